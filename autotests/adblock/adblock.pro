@@ -1,9 +1,12 @@
 TEMPLATE = subdirs
 SUBDIRS  = \
+    adblockautomaton \
     adblockmanager \
     adblocknetwork \
     adblockpage \
     adblockrule \
+    adblockruleindex \
+    adblockstringpool \
     adblocksubscription
 
 CONFIG += ordered
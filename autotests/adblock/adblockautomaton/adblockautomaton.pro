@@ -0,0 +1,10 @@
+TEMPLATE = app
+TARGET =
+DEPENDPATH += .
+INCLUDEPATH += .
+
+include(../../autotests.pri)
+
+# Input
+SOURCES += tst_adblockautomaton.cpp
+HEADERS +=
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2009 Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include <qtest.h>
+
+#include "adblockautomaton.h"
+
+#include <qdebug.h>
+
+class tst_AdBlockAutomaton : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+private slots:
+    void addKeyword();
+    void search_data();
+    void search();
+};
+
+// This will be called before the first test function is executed.
+// It is only called once.
+void tst_AdBlockAutomaton::initTestCase()
+{
+}
+
+// This will be called after the last test function is executed.
+// It is only called once.
+void tst_AdBlockAutomaton::cleanupTestCase()
+{
+}
+
+// This will be called before each test function is executed.
+void tst_AdBlockAutomaton::init()
+{
+}
+
+// This will be called after every test function.
+void tst_AdBlockAutomaton::cleanup()
+{
+}
+
+void tst_AdBlockAutomaton::addKeyword()
+{
+    AdBlockAutomaton automaton;
+    QCOMPARE(automaton.keywordCount(), 0);
+    QCOMPARE(automaton.addKeyword(QLatin1String("ads")), 0);
+    QCOMPARE(automaton.addKeyword(QLatin1String("banner")), 1);
+    QCOMPARE(automaton.addKeyword(QLatin1String("ads")), 0);
+    QCOMPARE(automaton.keywordCount(), 2);
+    QCOMPARE(automaton.keywordId(QLatin1String("banner")), 1);
+    QCOMPARE(automaton.keywordId(QLatin1String("foo")), -1);
+    QVERIFY(!automaton.isBuilt());
+    automaton.build();
+    QVERIFY(automaton.isBuilt());
+    automaton.addKeyword(QLatin1String("foo"));
+    QVERIFY(!automaton.isBuilt());
+    automaton.clear();
+    QCOMPARE(automaton.keywordCount(), 0);
+}
+
+void tst_AdBlockAutomaton::search_data()
+{
+    QTest::addColumn<QStringList>("keywords");
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QStringList>("found");
+
+    QTest::newRow("null") << QStringList() << QString() << QStringList();
+    QTest::newRow("empty") << (QStringList() << "ads") << QString() << QStringList();
+    QTest::newRow("none") << (QStringList() << "ads") << QString("http://example.com/") << QStringList();
+    QTest::newRow("one") << (QStringList() << "ads") << QString("http://example.com/ads/")
+                         << (QStringList() << "ads");
+    QTest::newRow("twice") << (QStringList() << "ads") << QString("ads/ads")
+                           << (QStringList() << "ads" << "ads");
+    // keywords that are suffixes or prefixes of each other
+    QTest::newRow("nested") << (QStringList() << "he" << "she" << "his" << "hers")
+                            << QString("ushers")
+                            << (QStringList() << "he" << "hers" << "she");
+    QTest::newRow("fail") << (QStringList() << "abcd" << "bcx")
+                          << QString("abcx")
+                          << (QStringList() << "bcx");
+    QTest::newRow("overlap") << (QStringList() << "aa")
+                             << QString("aaa")
+                             << (QStringList() << "aa" << "aa");
+}
+
+// public void search(QString const &text, QVector<int> &keywordIds) const
+void tst_AdBlockAutomaton::search()
+{
+    QFETCH(QStringList, keywords);
+    QFETCH(QString, text);
+    QFETCH(QStringList, found);
+
+    AdBlockAutomaton automaton;
+    foreach (const QString &keyword, keywords)
+        automaton.addKeyword(keyword);
+    automaton.build();
+
+    QVector<int> ids;
+    automaton.search(text, ids);
+    QStringList result;
+    foreach (int id, ids)
+        result.append(keywords.at(id));
+    result.sort();
+    QCOMPARE(result, found);
+}
+
+QTEST_MAIN(tst_AdBlockAutomaton)
+#include "tst_adblockautomaton.moc"
+
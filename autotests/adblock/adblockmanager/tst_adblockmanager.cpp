@@ -32,6 +32,7 @@
 
 #include "adblockdialog.h"
 #include "adblockmanager.h"
+#include "adblockrule.h"
 #include "adblocksubscription.h"
 
 #include <qdebug.h>
@@ -58,6 +59,8 @@ private slots:
     void removeSubscription();
     void showDialog();
     void rulesChanged();
+    void block();
+    void statistics();
 };
 
 // Subclass that exposes the protected functions.
@@ -233,6 +236,89 @@ void tst_AdBlockManager::rulesChanged()
     QCOMPARE(spy0.count(), 3);
 }
 
+// public AdBlockRule const *block(QString const &urlString) const
+void tst_AdBlockManager::block()
+{
+    SubAdBlockManager manager;
+
+    AdBlockSubscription *first = new AdBlockSubscription(QUrl(), &manager);
+    first->setEnabled(true);
+    first->addRule(AdBlockRule("/arora-test/*"));
+    manager.addSubscription(first);
+
+    AdBlockSubscription *second = new AdBlockSubscription(QUrl(), &manager);
+    second->setEnabled(true);
+    second->addRule(AdBlockRule("/arora-test/*"));
+    manager.addSubscription(second);
+
+    QString url = "http://example.com/arora-test/banner.gif";
+    const AdBlockRule *rule = manager.block(url);
+    QVERIFY(rule);
+    QCOMPARE(manager.subscription(rule), first);
+    QVERIFY(!manager.allow(url));
+
+    // the same filter from the second subscription takes over
+    first->setEnabled(false);
+    rule = manager.block(url);
+    QVERIFY(rule);
+    QCOMPARE(manager.subscription(rule), second);
+
+    // an exception in any subscription wins
+    first->setEnabled(true);
+    second->addRule(AdBlockRule("@@banner.gif"));
+    rule = manager.allow(url);
+    QVERIFY(rule);
+    QCOMPARE(manager.subscription(rule), second);
+
+    manager.removeSubscription(second);
+    QVERIFY(!manager.allow(url));
+    rule = manager.block(url);
+    QVERIFY(rule);
+    QCOMPARE(manager.subscription(rule), first);
+
+    manager.removeSubscription(first);
+    QVERIFY(!manager.block(url));
+}
+
+void tst_AdBlockManager::statistics()
+{
+    SubAdBlockManager manager;
+    manager.setStatisticsEnabled(true);
+    QVERIFY(manager.isStatisticsEnabled());
+
+    AdBlockSubscription *subscription = new AdBlockSubscription(QUrl(), &manager);
+    subscription->setEnabled(true);
+    subscription->addRule(AdBlockRule("/arora-test/*"));
+    subscription->addRule(AdBlockRule("/arora-unused/*"));
+    manager.addSubscription(subscription);
+
+    QString url = "http://example.com/arora-test/banner.gif";
+    const AdBlockRule *rule = manager.block(url);
+    QVERIFY(rule);
+    QCOMPARE(rule->evaluationCount(), 1);
+    QCOMPARE(rule->hitCount(), 0);
+    rule->addHit();
+    QCOMPARE(subscription->hitCount(), 1);
+
+    // the rules that never hit come first
+    const AdBlockRule *unused = subscription->rule(1);
+    QCOMPARE(unused->hitCount(), 0);
+    QString report = manager.statisticsReport();
+    QVERIFY(report.contains(rule->filter()));
+    QVERIFY(report.indexOf(unused->filter()) < report.indexOf(rule->filter()));
+
+    // an updated rule starts again
+    AdBlockRule changed = *rule;
+    changed.setFilter("/arora-changed/*");
+    subscription->replaceRule(changed, 0);
+    QCOMPARE(subscription->rule(0)->hitCount(), 0);
+
+    manager.setStatisticsEnabled(false);
+    QVERIFY(!manager.isStatisticsEnabled());
+    manager.block("http://example.com/arora-changed/banner.gif");
+    QCOMPARE(subscription->rule(0)->evaluationCount(), 0);
+}
+
 QTEST_MAIN(tst_AdBlockManager)
 #include "tst_adblockmanager.moc"
 
@@ -32,6 +32,7 @@
 #include "adblockmanager.h"
 #include "adblocksubscription.h"
 #include "adblockrule.h"
+#include "webpageproxy.h"
 
 #include <qnetworkrequest.h>
 
@@ -56,6 +57,9 @@ private slots:
 
     void block_data();
     void block();
+    void navigation_data();
+    void navigation();
+    void cache();
 };
 
 // Subclass that exposes the protected functions.
@@ -189,9 +193,31 @@ void tst_AdBlockNetwork::block_data()
                                 << QUrl("http://example.com/advice.html")
                                 << false;
 
+    // request types are guessed from the url
+    QTest::newRow("type0") << QString("/ads/*$script")
+                           << QUrl("http://example.com/ads/track.js")
+                           << true;
+    QTest::newRow("type1") << QString("/ads/*$script")
+                           << QUrl("http://example.com/ads/banner.gif")
+                           << false;
+    QTest::newRow("type2") << QString("/ads/*$~image")
+                           << QUrl("http://example.com/ads/banner.gif")
+                           << false;
+    QTest::newRow("type3") << QString("/ads/*$~image")
+                           << QUrl("http://example.com/ads/page.html")
+                           << true;
+
     QTest::newRow("order0") << QString("advice,@@advice")
                             << QUrl("http://example.com/advice.html")
                             << false;
+
+    // without a page a request is not third party
+    QTest::newRow("party0") << QString("||example.com^$third-party")
+                            << QUrl("http://example.com/ads/track.js")
+                            << false;
+    QTest::newRow("party1") << QString("||example.com^$~third-party")
+                            << QUrl("http://example.com/ads/track.js")
+                            << true;
 }
 
 // public QNetworkReply *block(QNetworkRequest const &request)
@@ -219,6 +245,74 @@ void tst_AdBlockNetwork::block()
     QCOMPARE(blocked, block);
 }
 
+void tst_AdBlockNetwork::navigation_data()
+{
+    QTest::addColumn<QString>("rule");
+    QTest::addColumn<bool>("subFrame");
+    QTest::addColumn<bool>("block");
+
+    QTest::newRow("page") << QString("/ads/*$subdocument") << false << false;
+    QTest::newRow("frame") << QString("/ads/*$subdocument") << true << true;
+    QTest::newRow("page ~subdocument") << QString("/ads/*$~subdocument") << false << true;
+    QTest::newRow("frame ~subdocument") << QString("/ads/*$~subdocument") << true << false;
+}
+
+// only the navigations of frames inside a page are subdocuments
+void tst_AdBlockNetwork::navigation()
+{
+    QFETCH(QString, rule);
+    QFETCH(bool, subFrame);
+    QFETCH(bool, block);
+
+    SubAdBlockNetwork network;
+
+    AdBlockManager *manager = AdBlockManager::instance();
+    manager->setEnabled(true);
+
+    AdBlockSubscription *subscription = new AdBlockSubscription(QUrl(), manager);
+    subscription->setEnabled(true);
+    manager->addSubscription(subscription);
+    subscription->addRule(AdBlockRule(rule));
+
+    QNetworkRequest request(QUrl("http://example.com/ads/frame.html"));
+    request.setAttribute((QNetworkRequest::Attribute)(WebPageProxy::pageAttributeId() + 1), 0);
+    if (subFrame)
+        request.setAttribute((QNetworkRequest::Attribute)(WebPageProxy::pageAttributeId() + 2), true);
+    QCOMPARE(network.block(request) != 0, block);
+}
+
+// decisions are cached until the rules change
+void tst_AdBlockNetwork::cache()
+{
+    SubAdBlockNetwork network;
+
+    AdBlockManager *manager = AdBlockManager::instance();
+    manager->setEnabled(true);
+
+    AdBlockSubscription *subscription = new AdBlockSubscription(QUrl(), manager);
+    subscription->setEnabled(true);
+    manager->addSubscription(subscription);
+    subscription->addRule(AdBlockRule("/ads/"));
+
+    QNetworkRequest request(QUrl("http://example.com/ads/banner.gif"));
+    QVERIFY(network.block(request));
+    QVERIFY(network.block(request));
+    QVERIFY(!network.block(QNetworkRequest(QUrl("http://example.com/index.html"))));
+    QCOMPARE(network.cacheMisses(), 2);
+    QCOMPARE(network.cacheHits(), 1);
+
+    subscription->addRule(AdBlockRule("@@banner.gif"));
+    QVERIFY(!network.block(request));
+    QCOMPARE(network.cacheMisses(), 3);
+
+    network.setCacheSize(1);
+    QCOMPARE(network.cacheSize(), 1);
+    QVERIFY(!network.block(QNetworkRequest(QUrl("http://example.com/index.html"))));
+    QVERIFY(!network.block(request));
+    QCOMPARE(network.cacheMisses(), 5);
+    QCOMPARE(network.cacheHits(), 1);
+}
+
 QTEST_MAIN(tst_AdBlockNetwork)
 #include "tst_adblocknetwork.moc"
 
@@ -36,6 +36,7 @@
 #include "adblocksubscription.h"
 #include "adblockrule.h"
 
+#include <qwebelement.h>
 #include <qwebview.h>
 #include <qwebframe.h>
 #include <qdebug.h>
@@ -57,6 +58,8 @@ private slots:
 
     void applyRulesToPage_data();
     void applyRulesToPage();
+    void styleSheet_data();
+    void styleSheet();
 };
 
 // Subclass that exposes the protected functions.
@@ -66,6 +69,17 @@ public:
 
 };
 
+// The number of elements in the body that are not hidden
+static int visibleCount(QWebFrame *frame)
+{
+    int count = 0;
+    foreach (QWebElement element, frame->documentElement().findAll("body > *")) {
+        if (element.styleProperty("display", QWebElement::ComputedStyle) != "none")
+            ++count;
+    }
+    return count;
+}
+
 // This will be called before the first test function is executed.
 // It is only called once.
 void tst_AdBlockPage::initTestCase()
@@ -150,9 +164,63 @@ void tst_AdBlockPage::applyRulesToPage()
 
     SubAdBlockPage page;
     page.applyRulesToPage(view.page());
-    if (view.page()->mainFrame()->toHtml().count("tofu") != count)
+    if (visibleCount(view.page()->mainFrame()) != count)
         qDebug() << view.page()->mainFrame()->toHtml();
-    QCOMPARE(view.page()->mainFrame()->toHtml().count("tofu"), count);
+    QCOMPARE(visibleCount(view.page()->mainFrame()), count);
+}
+
+void tst_AdBlockPage::styleSheet_data()
+{
+    QTest::addColumn<QStringList>("rules");
+    QTest::addColumn<QString>("host");
+    QTest::addColumn<QStringList>("selectors");
+
+    QTest::newRow("null") << QStringList() << QString("example.com") << QStringList();
+    QTest::newRow("generic") << (QStringList() << "##div.ad")
+        << QString("example.com") << (QStringList() << "div.ad");
+    QTest::newRow("duplicate") << (QStringList() << "##div.ad" << "##div.ad")
+        << QString("example.com") << (QStringList() << "div.ad");
+    QTest::newRow("domain") << (QStringList() << "example.com##div.ad" << "example.org##div.banner")
+        << QString("example.com") << (QStringList() << "div.ad");
+    QTest::newRow("subdomain") << (QStringList() << "example.com##div.ad")
+        << QString("www.Example.com") << (QStringList() << "div.ad");
+    QTest::newRow("suffix") << (QStringList() << "example.com##div.ad")
+        << QString("badexample.com") << QStringList();
+    QTest::newRow("several domains") << (QStringList() << "example.com,www.example.com##div.ad")
+        << QString("www.example.com") << (QStringList() << "div.ad");
+    QTest::newRow("excluded") << (QStringList() << "example.com,~foo.example.com##div.ad")
+        << QString("foo.example.com") << QStringList();
+    QTest::newRow("excluded-other") << (QStringList() << "example.com,~foo.example.com##div.ad")
+        << QString("bar.example.com") << (QStringList() << "div.ad");
+    QTest::newRow("generic-excluded") << (QStringList() << "~example.com##div.ad")
+        << QString("example.com") << QStringList();
+    QTest::newRow("generic-excluded-other") << (QStringList() << "~example.com##div.ad")
+        << QString("example.org") << (QStringList() << "div.ad");
+    QTest::newRow("invalid") << (QStringList() << "##div.ad { color: red; }")
+        << QString("example.com") << QStringList();
+}
+
+// public QString styleSheet(QString const &host)
+void tst_AdBlockPage::styleSheet()
+{
+    QFETCH(QStringList, rules);
+    QFETCH(QString, host);
+    QFETCH(QStringList, selectors);
+
+    AdBlockManager *manager = AdBlockManager::instance();
+    manager->setEnabled(true);
+
+    AdBlockSubscription *subscription = new AdBlockSubscription(QUrl(), manager);
+    subscription->setEnabled(true);
+    manager->addSubscription(subscription);
+    foreach (const QString &rule, rules)
+        subscription->addRule(AdBlockRule(rule));
+
+    SubAdBlockPage page;
+    QStringList hidden;
+    foreach (const QString &line, page.styleSheet(host).split('\n', QString::SkipEmptyParts))
+        hidden.append(line.left(line.indexOf(" {")));
+    QCOMPARE(hidden, selectors);
 }
 
 QTEST_MAIN(tst_AdBlockPage)
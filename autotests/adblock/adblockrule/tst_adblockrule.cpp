@@ -23,6 +23,7 @@
 #include "adblockrule.h"
 
 #include <qbuffer.h>
+#include <qdatastream.h>
 #include <qdebug.h>
 
 class tst_AdBlockRule : public QObject
@@ -40,6 +41,11 @@ private slots:
     void regexpCreation();
     void networkMatch_data();
     void networkMatch();
+    void keywords_data();
+    void keywords();
+    void copy();
+    void requestMatch_data();
+    void requestMatch();
 
 };
 
@@ -380,6 +386,146 @@ void tst_AdBlockRule::regexpCreation()
      QCOMPARE(rule.regExpPattern(), output);
 }
 
+void tst_AdBlockRule::keywords_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QStringList>("keywords");
+
+    QTest::newRow("null") << QString() << QStringList();
+    QTest::newRow("k0") << QString("/adserver/*") << (QStringList() << "/adserver/");
+    QTest::newRow("k1") << QString("||example.com/banner.gif")
+                        << (QStringList() << "example.com/banner.gif");
+    QTest::newRow("k2") << QString("|http://ads.") << (QStringList() << "http://ads.");
+    QTest::newRow("k3") << QString("@@/AdServer/*$domain=example.com") << (QStringList() << "/adserver/");
+    QTest::newRow("k4") << QString("^%D1%82^") << (QStringList() << "%d1%82");
+    QTest::newRow("k5") << QString("swf|") << (QStringList() << "swf");
+    QTest::newRow("k6") << QString("ad") << QStringList();
+    QTest::newRow("k7") << QString("/ads*banner.gif") << (QStringList() << "/ads" << "banner.gif");
+    QTest::newRow("k8") << QString("http://example.com^*^ad^") << (QStringList() << "http://example.com");
+    QTest::newRow("k9") << QString("/banner\\d+/") << QStringList();
+    QTest::newRow("k10") << QString("example.com##div.textad") << QStringList();
+}
+
+// public QStringList keywords() const
+void tst_AdBlockRule::keywords()
+{
+    QFETCH(QString, filter);
+    QFETCH(QStringList, keywords);
+
+    SubAdBlockRule rule(filter);
+    QCOMPARE(rule.keywords(), keywords);
+}
+
+// The regular expression is compiled lazily and not shared between copies
+void tst_AdBlockRule::copy()
+{
+    AdBlockRule rule("/banner\\d+/");
+    QVERIFY(rule.networkMatch("http://example.com/banner123.gif"));
+
+    AdBlockRule copy(rule);
+    QVERIFY(copy.networkMatch("http://example.com/banner123.gif"));
+    QVERIFY(copy.networkMatch("http://example.com/Banner123.gif"));
+    QVERIFY(!copy.networkMatch("http://example.com/banner.gif"));
+    QCOMPARE(copy.regExpPattern(), rule.regExpPattern());
+
+    AdBlockRule assigned;
+    assigned = rule;
+    rule.setFilter("/ad\\d+/");
+    QVERIFY(assigned.networkMatch("http://example.com/banner123.gif"));
+    QVERIFY(!rule.networkMatch("http://example.com/banner123.gif"));
+    QVERIFY(rule.networkMatch("http://example.com/ad1.gif"));
+}
+
+void tst_AdBlockRule::requestMatch_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QUrl>("url");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<QString>("firstPartyHost");
+    QTest::addColumn<bool>("networkMatch");
+
+    QUrl script("http://ads.example.net/ads/track.js");
+    QTest::newRow("type0") << QString("/ads/*$script") << script
+                           << int(AdBlockRule::ScriptRequest) << QString() << true;
+    QTest::newRow("type1") << QString("/ads/*$script,image") << script
+                           << int(AdBlockRule::ImageRequest) << QString() << true;
+    QTest::newRow("type2") << QString("/ads/*$script") << script
+                           << int(AdBlockRule::StyleSheetRequest) << QString() << false;
+    QTest::newRow("type3") << QString("/ads/*$~script") << script
+                           << int(AdBlockRule::ScriptRequest) << QString() << false;
+    QTest::newRow("type4") << QString("/ads/*$~script") << script
+                           << int(AdBlockRule::OtherRequest) << QString() << true;
+    QTest::newRow("type5") << QString("/ads/*$object_subrequest") << script
+                           << int(AdBlockRule::ObjectSubrequest) << QString() << true;
+
+    QTest::newRow("party0") << QString("/ads/*$third-party") << script
+                            << int(AdBlockRule::ScriptRequest) << QString("www.example.com") << true;
+    QTest::newRow("party1") << QString("/ads/*$third-party") << script
+                            << int(AdBlockRule::ScriptRequest) << QString("www.example.net") << false;
+    QTest::newRow("party2") << QString("/ads/*$~third-party") << script
+                            << int(AdBlockRule::ScriptRequest) << QString("example.net") << true;
+    QTest::newRow("party3") << QString("/ads/*$~third-party") << script
+                            << int(AdBlockRule::ScriptRequest) << QString("example.com") << false;
+    QTest::newRow("party4") << QString("/ads/*$third-party") << QUrl("http://ads.example.co.uk/ads/")
+                            << int(AdBlockRule::OtherRequest) << QString("www.example.co.uk") << false;
+    QTest::newRow("party5") << QString("/ads/*$third-party") << QUrl("http://static.orf.at/ads/")
+                            << int(AdBlockRule::ImageRequest) << QString("www.orf.at") << false;
+    QTest::newRow("party6") << QString("/ads/*$third-party") << QUrl("http://img.gmx.de/ads/")
+                            << int(AdBlockRule::ImageRequest) << QString("www.gmx.de") << false;
+    QTest::newRow("party7") << QString("/ads/*$third-party") << QUrl("http://img.web.de/ads/")
+                            << int(AdBlockRule::ImageRequest) << QString("web.de") << false;
+    QTest::newRow("party8") << QString("/ads/*$~third-party") << QUrl("http://static.orf.at/ads/")
+                            << int(AdBlockRule::ImageRequest) << QString("www.orf.at") << true;
+    QTest::newRow("party9") << QString("/ads/*$third-party") << QUrl("http://ads.other.co.uk/ads/")
+                            << int(AdBlockRule::OtherRequest) << QString("www.example.co.uk") << true;
+    QTest::newRow("party10") << QString("/ads/*$third-party") << QUrl("http://ads.gmx.net/ads/")
+                             << int(AdBlockRule::OtherRequest) << QString("www.gmx.de") << true;
+    QTest::newRow("party11") << QString("/ads/*$third-party") << QUrl("http://10.0.0.2/ads/")
+                             << int(AdBlockRule::OtherRequest) << QString("10.0.0.1") << true;
+
+    // domains are the ones of the page, not of the request
+    QTest::newRow("domain0") << QString("/ads/*$domain=example.com") << script
+                             << int(AdBlockRule::ScriptRequest) << QString("www.example.com") << true;
+    QTest::newRow("domain1") << QString("/ads/*$domain=example.com") << script
+                             << int(AdBlockRule::ScriptRequest) << QString("example.org") << false;
+    QTest::newRow("domain2") << QString("/ads/*$domain=example.com|~foo.example.com") << script
+                             << int(AdBlockRule::ScriptRequest) << QString("foo.example.com") << false;
+    QTest::newRow("domain3") << QString("/ads/*$domain=~example.com|bar.example.com") << script
+                             << int(AdBlockRule::ScriptRequest) << QString("bar.example.com") << true;
+    QTest::newRow("domain4") << QString("/ads/*$domain=EXAMPLE.com") << script
+                             << int(AdBlockRule::ScriptRequest) << QString("Example.COM") << true;
+
+    QTest::newRow("unsupported") << QString("/ads/*$popup") << script
+                                 << int(AdBlockRule::ScriptRequest) << QString() << false;
+}
+
+// public bool networkMatch(AdBlockRequest const &request) const
+void tst_AdBlockRule::requestMatch()
+{
+    QFETCH(QString, filter);
+    QFETCH(QUrl, url);
+    QFETCH(int, type);
+    QFETCH(QString, firstPartyHost);
+    QFETCH(bool, networkMatch);
+
+    AdBlockRule rule(filter);
+    AdBlockRequest request(QString::fromUtf8(url.toEncoded()), type, firstPartyHost);
+    QCOMPARE(rule.networkMatch(request), networkMatch);
+
+    // the parsed options survive copying and the cache
+    AdBlockRule copy(rule);
+    QCOMPARE(copy.networkMatch(request), networkMatch);
+    QByteArray data;
+    {
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out << rule;
+    }
+    QDataStream in(data);
+    AdBlockRule cached;
+    in >> cached;
+    QCOMPARE(cached.networkMatch(request), networkMatch);
+}
+
 QTEST_MAIN(tst_AdBlockRule)
 #include "tst_adblockrule.moc"
 
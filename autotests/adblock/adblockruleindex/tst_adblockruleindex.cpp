@@ -0,0 +1,270 @@
+/*
+ * Copyright 2009 Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include <qtest.h>
+
+#include "adblockrule.h"
+#include "adblockruleindex.h"
+
+#include <qdatastream.h>
+#include <qdebug.h>
+
+class tst_AdBlockRuleIndex : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+private slots:
+    void match_data();
+    void match();
+    void clear();
+    void removeRule();
+    void pendingRules();
+    void removeKeywords();
+    void saveLoad();
+};
+
+// This will be called before the first test function is executed.
+// It is only called once.
+void tst_AdBlockRuleIndex::initTestCase()
+{
+}
+
+// This will be called after the last test function is executed.
+// It is only called once.
+void tst_AdBlockRuleIndex::cleanupTestCase()
+{
+}
+
+// This will be called before each test function is executed.
+void tst_AdBlockRuleIndex::init()
+{
+}
+
+// This will be called after every test function.
+void tst_AdBlockRuleIndex::cleanup()
+{
+}
+
+void tst_AdBlockRuleIndex::match_data()
+{
+    QTest::addColumn<QStringList>("filters");
+    QTest::addColumn<QUrl>("url");
+    QTest::addColumn<QString>("matchedFilter");
+
+    QTest::newRow("null") << QStringList() << QUrl() << QString();
+    QTest::newRow("empty") << QStringList() << QUrl("http://example.com/") << QString();
+
+    QStringList filters;
+    filters << QLatin1String("||example.com/banner.gif")
+            << QLatin1String("/adserver/*")
+            << QLatin1String("ad")
+            << QLatin1String("/banner\\d+/")
+            << QLatin1String("swf|");
+
+    // keyword rules
+    QTest::newRow("t0") << filters << QUrl("http://www.example.com/banner.gif")
+                        << QString("||example.com/banner.gif");
+    QTest::newRow("t1") << filters << QUrl("http://foo.com/adserver/x.js")
+                        << QString("/adserver/*");
+    QTest::newRow("t2") << filters << QUrl("http://notexample.com/banner.gif")
+                        << QString();
+    QTest::newRow("t3") << filters << QUrl("http://FOO.com/AdServer/x.js")
+                        << QString("/adserver/*");
+
+    // rules without a keyword end up in the fallback bucket
+    QTest::newRow("f0") << filters << QUrl("http://foo.com/advice.html")
+                        << QString("ad");
+    QTest::newRow("f1") << filters << QUrl("http://foo.com/banner123")
+                        << QString("/banner\\d+/");
+    QTest::newRow("f2") << filters << QUrl("http://foo.com/index.html")
+                        << QString();
+
+    // the keyword is found but the anchors do not match
+    QTest::newRow("a0") << filters << QUrl("http://foo.com/annoyingflash.swf")
+                        << QString("swf|");
+    QTest::newRow("a1") << filters << QUrl("http://foo.com/swf/index.html")
+                        << QString();
+    QTest::newRow("a2") << filters << QUrl("http://foo.com/?http://example.com/banner.gif")
+                        << QString();
+}
+
+// public AdBlockRule const *match(QString const &encodedUrl) const
+void tst_AdBlockRuleIndex::match()
+{
+    QFETCH(QStringList, filters);
+    QFETCH(QUrl, url);
+    QFETCH(QString, matchedFilter);
+
+    QList<AdBlockRule> rules;
+    foreach (const QString &filter, filters)
+        rules.append(AdBlockRule(filter));
+
+    AdBlockRuleIndex index;
+    for (int i = 0; i < rules.count(); ++i)
+        index.addRule(&rules.at(i));
+    QCOMPARE(index.count(), rules.count());
+
+    const AdBlockRule *rule = index.match(QString::fromUtf8(url.toEncoded()));
+    QCOMPARE(rule ? rule->filter() : QString(), matchedFilter);
+}
+
+void tst_AdBlockRuleIndex::clear()
+{
+    AdBlockRule rule(QLatin1String("/adserver/*"));
+    AdBlockRuleIndex index;
+    index.addRule(&rule);
+    QCOMPARE(index.count(), 1);
+    QVERIFY(index.match(QLatin1String("http://foo.com/adserver/")) != 0);
+    index.clear();
+    QCOMPARE(index.count(), 0);
+    QVERIFY(index.match(QLatin1String("http://foo.com/adserver/")) == 0);
+}
+
+void tst_AdBlockRuleIndex::removeRule()
+{
+    AdBlockRule rule(QLatin1String("/adserver/*"));
+    AdBlockRule otherRule(QLatin1String("||example.com^"));
+    AdBlockRule fallbackRule(QLatin1String("ad"));
+    AdBlockRuleIndex index;
+    index.addRule(&rule);
+    index.addRule(&otherRule);
+    index.addRule(&fallbackRule);
+    index.addRule(&rule);
+    QCOMPARE(index.count(), 3);
+    QVERIFY(index.contains(&rule));
+
+    index.removeRule(&rule);
+    QCOMPARE(index.count(), 2);
+    QVERIFY(!index.contains(&rule));
+    QVERIFY(index.match(QLatin1String("http://foo.com/adserver/")) == &fallbackRule);
+    index.removeRule(&fallbackRule);
+    QVERIFY(index.match(QLatin1String("http://foo.com/adserver/")) == 0);
+    QVERIFY(index.match(QLatin1String("http://example.com/")) == &otherRule);
+
+    index.addRule(&rule);
+    QVERIFY(index.match(QLatin1String("http://foo.com/adserver/")) == &rule);
+    index.removeRule(&rule);
+    index.removeRule(&rule);
+    QCOMPARE(index.count(), 1);
+}
+
+// rules added after the first match do not rebuild the automaton each time
+void tst_AdBlockRuleIndex::pendingRules()
+{
+    QList<AdBlockRule*> rules;
+    for (int i = 0; i < 40; ++i)
+        rules.append(new AdBlockRule(QString(QLatin1String("/banner%1/*")).arg(i)));
+
+    AdBlockRuleIndex index;
+    index.addRule(rules.at(0));
+    QVERIFY(index.match(QLatin1String("http://foo.com/banner0/")) == rules.at(0));
+
+    for (int i = 1; i < rules.count(); ++i) {
+        index.addRule(rules.at(i));
+        QString url = QString(QLatin1String("http://foo.com/banner%1/")).arg(i);
+        QVERIFY(index.match(url) == rules.at(i));
+    }
+    QCOMPARE(index.count(), rules.count());
+
+    index.removeRule(rules.at(39));
+    QVERIFY(index.match(QLatin1String("http://foo.com/banner39/")) == 0);
+    index.build();
+    for (int i = 0; i < rules.count() - 1; ++i) {
+        QString url = QString(QLatin1String("http://foo.com/banner%1/")).arg(i);
+        QVERIFY(index.match(url) == rules.at(i));
+    }
+    qDeleteAll(rules);
+}
+
+// the keywords of removed rules are dropped once there are enough of them
+void tst_AdBlockRuleIndex::removeKeywords()
+{
+    QList<AdBlockRule*> rules;
+    for (int i = 0; i < 40; ++i)
+        rules.append(new AdBlockRule(QString(QLatin1String("/banner%1/*")).arg(i)));
+
+    AdBlockRuleIndex index;
+    for (int i = 0; i < rules.count(); ++i)
+        index.addRule(rules.at(i));
+    QVERIFY(index.match(QLatin1String("http://foo.com/banner0/")) == rules.at(0));
+    QCOMPARE(index.keywordCount(), 40);
+
+    // the automaton is built again after the 17th empty keyword
+    for (int i = 0; i < 16; ++i)
+        index.removeRule(rules.at(i));
+    QCOMPARE(index.keywordCount(), 40);
+    index.removeRule(rules.at(16));
+    QCOMPARE(index.keywordCount(), 23);
+    QCOMPARE(index.count(), 23);
+
+    for (int i = 0; i < rules.count(); ++i) {
+        QString url = QString(QLatin1String("http://foo.com/banner%1/")).arg(i);
+        QVERIFY(index.match(url) == (i < 17 ? 0 : rules.at(i)));
+    }
+    qDeleteAll(rules);
+}
+
+// an index read back matches like the one that was written
+void tst_AdBlockRuleIndex::saveLoad()
+{
+    QList<AdBlockRule*> rules;
+    rules.append(new AdBlockRule(QLatin1String("/banner/*")));
+    rules.append(new AdBlockRule(QLatin1String("||example.com/ads/")));
+    rules.append(new AdBlockRule(QLatin1String("/unused/*")));
+    rules.append(new AdBlockRule(QLatin1String("/ad\\d+/")));
+
+    QHash<const AdBlockRule*, int> ruleOffsets;
+    AdBlockRuleIndex index;
+    for (int i = 0; i < rules.count(); ++i) {
+        index.addRule(rules.at(i));
+        ruleOffsets.insert(rules.at(i), i);
+    }
+    index.removeRule(rules.at(2));
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    index.save(out, ruleOffsets);
+
+    AdBlockRuleIndex loaded;
+    QDataStream in(data);
+    QVERIFY(loaded.load(in, rules));
+    QCOMPARE(loaded.count(), 3);
+    QCOMPARE(loaded.keywordCount(), index.keywordCount());
+    QVERIFY(!loaded.contains(rules.at(2)));
+    QVERIFY(loaded.match(QLatin1String("http://foo.com/banner/1.gif")) == rules.at(0));
+    QVERIFY(loaded.match(QLatin1String("http://example.com/ads/1.gif")) == rules.at(1));
+    QVERIFY(loaded.match(QLatin1String("http://foo.com/ad12")) == rules.at(3));
+    QVERIFY(!loaded.match(QLatin1String("http://foo.com/unused/1.gif")));
+
+    // offsets that are not in the list of rules are rejected
+    QDataStream truncated(data);
+    QVERIFY(!loaded.load(truncated, rules.mid(0, 1)));
+    QCOMPARE(loaded.count(), 0);
+    qDeleteAll(rules);
+}
+
+QTEST_MAIN(tst_AdBlockRuleIndex)
+#include "tst_adblockruleindex.moc"
+
@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <qtest.h>
+
+#include "adblockrule.h"
+#include "adblockstringpool.h"
+
+#include <qdebug.h>
+
+class tst_AdBlockStringPool : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+private slots:
+    void intern_data();
+    void intern();
+    void squeeze();
+    void internStrings();
+};
+
+// This will be called before the first test function is executed.
+// It is only called once.
+void tst_AdBlockStringPool::initTestCase()
+{
+}
+
+// This will be called after the last test function is executed.
+// It is only called once.
+void tst_AdBlockStringPool::cleanupTestCase()
+{
+}
+
+// This will be called before each test function is executed.
+void tst_AdBlockStringPool::init()
+{
+}
+
+// This will be called after every test function.
+void tst_AdBlockStringPool::cleanup()
+{
+}
+
+void tst_AdBlockStringPool::intern_data()
+{
+    QTest::addColumn<QStringList>("strings");
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("none") << QStringList() << 0;
+    QTest::newRow("empty") << (QStringList() << QString() << QString("")) << 0;
+    QTest::newRow("one") << (QStringList() << "example.com") << 1;
+    QTest::newRow("same") << (QStringList() << "example.com" << "example.com") << 1;
+    QTest::newRow("different") << (QStringList() << "example.com" << "example.org" << "example.com") << 2;
+}
+
+// public QString intern(QString const &string)
+void tst_AdBlockStringPool::intern()
+{
+    QFETCH(QStringList, strings);
+    QFETCH(int, count);
+
+    AdBlockStringPool pool;
+    QStringList interned;
+    foreach (const QString &string, strings) {
+        // a copy that does not share its data with the test data
+        QString copy = QString(string.unicode(), string.length());
+        interned.append(pool.intern(copy));
+        QCOMPARE(interned.last(), string);
+    }
+    QCOMPARE(pool.count(), count);
+
+    for (int i = 0; i < interned.count(); ++i) {
+        for (int j = 0; j < i; ++j) {
+            if (interned.at(i) == interned.at(j) && !interned.at(i).isEmpty())
+                QCOMPARE(interned.at(i).constData(), interned.at(j).constData());
+        }
+    }
+}
+
+// public void squeeze()
+void tst_AdBlockStringPool::squeeze()
+{
+    AdBlockStringPool pool;
+    QString used = pool.intern(QString("used.example.com"));
+    pool.intern(QString("unused.example.com"));
+    QCOMPARE(pool.count(), 2);
+
+    pool.squeeze();
+    QCOMPARE(pool.count(), 1);
+    QCOMPARE(pool.intern(QString("used.example.com")).constData(), used.constData());
+}
+
+// public void internStrings(AdBlockStringPool *pool)
+void tst_AdBlockStringPool::internStrings()
+{
+    AdBlockStringPool pool;
+    AdBlockRule first(QString("/banner/*$domain=example.com|example.org"));
+    AdBlockRule second(QString("/banner/*$domain=example.com|example.org"));
+    first.internStrings(&pool);
+    second.internStrings(&pool);
+    QCOMPARE(first.filter().constData(), second.filter().constData());
+    // the domains are numbered once for all rules, only the filter is pooled
+    QCOMPARE(pool.count(), 1);
+
+    // interning does not change what the rule matches
+    AdBlockRequest request("http://ads.net/banner/1.gif", AdBlockRule::ImageRequest, "www.example.com");
+    QVERIFY(first.networkMatch(request));
+    QVERIFY(!first.networkMatch(AdBlockRequest("http://ads.net/banner/1.gif", AdBlockRule::ImageRequest, "example.net")));
+
+    // a rule without options shares its pattern with the filter
+    AdBlockRule third(QString("/banner/*"));
+    third.internStrings(&pool);
+    QCOMPARE(third.filter(), QString("/banner/*"));
+    QVERIFY(third.networkMatch(QString("http://ads.net/banner/1.gif")));
+
+    first.internStrings(0);
+    QCOMPARE(pool.count(), 2);
+}
+
+QTEST_MAIN(tst_AdBlockStringPool)
+#include "tst_adblockstringpool.moc"
+
@@ -33,6 +33,9 @@
 #include <adblocksubscription.h>
 
 #include <qdir.h>
+#include <qfile.h>
+#include <qtcpserver.h>
+#include <qtcpsocket.h>
 
 class tst_AdBlockSubscription : public QObject
 {
@@ -64,6 +67,69 @@ private slots:
     void block();
     void addRule();
     void removeRule();
+    void cache();
+    void rule();
+    void conditionalUpdate();
+};
+
+/*
+    A minimal http server that serves one list with an ETag and answers
+    a matching If-None-Match with 304 Not Modified.
+ */
+class ListServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    ListServer(const QByteArray &list, const QByteArray &entityTag)
+        : m_list(list), m_entityTag(entityTag)
+    {
+        connect(this, SIGNAL(newConnection()), this, SLOT(acceptConnection()));
+        listen(QHostAddress::LocalHost);
+    }
+
+    QUrl url() const
+        { return QUrl(QString("http://127.0.0.1:%1/list.txt").arg(serverPort())); }
+
+    QList<QByteArray> requests;
+
+private slots:
+    void acceptConnection()
+    {
+        while (hasPendingConnections()) {
+            QTcpSocket *socket = nextPendingConnection();
+            connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+            connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        }
+    }
+
+    void readRequest()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+        socket->setProperty("request", request);
+        if (!request.contains("\r\n\r\n"))
+            return;
+        requests.append(request);
+
+        if (request.contains("If-None-Match: " + m_entityTag + "\r\n")) {
+            socket->write("HTTP/1.1 304 Not Modified\r\nConnection: close\r\n\r\n");
+        } else {
+            socket->write("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nETag: " + m_entityTag
+                          + "\r\nContent-Length: " + QByteArray::number(m_list.size())
+                          + "\r\nConnection: close\r\n\r\n");
+            // send the list in pieces that split lines
+            for (int i = 0; i < m_list.size(); i += 7) {
+                socket->write(m_list.mid(i, 7));
+                socket->flush();
+            }
+        }
+        socket->disconnectFromHost();
+    }
+
+private:
+    QByteArray m_list;
+    QByteArray m_entityTag;
 };
 
 // Subclass that exposes the protected functions.
@@ -169,6 +235,7 @@ void tst_AdBlockSubscription::allow()
     subscription.setLocation(QUrl::fromLocalFile(QDir::currentPath() + "/rules.txt"));
     subscription.setEnabled(true);
     subscription.updateNow();
+    QTRY_VERIFY(subscription.ruleCount() > 0);
 
     const AdBlockRule *rule = subscription.allow(QString::fromUtf8(url.toEncoded()));
     if (rule)
@@ -194,6 +261,7 @@ void tst_AdBlockSubscription::block()
     subscription.setLocation(QUrl::fromLocalFile(QDir::currentPath() + "/rules.txt"));
     subscription.setEnabled(true);
     subscription.updateNow();
+    QTRY_VERIFY(subscription.ruleCount() > 0);
 
     const AdBlockRule *rule = subscription.block(QString::fromUtf8(url.toEncoded()));
     if (rule)
@@ -352,6 +420,138 @@ void tst_AdBlockSubscription::removeRule()
     QCOMPARE(subscription.allRules().count(), 0);
 }
 
+static void writeRules(const QString &fileName, const QStringList &filters)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write("[Adblock Plus 0.7.1]\n");
+    foreach (const QString &filter, filters)
+        file.write(filter.toUtf8() + '\n');
+}
+
+// The second subscription is loaded from the cache written by the first
+void tst_AdBlockSubscription::cache()
+{
+    QString fileName = QDir::currentPath() + "/cache.txt";
+    QUrl location = QUrl::fromLocalFile(fileName);
+    writeRules(fileName, QStringList() << "||example.com/ads/" << "/banner\\d+/" << "@@advice" << "example.com##.ad");
+
+    // without a cache the list is parsed in another thread
+    SubAdBlockSubscription first;
+    first.setLocation(location);
+    first.setEnabled(true);
+    QSignalSpy loadedSpy(&first, SIGNAL(rulesLoaded()));
+    first.updateNow();
+    QCOMPARE(loadedSpy.count(), 0);
+    QTRY_COMPARE(loadedSpy.count(), 1);
+    QCOMPARE(first.ruleCount(), 4);
+
+    SubAdBlockSubscription second;
+    second.setLocation(location);
+    second.setEnabled(true);
+    QSignalSpy spy0(&second, SIGNAL(rulesChanged()));
+    second.updateNow();
+    QCOMPARE(spy0.count(), 1);
+
+    QCOMPARE(second.allRules().count(), first.allRules().count());
+    for (int i = 0; i < first.allRules().count(); ++i) {
+        AdBlockRule rule = first.allRules().at(i);
+        AdBlockRule cachedRule = second.allRules().at(i);
+        QCOMPARE(cachedRule.filter(), rule.filter());
+        QCOMPARE(cachedRule.regExpPattern(), rule.regExpPattern());
+        QCOMPARE(cachedRule.isException(), rule.isException());
+        QCOMPARE(cachedRule.isCSSRule(), rule.isCSSRule());
+    }
+    QCOMPARE(second.pageRules().count(), 1);
+    QVERIFY(second.block("http://example.com/ads/banner.gif"));
+    QVERIFY(second.block("http://example.org/banner123.gif"));
+    QVERIFY(!second.block("http://example.org/index.html"));
+    QVERIFY(second.allow("http://example.com/ads/advice.html"));
+
+    // changing the rules file makes the cache out of date
+    writeRules(fileName, QStringList() << "/tracker.js");
+    SubAdBlockSubscription third;
+    third.setLocation(location);
+    third.setEnabled(true);
+    third.updateNow();
+    QTRY_COMPARE(third.allRules().count(), 1);
+    QVERIFY(third.block("http://example.org/tracker.js"));
+    QVERIFY(!third.block("http://example.com/ads/banner.gif"));
+
+    QFile::remove(fileName);
+}
+
+// rules keep their address while other rules are added, removed or replaced
+void tst_AdBlockSubscription::rule()
+{
+    SubAdBlockSubscription subscription;
+    subscription.setEnabled(true);
+    subscription.addRule(AdBlockRule("/first/*"));
+    subscription.addRule(AdBlockRule("/banner/*"));
+    subscription.addRule(AdBlockRule("/last/*"));
+    QCOMPARE(subscription.ruleCount(), 3);
+    QVERIFY(!subscription.rule(-1));
+    QVERIFY(!subscription.rule(3));
+
+    const AdBlockRule *banner = subscription.rule(1);
+    QCOMPARE(subscription.block("http://example.com/banner/ad.gif"), banner);
+
+    subscription.removeRule(0);
+    subscription.addRule(AdBlockRule("/other/*"));
+    QCOMPARE(subscription.rule(0), banner);
+    QCOMPARE(subscription.block("http://example.com/banner/ad.gif"), banner);
+    QVERIFY(!subscription.block("http://example.com/first/ad.gif"));
+    QVERIFY(subscription.block("http://example.com/other/ad.gif"));
+
+    subscription.replaceRule(AdBlockRule("/ads/*"), 0);
+    QCOMPARE(subscription.rule(0), banner);
+    QCOMPARE(banner->filter(), QString("/ads/*"));
+    QVERIFY(!subscription.block("http://example.com/banner/ad.gif"));
+    QCOMPARE(subscription.block("http://example.com/ads/ad.gif"), banner);
+
+    AdBlockRule disabled("/ads/*");
+    disabled.setEnabled(false);
+    subscription.replaceRule(disabled, 0);
+    QVERIFY(!subscription.block("http://example.com/ads/ad.gif"));
+}
+
+// An unchanged list is not downloaded or parsed again
+void tst_AdBlockSubscription::conditionalUpdate()
+{
+    ListServer server("[Adblock Plus 0.7.1]\n/banner/*\r\n@@/banner/advice\n||example.com/ads/", "\"arora-test\"");
+    QVERIFY(server.isListening());
+
+    SubAdBlockSubscription subscription;
+    subscription.setEnabled(true);
+    subscription.setLocation(server.url());
+    QSignalSpy spy0(&subscription, SIGNAL(rulesChanged()));
+    QSignalSpy spy1(&subscription, SIGNAL(changed()));
+
+    subscription.updateNow();
+    QTRY_COMPARE(spy0.count(), 1);
+    QCOMPARE(server.requests.count(), 1);
+    QVERIFY(!server.requests.at(0).contains("If-None-Match"));
+    QCOMPARE(subscription.ruleCount(), 3);
+    QCOMPARE(subscription.rule(0)->filter(), QString("/banner/*"));
+    QCOMPARE(subscription.rule(2)->filter(), QString("||example.com/ads/"));
+    QVERIFY(subscription.block("http://example.org/banner/ad.gif"));
+    QVERIFY(subscription.allow("http://example.org/banner/advice.html"));
+    QVERIFY(subscription.url().toString().contains("etag"));
+
+    // the etag is kept with the subscription
+    SubAdBlockSubscription restored(subscription.url());
+    QSignalSpy spy2(&restored, SIGNAL(rulesChanged()));
+    QSignalSpy spy3(&restored, SIGNAL(changed()));
+    QCOMPARE(restored.ruleCount(), 3);
+    int changedCount = spy3.count();
+    restored.updateNow();
+    QTRY_COMPARE(server.requests.count(), 2);
+    QVERIFY(server.requests.at(1).contains("If-None-Match: \"arora-test\""));
+    QTRY_COMPARE(spy3.count(), changedCount + 1);
+    QCOMPARE(spy2.count(), 0);
+    QCOMPARE(restored.ruleCount(), 3);
+    QVERIFY(restored.lastUpdate().isValid());
+}
 
 QTEST_MAIN(tst_AdBlockSubscription)
 #include "tst_adblocksubscription.moc"
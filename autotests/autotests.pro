@@ -3,6 +3,7 @@ SUBDIRS  = \
     adblock \
     addbookmarkdialog \
     autosaver \
+    benchmarks \
     cookiejar \
     historyfiltermodel \
     historymanager \
@@ -0,0 +1,367 @@
+#!/usr/bin/env python
+#
+# Generates the synthetic rule list and url trace used by the adblock
+# benchmark.  The output only depends on the seed, run it again after
+# changing it and commit both files.
+#
+# Every network rule contains one token that starts with 'q' and none of
+# the words the rest of the urls are made of do, which lets the reference
+# matcher below only look at the rules a url can possibly match.  The
+# number of blocked requests it finds is written into the trace and
+# checked by the benchmark.
+
+import random
+import re
+
+SEED = 2009
+BLOCK_RULES = 22000
+EXCEPTION_RULES = 1500
+REGEXP_RULES = 60
+HIDING_RULES = 15500
+COMMENTS = 900
+SITES = 40
+VISITS = 1000
+REQUESTS_PER_VISIT = 40
+
+WORDS = ["news", "media", "static", "img", "photo", "gallery", "article",
+         "story", "sport", "world", "video", "player", "main", "style",
+         "theme", "app", "vendor", "lib", "common", "header", "footer",
+         "logo", "icon", "thumb", "user", "avatar", "profile", "search",
+         "weather", "finance", "travel", "food", "music", "movie", "book",
+         "blog", "forum", "shop", "cart", "item", "product", "review",
+         "comment", "home", "index", "page", "section", "topic", "content",
+         "data", "api", "feed", "rss", "font", "menu", "widget", "local"]
+SUFFIXES = ["js", "css", "png", "gif", "jpg", "html", "php", "swf", "woff", ""]
+TOKEN_CHARACTERS = "abcdefghijklmnopqrstuvwxyz0123456789"
+
+random.seed(SEED)
+tokens = set()
+
+
+def token():
+    while True:
+        t = "q" + "".join(random.choice(TOKEN_CHARACTERS) for i in range(7))
+        if t not in tokens:
+            tokens.add(t)
+            return t
+
+
+def word():
+    return random.choice(WORDS)
+
+
+def clean_host():
+    return "%s%s.%s" % (word(), word(), random.choice(["com", "net", "org", "co.uk", "de"]))
+
+
+sites = []
+while len(sites) < SITES:
+    host = "www." + clean_host()
+    if host not in sites:
+        sites.append(host)
+
+
+# Rules: (filter, token, kind)
+rules = []
+
+
+def block_rule():
+    t = token()
+    kind = random.randint(0, 17)
+    if kind == 0:
+        f = "/%s/" % t
+    elif kind == 1:
+        f = "||%s.com^" % t
+    elif kind == 2:
+        f = "||%s.net^$third-party" % t
+    elif kind == 3:
+        f = "-%s-" % t
+    elif kind == 4:
+        f = "&%s=" % t
+    elif kind == 5:
+        f = "/%s.gif|" % t
+    elif kind == 6:
+        f = "|http://%s." % t
+    elif kind == 7:
+        f = "/%s*.js$script" % t
+    elif kind == 8:
+        f = "/%s^$image,third-party" % t
+    elif kind == 9:
+        f = "/%s/*$domain=%s|%s" % (t, random.choice(sites)[4:], random.choice(sites)[4:])
+    elif kind == 10:
+        f = "/%s/*$domain=~%s" % (t, random.choice(sites)[4:])
+    elif kind == 11:
+        f = "/%s/*$~third-party" % t
+    elif kind == 12:
+        f = "/%s/*$~image" % t
+    elif kind == 13:
+        f = "_%s.$object_subrequest" % t
+    elif kind == 14:
+        f = "/%s/*$popup" % t
+    elif kind == 15:
+        f = "/%s/*$match-case" % t.upper()
+    elif kind == 16:
+        f = "/%s/%s/*" % (word(), t)
+    else:
+        f = ".%s/%s." % (word(), t)
+    return (f, t, kind)
+
+
+for i in range(BLOCK_RULES):
+    rules.append(block_rule())
+for i in range(REGEXP_RULES):
+    t = token()
+    rules.append(("/%s[0-9]+\\.gif/" % t, t, "regexp"))
+
+exceptions = []
+for i in range(EXCEPTION_RULES):
+    t = token()
+    if i % 2:
+        f = "@@||%s.com^" % t
+    else:
+        f = "@@/%s/*$script" % t
+    exceptions.append((f, t, "exception"))
+
+hiding = []
+for i in range(HIDING_RULES):
+    kind = i % 5
+    if kind == 0:
+        hiding.append("##.%s-%d" % (word(), i))
+    elif kind == 1:
+        hiding.append("##div[id^=\"%s%d\"]" % (word(), i))
+    elif kind == 2:
+        hiding.append("%s##.%s%d" % (random.choice(sites)[4:], word(), i))
+    elif kind == 3:
+        hiding.append("~%s##div#%s%d" % (random.choice(sites)[4:], word(), i))
+    else:
+        hiding.append("##table[width=\"%d\"] > .%s" % (i, word()))
+
+lines = [f for f, t, k in rules + exceptions] + hiding
+lines += ["! %s %s %d" % (word(), word(), i) for i in range(COMMENTS)]
+random.shuffle(lines)
+
+with open("easylist.txt", "w") as out:
+    out.write("[Adblock Plus 1.1]\n")
+    for line in lines:
+        out.write(line + "\n")
+
+
+# The reference matcher, see AdBlockRule
+
+def convert_pattern(pattern):
+    pattern = re.sub(r"\*+", "*", pattern)
+    pattern = re.sub(r"\^\|$", "^", pattern)
+    pattern = re.sub(r"^(\*)", "", pattern)
+    pattern = re.sub(r"(\*)$", "", pattern)
+    pattern = re.sub(r"(\W)", lambda m: "\\" + m.group(1), pattern)
+    pattern = re.sub(r"^\\\|\\\|", lambda m: r"^[\w\-]+:\/+(?!\/)(?:[^\/]+\.)?", pattern)
+    pattern = re.sub(r"\\\^", lambda m: r"(?:[^\w\d\-.%]|$)", pattern)
+    pattern = re.sub(r"^\\\|", "^", pattern)
+    pattern = re.sub(r"\\\|$", "$", pattern)
+    pattern = re.sub(r"\\\*", ".*", pattern)
+    return pattern
+
+
+TYPES = {"script": 0x02, "image": 0x04, "stylesheet": 0x08, "object": 0x10,
+         "object-subrequest": 0x40, "font": 0x200}
+SUFFIX_TYPES = {"js": 0x02, "css": 0x08, "png": 0x04, "gif": 0x04, "jpg": 0x04,
+                "swf": 0x10, "woff": 0x200}
+
+
+class Rule:
+    def __init__(self, line):
+        self.exception = line.startswith("@@")
+        parsed = line[2:] if self.exception else line
+        regexp = False
+        if parsed.startswith("/") and parsed.endswith("/"):
+            parsed = parsed[1:-1]
+            regexp = True
+        options = []
+        if "$" in parsed:
+            options = parsed[parsed.index("$") + 1:].split(",")
+            parsed = parsed[:parsed.index("$")]
+        self.types = 0x3ff
+        self.third_party = None
+        self.included = set()
+        self.excluded = set()
+        match_case = False
+        included_types = 0
+        excluded_types = 0
+        for option in options:
+            negate = option.startswith("~")
+            if negate:
+                option = option[1:]
+            if option == "match-case":
+                match_case = True
+            elif option == "third-party":
+                self.third_party = not negate
+            elif option.startswith("domain="):
+                for domain in option[7:].lower().split("|"):
+                    if domain.startswith("~"):
+                        self.excluded.add(domain[1:])
+                    else:
+                        self.included.add(domain)
+            elif option.replace("_", "-") in TYPES:
+                if negate:
+                    excluded_types |= TYPES[option.replace("_", "-")]
+                else:
+                    included_types |= TYPES[option.replace("_", "-")]
+            else:
+                self.types = 0
+        if self.types:
+            self.types = (included_types or 0x3ff) & ~excluded_types
+        pattern = parsed if regexp else convert_pattern(parsed)
+        self.regexp = re.compile(pattern, 0 if match_case else re.IGNORECASE)
+
+    def match(self, request):
+        url, kind, third_party, domains = request
+        if not self.types & kind:
+            return False
+        if self.third_party is not None and self.third_party != third_party:
+            return False
+        if self.included or self.excluded:
+            decided = None
+            for domain in domains:
+                if domain in self.excluded:
+                    decided = False
+                    break
+                if domain in self.included:
+                    decided = True
+                    break
+            if decided is None:
+                decided = not self.included
+            if not decided:
+                return False
+        return self.regexp.search(url) is not None
+
+
+def site_of_host(host):
+    last = host.rfind(".")
+    if last == -1 or host[-1].isdigit():
+        return host
+    second = host.rfind(".", 0, last)
+    if second == -1:
+        return host
+    if len(host) - last - 1 == 2 and last - second - 1 <= 3:
+        third = host.rfind(".", 0, second)
+        return host[third + 1:]
+    return host[second + 1:]
+
+
+def domains_of_host(host):
+    domains = []
+    offset = 0
+    while offset != -1 and offset < len(host):
+        domains.append(host[offset:])
+        offset = host.find(".", offset)
+        if offset != -1:
+            offset += 1
+    return domains
+
+
+def request_of(page, url):
+    host = url.split("/")[2]
+    path = "/" + url.split("/", 3)[3].split("?")[0]
+    name = path[path.rfind("/") + 1:]
+    suffix = name[name.rfind(".") + 1:].lower() if "." in name else ""
+    return (url, SUFFIX_TYPES.get(suffix, 0x01),
+            site_of_host(host) != site_of_host(page), domains_of_host(page))
+
+
+candidates = {}
+for f, t, k in rules + exceptions:
+    candidates.setdefault(t, []).append(Rule(f))
+
+
+def blocked(page, url):
+    request = request_of(page, url)
+    lower = url.lower()
+    matched = []
+    for i in range(len(lower)):
+        if lower[i] == "q":
+            matched += candidates.get(lower[i:i + 8], [])
+    if any(rule.exception and rule.match(request) for rule in matched):
+        return False
+    return any(not rule.exception and rule.match(request) for rule in matched)
+
+
+# The trace
+
+def clean_url(page):
+    suffix = random.choice(SUFFIXES)
+    name = "%s%d" % (word(), random.randint(1, 40))
+    if suffix:
+        name += "." + suffix
+    if random.random() < 0.6:
+        host = page
+    else:
+        host = "cdn%d.%s" % (random.randint(1, 3), clean_host())
+    url = "http://%s/%s/%s" % (host, word(), name)
+    if random.random() < 0.2:
+        url += "?id=%d&%s=%d" % (random.randint(1, 9999), word(), random.randint(1, 9))
+    return url
+
+
+def ad_url(page, rule):
+    f, t, kind = rule
+    other = "ads.%s" % clean_host()
+    host = random.choice([page, other])
+    suffix = random.choice(["gif", "js", "png", "html"])
+    if kind == 1:
+        return "http://%s.com/%s/%s.%s" % (random.choice([t, "cdn." + t]), word(), word(), suffix)
+    if kind == 2:
+        return "http://%s.net/%s.%s" % (t, word(), suffix)
+    if kind == 3:
+        return "http://%s/%s-%s-%d.%s" % (host, word(), t, random.randint(1, 99), suffix)
+    if kind == 4:
+        return "http://%s/%s.php?%s&%s=%d" % (host, word(), word(), t, random.randint(1, 99))
+    if kind == 5:
+        return "http://%s/%s/%s.gif" % (host, word(), t)
+    if kind == 6:
+        return "http://%s.%s/%s.%s" % (t, clean_host(), word(), suffix)
+    if kind == 13:
+        return "http://%s/%s_%s.swf" % (host, word(), t)
+    if kind == "regexp":
+        return "http://%s/%s%d.gif" % (host, t, random.randint(1, 999))
+    if kind == 17:
+        return "http://%s/%s/%s.%s" % (host, f[1:f.index("/")], t, suffix)
+    if kind == 16:
+        return "http://%s/%s/%s/%s.%s" % (host, f.split("/")[1], t, word(), suffix)
+    return "http://%s/%s/%s.%s" % (host, t, word(), suffix)
+
+
+def excepted_url(page, exception):
+    f, t, kind = exception
+    unanchored = [r for r in rules if r[2] in (3, 4)]
+    rule = random.choice(unanchored)
+    url = ad_url(page, rule)
+    if f.startswith("@@||"):
+        return url.replace(url.split("/")[2], t + ".com", 1)
+    return url.replace("http://", "http://www.", 1).rsplit(".", 1)[0] + "/" + t + "/x.js"
+
+
+requests = []
+site_urls = {}
+for visit in range(VISITS):
+    page = random.choice(sites)
+    known = site_urls.setdefault(page, [])
+    for i in range(REQUESTS_PER_VISIT):
+        r = random.random()
+        if r < 0.45 and known:
+            url = random.choice(known)
+        elif r < 0.75:
+            url = clean_url(page)
+            known.append(url)
+        elif r < 0.95:
+            url = ad_url(page, random.choice(rules))
+        else:
+            url = excepted_url(page, random.choice(exceptions))
+        requests.append((page, url))
+
+blocked_count = sum(1 for page, url in requests if blocked(page, url))
+
+with open("urltrace.txt", "w") as out:
+    out.write("# requests: %d\n" % len(requests))
+    out.write("# blocked: %d\n" % blocked_count)
+    for page, url in requests:
+        out.write("%s %s\n" % (page, url))
@@ -0,0 +1,308 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <qtest.h>
+#include <qsignalspy.h>
+#include <qtry.h>
+
+#include "adblockmanager.h"
+#include "adblocknetwork.h"
+#include "adblockrule.h"
+#include "adblocksubscription.h"
+#include "browserapplication.h"
+#include "webpageproxy.h"
+
+#include <qcryptographichash.h>
+#include <qdebug.h>
+#include <qdir.h>
+#include <qfile.h>
+#include <qnetworkreply.h>
+#include <qnetworkrequest.h>
+#include <qtextstream.h>
+#include <qwebframe.h>
+#if QT_VERSION >= 0x040800
+#include <qelapsedtimer.h>
+#endif
+
+/*
+    Loads easylist.txt, a synthetic list the size of EasyList, and replays
+    urltrace.txt, the requests made while visiting pages of a few dozen
+    sites, through AdBlockNetwork::block().  Both files are made by
+    generatecorpus.py, which also records how many of the requests are
+    blocked so that a change in behavior fails the benchmark.
+ */
+class tst_AdBlock : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+private slots:
+    void loadList_data();
+    void loadList();
+    void memory();
+    void replay();
+    void latency();
+
+private:
+    QString listFileName() const;
+    QString cacheFileName() const;
+    AdBlockSubscription *newSubscription(QObject *parent = 0);
+    int blockTrace(AdBlockNetwork *network);
+
+    QList<WebPageProxy*> m_pages;
+    QList<QNetworkRequest> m_requests;
+    int m_expectedBlocked;
+};
+
+// The resident memory of the process in kB, -1 when unknown
+static int residentMemory()
+{
+#if defined(Q_OS_LINUX)
+    QFile file(QLatin1String("/proc/self/status"));
+    if (!file.open(QFile::ReadOnly))
+        return -1;
+    QTextStream stream(&file);
+    QString line;
+    do {
+        line = stream.readLine();
+        if (line.startsWith(QLatin1String("VmRSS:")))
+            return line.mid(6).remove(QLatin1String("kB")).trimmed().toInt();
+    } while (!line.isNull());
+#endif
+    return -1;
+}
+
+// This will be called before the first test function is executed.
+// It is only called once.
+void tst_AdBlock::initTestCase()
+{
+    // only the list of the benchmark is used, not the ones in the settings
+    AdBlockManager::instance()->load();
+    cleanup();
+
+    QFile trace(QDir::currentPath() + "/urltrace.txt");
+    QVERIFY(trace.open(QFile::ReadOnly));
+    QTextStream stream(&trace);
+
+    // every site the trace visits gets a page for the first party
+    QHash<QString, WebPageProxy*> pages;
+    int expectedRequests = -1;
+    m_expectedBlocked = -1;
+    while (!stream.atEnd()) {
+        QString line = stream.readLine();
+        if (line.startsWith(QLatin1String("# requests:"))) {
+            expectedRequests = line.mid(11).trimmed().toInt();
+            continue;
+        }
+        if (line.startsWith(QLatin1String("# blocked:"))) {
+            m_expectedBlocked = line.mid(10).trimmed().toInt();
+            continue;
+        }
+        int space = line.indexOf(QLatin1Char(' '));
+        if (line.startsWith(QLatin1Char('#')) || space == -1)
+            continue;
+
+        QString host = line.left(space);
+        WebPageProxy *page = pages.value(host);
+        if (!page) {
+            page = new WebPageProxy(this);
+            QSignalSpy spy(page, SIGNAL(loadFinished(bool)));
+            page->mainFrame()->setHtml(QString(), QUrl(QLatin1String("http://") + host + QLatin1Char('/')));
+            QTRY_COMPARE(spy.count(), 1);
+            QCOMPARE(page->mainFrame()->url().host(), host);
+            pages.insert(host, page);
+            m_pages.append(page);
+        }
+
+        QNetworkRequest request(QUrl::fromEncoded(line.mid(space + 1).toUtf8()));
+        request.setAttribute((QNetworkRequest::Attribute)(WebPageProxy::pageAttributeId()),
+                             qVariantFromValue((void *)page));
+        m_requests.append(request);
+    }
+    QCOMPARE(m_requests.count(), expectedRequests);
+    QVERIFY(m_expectedBlocked > 0);
+}
+
+// This will be called after the last test function is executed.
+// It is only called once.
+void tst_AdBlock::cleanupTestCase()
+{
+    m_requests.clear();
+    qDeleteAll(m_pages);
+    m_pages.clear();
+}
+
+// This will be called before each test function is executed.
+void tst_AdBlock::init()
+{
+    AdBlockManager::instance()->setEnabled(true);
+}
+
+// This will be called after every test function.
+void tst_AdBlock::cleanup()
+{
+    AdBlockManager *manager = AdBlockManager::instance();
+    QList<AdBlockSubscription*> list = manager->subscriptions();
+    foreach (AdBlockSubscription *s, list)
+        manager->removeSubscription(s);
+}
+
+QString tst_AdBlock::listFileName() const
+{
+    return QDir::currentPath() + "/easylist.txt";
+}
+
+// Where AdBlockSubscription keeps the parsed rules of the list
+QString tst_AdBlock::cacheFileName() const
+{
+    QByteArray location = QUrl::fromLocalFile(listFileName()).toEncoded();
+    QByteArray sha1 = QCryptographicHash::hash(location, QCryptographicHash::Sha1).toHex();
+    return BrowserApplication::dataFilePath(QString(QLatin1String("adblock_subscription_%1.cache")).arg(QLatin1String(sha1)));
+}
+
+AdBlockSubscription *tst_AdBlock::newSubscription(QObject *parent)
+{
+    AdBlockSubscription *subscription = new AdBlockSubscription(QUrl(), parent);
+    subscription->setEnabled(true);
+    subscription->setLocation(QUrl::fromLocalFile(listFileName()));
+    // without a cache the list is parsed in another thread
+    QSignalSpy spy(subscription, SIGNAL(rulesLoaded()));
+    subscription->updateNow();
+    while (spy.isEmpty())
+        QTest::qWait(10);
+    return subscription;
+}
+
+int tst_AdBlock::blockTrace(AdBlockNetwork *network)
+{
+    int blocked = 0;
+    for (int i = 0; i < m_requests.count(); ++i) {
+        if (QNetworkReply *reply = network->block(m_requests.at(i))) {
+            ++blocked;
+            delete reply;
+        }
+    }
+    return blocked;
+}
+
+void tst_AdBlock::loadList_data()
+{
+    QTest::addColumn<bool>("cached");
+    QTest::newRow("parse") << false;
+    QTest::newRow("cache") << true;
+}
+
+// Loading the list from its text and from the cache written the first time
+void tst_AdBlock::loadList()
+{
+    QFETCH(bool, cached);
+
+    AdBlockSubscription *subscription = newSubscription();
+    int ruleCount = subscription->ruleCount();
+    delete subscription;
+    QVERIFY(ruleCount > 0);
+
+    QBENCHMARK {
+        if (!cached)
+            QFile::remove(cacheFileName());
+        subscription = newSubscription();
+        QCOMPARE(subscription->ruleCount(), ruleCount);
+        delete subscription;
+    }
+}
+
+// The memory taken by the parsed and indexed list
+void tst_AdBlock::memory()
+{
+    QFile::remove(cacheFileName());
+    int before = residentMemory();
+    if (before == -1)
+        QSKIP("The resident memory of the process is not known on this platform", SkipAll);
+
+    AdBlockManager *manager = AdBlockManager::instance();
+    AdBlockSubscription *subscription = newSubscription(manager);
+    manager->addSubscription(subscription);
+    manager->block(QLatin1String("http://example.com/"));
+    int after = residentMemory();
+    qDebug() << "rules:" << subscription->ruleCount()
+             << "memory:" << (after - before) << "kB";
+}
+
+// The whole trace, every iteration starts with an empty decision cache
+void tst_AdBlock::replay()
+{
+    AdBlockManager *manager = AdBlockManager::instance();
+    manager->addSubscription(newSubscription(manager));
+
+    int blocked = 0;
+    QBENCHMARK {
+        AdBlockNetwork network;
+        blocked = blockTrace(&network);
+    }
+    QCOMPARE(blocked, m_expectedBlocked);
+}
+
+// The time every request of the trace takes on its own
+void tst_AdBlock::latency()
+{
+#if QT_VERSION < 0x040800
+    QSKIP("Timing single requests needs QElapsedTimer::nsecsElapsed()", SkipAll);
+#else
+    AdBlockManager *manager = AdBlockManager::instance();
+    manager->addSubscription(newSubscription(manager));
+
+    AdBlockNetwork network;
+    QVector<qint64> times;
+    times.reserve(m_requests.count());
+    QElapsedTimer timer;
+    for (int i = 0; i < m_requests.count(); ++i) {
+        timer.start();
+        QNetworkReply *reply = network.block(m_requests.at(i));
+        times.append(timer.nsecsElapsed());
+        delete reply;
+    }
+
+    qSort(times.begin(), times.end());
+    qDebug() << "requests:" << times.count()
+             << "cache hits:" << network.cacheHits()
+             << "cache misses:" << network.cacheMisses();
+    qDebug() << "latency in us, 50%:" << times.at(times.count() * 50 / 100) / 1000.0
+             << "90%:" << times.at(times.count() * 90 / 100) / 1000.0
+             << "99%:" << times.at(times.count() * 99 / 100) / 1000.0
+             << "max:" << times.last() / 1000.0;
+#endif
+}
+
+QTEST_MAIN(tst_AdBlock)
+#include "tst_adblock.moc"
+
@@ -48,6 +48,12 @@ private slots:
 
     void removeRows_data();
     void removeRows();
+    void removeOlderVisits();
+
+    void expire();
+
+    void frecency_data();
+    void frecency();
 };
 
 // Subclass that exposes the protected functions.
@@ -104,6 +110,7 @@ void tst_HistoryFilterModel::historyfiltermodel()
 typedef QList<HistoryEntry> HistoryList;
 Q_DECLARE_METATYPE(HistoryList)
 Q_DECLARE_METATYPE(HistoryEntry)
+Q_DECLARE_METATYPE(QList<int>)
 
 HistoryList makeHistoryList(int count)
 {
@@ -330,6 +337,112 @@ void tst_HistoryFilterModel::removeRows()
     QCOMPARE(model.rowCount(), count);
 }
 
+// A url whose newest visit is removed comes back at its older visit
+void tst_HistoryFilterModel::removeOlderVisits()
+{
+    QDateTime now = QDateTime::currentDateTime();
+    HistoryList history;
+    history << HistoryEntry("http://a.com/", now)
+            << HistoryEntry("http://b.com/", now.addSecs(-60))
+            << HistoryEntry("http://a.com/", now.addSecs(-120))
+            << HistoryEntry("http://c.com/", now.addSecs(-180));
+
+    SubHistoryFilterModel model;
+    model.history->setHistory(history);
+    QCOMPARE(model.rowCount(), 3);
+
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(const QModelIndex &, int, int)));
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(const QModelIndex &, int, int)));
+    QVERIFY(model.removeRows(0, 1));
+    QCOMPARE(resetSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.at(0).at(1).toInt(), 1);
+
+    QCOMPARE(model.rowCount(), 3);
+    QStringList urls;
+    urls << "http://b.com/" << "http://a.com/" << "http://c.com/";
+    for (int i = 0; i < urls.count(); ++i) {
+        QModelIndex idx = model.index(i, 0);
+        QCOMPARE(idx.data(HistoryModel::UrlStringRole).toString(), urls.at(i));
+        QCOMPARE(idx.data(HistoryFilterModel::FrecencyRole).toInt(), 100);
+        QCOMPARE(model.mapToSource(idx).row(), i);
+        QCOMPARE(model.mapFromSource(model.historyModel->index(i, 0)), idx);
+        QCOMPARE(model.historyLocation(urls.at(i)), i);
+    }
+}
+
+// Expired visits are removed from the end without a reset
+void tst_HistoryFilterModel::expire()
+{
+    QDateTime now = QDateTime::currentDateTime();
+    HistoryList history;
+    history << HistoryEntry("http://a.com/", now)
+            << HistoryEntry("http://b.com/", now.addDays(-2))
+            << HistoryEntry("http://a.com/", now.addDays(-3))
+            << HistoryEntry("http://c.com/", now.addDays(-5));
+
+    SubHistoryFilterModel model;
+    model.history->setHistory(history);
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.index(0, 0).data(HistoryFilterModel::FrecencyRole).toInt(), 193);
+
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(const QModelIndex &, int, int)));
+    QSignalSpy sourceRemovedSpy(model.historyModel, SIGNAL(rowsRemoved(const QModelIndex &, int, int)));
+    model.history->setDaysToExpire(4);
+    QCOMPARE(sourceRemovedSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.index(1, 0).data(HistoryModel::UrlStringRole).toString(), QString("http://b.com/"));
+
+    model.history->setDaysToExpire(1);
+    QCOMPARE(sourceRemovedSpy.count(), 2);
+    QCOMPARE(removedSpy.count(), 2);
+    QCOMPARE(resetSpy.count(), 0);
+    QCOMPARE(model.rowCount(), 1);
+    QModelIndex idx = model.index(0, 0);
+    QCOMPARE(idx.data(HistoryModel::UrlStringRole).toString(), QString("http://a.com/"));
+    QCOMPARE(idx.data(HistoryFilterModel::FrecencyRole).toInt(), 100);
+    QCOMPARE(model.mapToSource(idx).row(), 0);
+    QCOMPARE(model.mapFromSource(model.historyModel->index(0, 0)), idx);
+}
+
+void tst_HistoryFilterModel::frecency_data()
+{
+    QTest::addColumn<QList<int> >("days");
+    QTest::addColumn<int>("frecency");
+    QTest::newRow("today") << (QList<int>() << 0) << 100;
+    QTest::newRow("month") << (QList<int>() << 30) << 50;
+    QTest::newRow("two months") << (QList<int>() << 60) << 25;
+    QTest::newRow("today and month") << (QList<int>() << 0 << 30) << 150;
+    QTest::newRow("three days") << (QList<int>() << 0 << 3) << 193;
+}
+
+// A visit adds to the frecency of its url without a reset
+void tst_HistoryFilterModel::frecency()
+{
+    QFETCH(QList<int>, days);
+    QFETCH(int, frecency);
+
+    QDateTime now = QDateTime::currentDateTime();
+    HistoryList history;
+    foreach (int day, days)
+        history.append(HistoryEntry("http://a.com/", now.addDays(-day)));
+
+    SubHistoryFilterModel model;
+    model.history->setHistory(history);
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.index(0, 0).data(HistoryFilterModel::FrecencyRole).toInt(), frecency);
+
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    model.history->addHistoryEntry("http://a.com/");
+    QCOMPARE(resetSpy.count(), 0);
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.index(0, 0).data(HistoryFilterModel::FrecencyRole).toInt(), frecency + 100);
+}
+
 QTEST_MAIN(tst_HistoryFilterModel)
 #include "tst_historyfiltermodel.moc"
 
@@ -20,6 +20,7 @@
 #include <QtTest/QtTest>
 #include "qtest_arora.h"
 
+#include <browserapplication.h>
 #include <historymanager.h>
 #include <history.h>
 #include <historycompleter.h>
@@ -50,9 +51,20 @@ private slots:
     void setHistory();
     void saveload_data();
     void saveload();
+    void historyStore_data();
+    void historyStore();
+    void matchingUrls_data();
+    void matchingUrls();
+    void historyContains_data();
+    void historyContains();
+    void journal_data();
+    void journal();
+    void loading();
 
     // TODO move to their own tests
     void big();
+    void completionModel();
+    void completer();
 
     void historyDialog_data();
     void historyDialog();
@@ -65,13 +77,15 @@ private:
 class SubHistory : public HistoryManager
 {
 public:
-    SubHistory() : HistoryManager()
+    SubHistory(bool waitForHistory = true) : HistoryManager()
     {
         QWidget w;
         setParent(&w);
         if (QWebHistoryInterface::defaultInterface() == this)
             QWebHistoryInterface::setDefaultInterface(0);
         setParent(0);
+        if (waitForHistory)
+            waitForLoaded();
     }
 
     ~SubHistory() {
@@ -82,6 +96,27 @@ public:
         { HistoryManager::addHistoryEntry(item); }
 };
 
+// Subclass that records the rows that are checked and scored.
+class SubCompletionModel : public HistoryCompletionModel
+{
+public:
+    mutable QSet<int> checkedRows;
+    mutable QList<int> scoredRows;
+
+protected:
+    bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
+    {
+        checkedRows.insert(source_row);
+        return HistoryCompletionModel::filterAcceptsRow(source_row, source_parent);
+    }
+
+    int score(const QModelIndex &sourceIndex) const
+    {
+        scoredRows.append(sourceIndex.row());
+        return HistoryCompletionModel::score(sourceIndex);
+    }
+};
+
 // This will be called before the first test function is executed.
 // It is only called once.
 void tst_HistoryManager::initTestCase()
@@ -396,6 +431,225 @@ void tst_HistoryManager::saveload()
     }
 }
 
+void tst_HistoryManager::historyStore_data()
+{
+    QTest::addColumn<QDateTime>("dateTime");
+    QTest::addColumn<bool>("valid");
+    QTest::newRow("null") << QDateTime() << false;
+    QTest::newRow("now") << QDateTime::currentDateTime() << true;
+    QTest::newRow("msecs") << QDateTime(QDate(2009, 3, 1), QTime(23, 59, 59, 999)) << true;
+    QTest::newRow("epoch") << QDateTime(QDate(1970, 1, 1), QTime(0, 0), Qt::UTC) << true;
+    QTest::newRow("before epoch") << QDateTime(QDate(1969, 12, 31), QTime(12, 30, 0, 5), Qt::UTC) << true;
+}
+
+// HistoryStore keeps the visits in columns and every url and title once
+void tst_HistoryManager::historyStore()
+{
+    QFETCH(QDateTime, dateTime);
+    QFETCH(bool, valid);
+
+    HistoryStore store;
+    HistoryEntry first("http://foo.com", dateTime, "Foo");
+    HistoryEntry second("http://bar.com", dateTime, "Bar");
+    store.prepend(first);
+    store.prepend(second);
+    store.prepend(first);
+    QCOMPARE(store.count(), 3);
+    QCOMPARE(store.at(0), first);
+    QCOMPARE(store.at(1), second);
+    QCOMPARE(store.dateTime(2).isValid(), valid);
+    QCOMPARE(store.dateTime(2), dateTime);
+    QCOMPARE(store.urlId(0), store.urlId(2));
+    QVERIFY(store.urlId(0) != store.urlId(1));
+    QCOMPARE(store.urlId(QString("http://bar.com")), store.urlId(1));
+    QCOMPARE(store.urlId(QString("http://baz.com")), -1);
+
+    store.setTitle(0, "Foo 2");
+    QCOMPARE(store.title(0), QString("Foo 2"));
+    QCOMPARE(store.title(2), QString("Foo"));
+    QCOMPARE(store.indexOf(second), 1);
+    QCOMPARE(store.visits(first.url), QList<int>() << 0 << 2);
+    QCOMPARE(store.lastVisit(second.url), 1);
+    QCOMPARE(store.lastVisit(QString("http://baz.com")), -1);
+
+    store.removeLast();
+    QCOMPARE(store.visits(first.url), QList<int>() << 0);
+    QCOMPARE(store.count(), 2);
+    QCOMPARE(store.at(1), second);
+    store.prepend(second);
+    store.removeAt(2);
+    QCOMPARE(store.count(), 2);
+    QCOMPARE(store.visits(second.url), QList<int>() << 0);
+    QCOMPARE(store.lastVisit(first.url), 1);
+    store.removeAt(0);
+    QCOMPARE(store.count(), 1);
+    QCOMPARE(store.indexOf(second), -1);
+    QCOMPARE(store.lastVisit(second.url), -1);
+
+    store.prepend(second);
+    store.prepend(first);
+    store.removeAt(1);
+    QCOMPARE(store.count(), 2);
+    QCOMPARE(store.visits(first.url), QList<int>() << 0 << 1);
+    QCOMPARE(store.url(1), first.url);
+    QCOMPARE(store.expiredCount(HistoryStore::toTimestamp(dateTime)), 2);
+    store.removeLast();
+    QCOMPARE(store.visits(first.url), QList<int>() << 0);
+    QCOMPARE(store.lastVisit(second.url), -1);
+    QVector<int> offsets;
+    QVERIFY(store.matchingUrls("bar.com", offsets));
+    QVERIFY(offsets.isEmpty());
+    store.prepend(second);
+    QVERIFY(store.matchingUrls("bar.com", offsets));
+    QCOMPARE(offsets, QVector<int>() << 0);
+
+    QList<HistoryEntry> list;
+    list << second << first;
+    store.setEntries(list);
+    QCOMPARE(store.toList(), list);
+}
+
+void tst_HistoryManager::matchingUrls_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<bool>("indexed");
+    QTest::addColumn<QStringList>("urls");
+    QTest::newRow("short") << "fo" << false << QStringList();
+    QTest::newRow("url") << "foo" << true << (QStringList() << "http://foo.com/");
+    QTest::newRow("case") << "FOO.c" << true << (QStringList() << "http://foo.com/");
+    QTest::newRow("title") << "kitten" << true << (QStringList() << "http://bar.com/");
+    QTest::newRow("both") << "http" << true << (QStringList() << "http://bar.com/" << "http://foo.com/");
+    QTest::newRow("none") << "qux" << true << QStringList();
+    QTest::newRow("removed") << "baz" << true << QStringList();
+}
+
+// The trigram index finds every url that might have the text
+void tst_HistoryManager::matchingUrls()
+{
+    QFETCH(QString, text);
+    QFETCH(bool, indexed);
+    QFETCH(QStringList, urls);
+
+    QDateTime now = QDateTime::currentDateTime();
+    HistoryStore store;
+    store.prepend(HistoryEntry("http://baz.com/", now.addSecs(-3), "Baz"));
+    store.prepend(HistoryEntry("http://foo.com/", now.addSecs(-2), "Foo"));
+    store.prepend(HistoryEntry("http://bar.com/", now.addSecs(-1), "Bar"));
+    store.setTitle(0, "Kittens");
+    store.removeLast();
+
+    QVector<int> offsets;
+    QCOMPARE(store.matchingUrls(text, offsets), indexed);
+    QStringList found;
+    foreach (int offset, offsets)
+        found.append(store.url(offset));
+    found.sort();
+    QCOMPARE(found, urls);
+}
+
+void tst_HistoryManager::historyContains_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::newRow("none") << 0;
+    QTest::newRow("one") << 1;
+    QTest::newRow("more than the filter holds") << 3000;
+}
+
+// The manager answers from its own urls, removed ones are not visited
+void tst_HistoryManager::historyContains()
+{
+    QFETCH(int, count);
+
+    SubHistory history;
+    history.setDaysToExpire(-1);
+    HistoryList list;
+    QDateTime dateTime = QDateTime::currentDateTime();
+    for (int i = 0; i < count; ++i)
+        list.append(HistoryEntry(QString("http://host-%1.com/").arg(i), dateTime.addSecs(-i)));
+    history.setHistory(list);
+
+    for (int i = 0; i < count; ++i)
+        QVERIFY(history.historyContains(list.at(i).url));
+    QVERIFY(!history.historyContains(QString("http://foo.com/")));
+    QVERIFY(!history.historyContains(QString()));
+
+    history.addHistoryEntry(HistoryEntry("http://foo.com/", dateTime.addSecs(1)));
+    QVERIFY(history.historyContains(QString("http://foo.com/")));
+    QSignalSpy resetSpy(history.historyModel(), SIGNAL(modelReset()));
+    QSignalSpy removedSpy(history.historyModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)));
+    history.removeHistoryEntry(QUrl("http://foo.com/"));
+    QVERIFY(!history.historyContains(QString("http://foo.com/")));
+    QCOMPARE(resetSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(removedSpy.at(0).at(1).toInt(), 0);
+    QCOMPARE(history.historyModel()->rowCount(), count);
+}
+
+void tst_HistoryManager::journal_data()
+{
+    QTest::addColumn<bool>("removeIndex");
+    QTest::newRow("index") << false;
+    QTest::newRow("no index") << true;
+}
+
+// Changes are appended to the history file and replayed when it is loaded
+void tst_HistoryManager::journal()
+{
+    QFETCH(bool, removeIndex);
+
+    QDateTime now = QDateTime::currentDateTime();
+    HistoryEntry foo("http://foo.com", now.addSecs(-30), "Foo");
+    HistoryEntry bar("http://bar.com", now.addSecs(-20), "Bar");
+    HistoryEntry baz("http://baz.com", now.addSecs(-10), "Baz");
+    {
+        SubHistory history;
+        history.setHistory(HistoryList() << baz << bar << foo);
+    }
+    if (removeIndex)
+        QFile::remove(BrowserApplication::dataFilePath(QLatin1String("history.index")));
+
+    HistoryEntry qux("http://qux.com", now, "Qux");
+    {
+        SubHistory history;
+        QCOMPARE(history.history(), HistoryList() << baz << bar << foo);
+        history.removeHistoryEntry(QUrl(bar.url));
+        history.updateHistoryEntry(QUrl(foo.url), "Foo 2");
+        history.addHistoryEntry(qux);
+    }
+    foo.title = "Foo 2";
+    {
+        SubHistory history;
+        QCOMPARE(history.history(), HistoryList() << qux << baz << foo);
+    }
+}
+
+// Visits added while the history file is read are merged with it
+void tst_HistoryManager::loading()
+{
+    QDateTime now = QDateTime::currentDateTime();
+    HistoryEntry foo("http://foo.com", now.addSecs(-10), "Foo");
+    HistoryEntry bar("http://bar.com", now, "Bar");
+    {
+        SubHistory history;
+        history.setHistory(HistoryList() << foo);
+    }
+
+    SubHistory history(false);
+    QVERIFY(history.isLoading());
+    QSignalSpy historyResetSpy(&history, SIGNAL(historyReset()));
+    history.addHistoryEntry(bar);
+    QVERIFY(history.historyContains(bar.url));
+    QCOMPARE(history.historyStore().count(), 1);
+
+    history.waitForLoaded();
+    QVERIFY(!history.isLoading());
+    QCOMPARE(historyResetSpy.count(), 1);
+    QCOMPARE(history.historyStore().count(), 2);
+    QCOMPARE(history.historyStore().at(0), bar);
+    QCOMPARE(history.historyStore().at(1), foo);
+    QVERIFY(history.historyContains(foo.url));
+}
+
 void tst_HistoryManager::big()
 {
     SubHistory history;
@@ -435,6 +689,96 @@ void tst_HistoryManager::big()
     QTest::qWait(100);
 }
 
+// Only the best completions are ranked until the view fetches more
+void tst_HistoryManager::completionModel()
+{
+    SubHistory history;
+    history.setDaysToExpire(-1);
+    QDateTime now = QDateTime::currentDateTime();
+    HistoryList list;
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j <= i % 7; ++j)
+            list.append(HistoryEntry(QString("http://foo%1.com").arg(i), now.addSecs(-i * 60 - j), "Foo"));
+    }
+    qSort(list);
+    history.setHistory(list);
+
+    HistoryCompletionModel completionModel;
+    completionModel.setSourceModel(history.historyFilterModel());
+    ModelTest test(&completionModel);
+    completionModel.setSearchString("foo");
+    completionModel.sort(0);
+    QVERIFY(completionModel.rowCount() < 100);
+    QVERIFY(completionModel.canFetchMore(QModelIndex()));
+
+    while (completionModel.canFetchMore(QModelIndex()))
+        completionModel.fetchMore(QModelIndex());
+    QCOMPARE(completionModel.rowCount(), 100);
+    int frecency = completionModel.index(0, 0).data(HistoryFilterModel::FrecencyRole).toInt();
+    for (int i = 1; i < completionModel.rowCount(); ++i) {
+        int rowFrecency = completionModel.index(i, 0).data(HistoryFilterModel::FrecencyRole).toInt();
+        QVERIFY(rowFrecency <= frecency);
+        frecency = rowFrecency;
+    }
+
+    // new visits are checked on their own instead of filtering every row
+    QSignalSpy resetSpy(&completionModel, SIGNAL(modelReset()));
+    history.addHistoryEntry(HistoryEntry("http://bar.com", now.addSecs(1), "Bar"));
+    QCOMPARE(completionModel.rowCount(), 100);
+    history.addHistoryEntry(HistoryEntry("http://foo0.com", now.addSecs(2), "Foo"));
+    QCOMPARE(completionModel.rowCount(), 100);
+    history.addHistoryEntry(HistoryEntry("http://foo100.com", now.addSecs(3), "Foo"));
+    QCOMPARE(completionModel.rowCount(), 101);
+    QCOMPARE(resetSpy.count(), 0);
+    QModelIndex newest = history.historyFilterModel()->index(0, 0);
+    QCOMPARE(completionModel.mapToSource(completionModel.mapFromSource(newest)), newest);
+}
+
+// Every character typed only checks the rows that matched before it and
+// scores each of them once
+void tst_HistoryManager::completer()
+{
+    SubHistory history;
+    history.setDaysToExpire(-1);
+    QDateTime now = QDateTime::currentDateTime();
+    HistoryList list;
+    for (int i = 0; i < 100; ++i) {
+        list.append(HistoryEntry(QString("http://foo%1.com").arg(i), now.addSecs(-i * 60), "Foo"));
+        list.append(HistoryEntry(QString("http://bar%1.com").arg(i), now.addSecs(-i * 60 - 30), "Bar"));
+    }
+    qSort(list);
+    history.setHistory(list);
+
+    SubCompletionModel completionModel;
+    completionModel.setSourceModel(history.historyFilterModel());
+    HistoryCompleter completer(&completionModel);
+
+    QString url = "http://foo1";
+    QSet<int> matchedRows;
+    for (int i = 1; i <= url.length(); ++i) {
+        completionModel.checkedRows.clear();
+        completionModel.scoredRows.clear();
+        completer.splitPath(url.left(i));
+        QMetaObject::invokeMethod(&completer, "updateFilter");
+        if (i > 1) {
+            foreach (int row, completionModel.checkedRows)
+                QVERIFY(matchedRows.contains(row));
+        }
+
+        while (completionModel.canFetchMore(QModelIndex()))
+            completionModel.fetchMore(QModelIndex());
+        matchedRows.clear();
+        for (int j = 0; j < completionModel.rowCount(); ++j)
+            matchedRows.insert(completionModel.mapToSource(completionModel.index(j, 0)).row());
+
+        // every matching row is scored once
+        QCOMPARE(completionModel.scoredRows.count(), matchedRows.count());
+        QCOMPARE(completionModel.scoredRows.toSet(), matchedRows);
+    }
+    // foo1 and foo10 to foo19
+    QCOMPARE(matchedRows.count(), 11);
+}
+
 void tst_HistoryManager::historyDialog_data()
 {
     QTest::addColumn<int>("parentRow");
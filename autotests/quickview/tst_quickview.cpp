@@ -271,7 +271,6 @@ void tst_QuickView::testMinorFilterMethods()
     QVERIFY(m_model->rowCount() == 0);
     m_manager->addHistoryEntry("http://facebook.com/lol");
     m_manager->addHistoryEntry("http://twitter.com/xyz");
-    m_model->recalculateFrecencies();
     QVERIFY(m_manager->history().count() == 2);
     QVERIFY(m_model->rowCount() == 2);
 
@@ -301,7 +300,6 @@ void tst_QuickView::testMinorFilterMethods()
     QVERIFY(m_manager->history().count() == 0);
     QVERIFY(m_model->rowCount() == 0);
     m_model->sourceModel();
-    m_model->recalculateFrecencies();
 }
 
 
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET =
+DEPENDPATH += .
+INCLUDEPATH += .
+
+include(../../autotests.pri)
+
+# Input
+SOURCES = tst_bloomfilter.cpp bloomfilter.cpp
+HEADERS = bloomfilter.h
+FORMS =
+RESOURCES =
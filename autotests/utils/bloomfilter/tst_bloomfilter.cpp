@@ -0,0 +1,130 @@
+/*
+ * Copyright 2009 Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include <qtest.h>
+
+#include <bloomfilter.h>
+
+class tst_BloomFilter : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+private slots:
+    void bloomfilter_data();
+    void bloomfilter();
+    void insert_data();
+    void insert();
+    void falsePositives();
+};
+
+// This will be called before the first test function is executed.
+// It is only called once.
+void tst_BloomFilter::initTestCase()
+{
+}
+
+// This will be called after the last test function is executed.
+// It is only called once.
+void tst_BloomFilter::cleanupTestCase()
+{
+}
+
+// This will be called before each test function is executed.
+void tst_BloomFilter::init()
+{
+}
+
+// This will be called after every test function.
+void tst_BloomFilter::cleanup()
+{
+}
+
+void tst_BloomFilter::bloomfilter_data()
+{
+}
+
+void tst_BloomFilter::bloomfilter()
+{
+    BloomFilter filter;
+    QCOMPARE(filter.count(), 0);
+    QCOMPARE(filter.capacity(), 0);
+    QVERIFY(filter.isFull());
+    QVERIFY(!filter.mightContain(QString()));
+    filter.insert(QString());
+    QVERIFY(filter.mightContain(QString()));
+    filter.clear();
+    QCOMPARE(filter.count(), 0);
+    QVERIFY(!filter.mightContain(QString()));
+}
+
+void tst_BloomFilter::insert_data()
+{
+    QTest::addColumn<QStringList>("strings");
+    QTest::addColumn<int>("capacity");
+    QTest::newRow("empty") << QStringList() << 10;
+    QTest::newRow("one") << (QStringList() << "http://foo.com/") << 10;
+    QTest::newRow("over capacity") << (QStringList() << "a" << "b" << "c" << "d") << 2;
+    QStringList many;
+    for (int i = 0; i < 1000; ++i)
+        many << QString("http://host-%1.com/").arg(i);
+    QTest::newRow("many") << many << 1000;
+}
+
+// Every string that was inserted is found
+void tst_BloomFilter::insert()
+{
+    QFETCH(QStringList, strings);
+    QFETCH(int, capacity);
+
+    BloomFilter filter(capacity);
+    foreach (const QString &string, strings)
+        filter.insert(string);
+    QCOMPARE(filter.count(), strings.count());
+    QCOMPARE(filter.isFull(), strings.count() >= capacity);
+    foreach (const QString &string, strings)
+        QVERIFY(filter.mightContain(string));
+
+    filter.clear(capacity * 2);
+    QCOMPARE(filter.capacity(), capacity * 2);
+    QVERIFY(!filter.isFull());
+    foreach (const QString &string, strings)
+        QVERIFY(!filter.mightContain(string));
+}
+
+void tst_BloomFilter::falsePositives()
+{
+    BloomFilter filter(10000);
+    for (int i = 0; i < 10000; ++i)
+        filter.insert(QString("http://host-%1.com/").arg(i));
+    int found = 0;
+    for (int i = 0; i < 10000; ++i) {
+        if (filter.mightContain(QString("http://www.other-%1.com/").arg(i)))
+            ++found;
+    }
+    QVERIFY(found < 300);
+}
+
+QTEST_MAIN(tst_BloomFilter)
+#include "tst_bloomfilter.moc"
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET =
+DEPENDPATH += .
+INCLUDEPATH += .
+
+include(../../autotests.pri)
+
+# Input
+SOURCES = tst_fenwicktree.cpp fenwicktree.cpp
+HEADERS = fenwicktree.h
+FORMS =
+RESOURCES =
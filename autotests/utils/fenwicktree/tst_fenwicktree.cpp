@@ -0,0 +1,140 @@
+/*
+ * Copyright 2009 Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include <qtest.h>
+
+#include <fenwicktree.h>
+
+class tst_FenwickTree : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+private slots:
+    void fenwicktree_data();
+    void fenwicktree();
+    void counts_data();
+    void counts();
+};
+
+// This will be called before the first test function is executed.
+// It is only called once.
+void tst_FenwickTree::initTestCase()
+{
+}
+
+// This will be called after the last test function is executed.
+// It is only called once.
+void tst_FenwickTree::cleanupTestCase()
+{
+}
+
+// This will be called before each test function is executed.
+void tst_FenwickTree::init()
+{
+}
+
+// This will be called after every test function.
+void tst_FenwickTree::cleanup()
+{
+}
+
+void tst_FenwickTree::fenwicktree_data()
+{
+}
+
+void tst_FenwickTree::fenwicktree()
+{
+    FenwickTree tree;
+    QCOMPARE(tree.size(), 0);
+    QCOMPARE(tree.total(), 0);
+    QCOMPARE(tree.sum(0), 0);
+    QCOMPARE(tree.find(0), 0);
+    tree.append(1);
+    QCOMPARE(tree.size(), 1);
+    QCOMPARE(tree.total(), 1);
+    QCOMPARE(tree.find(0), 0);
+    QCOMPARE(tree.find(1), 1);
+    tree.clear(4, 1);
+    QCOMPARE(tree.size(), 4);
+    QCOMPARE(tree.total(), 4);
+    QCOMPARE(tree.sum(3), 3);
+}
+
+typedef QList<int> Counts;
+Q_DECLARE_METATYPE(Counts)
+
+void tst_FenwickTree::counts_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("count");
+    QTest::addColumn<Counts>("appended");
+    QTest::addColumn<Counts>("removed");
+
+    QTest::newRow("empty") << 0 << 0 << Counts() << Counts();
+    QTest::newRow("cleared") << 7 << 1 << Counts() << (Counts() << 0 << 3 << 6);
+    QTest::newRow("appended") << 0 << 0 << (Counts() << 1 << 0 << 1 << 1 << 0) << Counts();
+    QTest::newRow("both") << 5 << 1 << (Counts() << 1 << 1 << 0 << 1) << (Counts() << 4 << 5 << 1);
+    Counts many;
+    for (int i = 0; i < 100; ++i)
+        many << i % 3 % 2;
+    QTest::newRow("many") << 100 << 1 << many << (Counts() << 0 << 64 << 99 << 100 << 127 << 150);
+}
+
+// The tree agrees with a plain list of the counts
+void tst_FenwickTree::counts()
+{
+    QFETCH(int, size);
+    QFETCH(int, count);
+    QFETCH(Counts, appended);
+    QFETCH(Counts, removed);
+
+    FenwickTree tree(size, count);
+    Counts counts;
+    for (int i = 0; i < size; ++i)
+        counts << count;
+    foreach (int appendedCount, appended) {
+        tree.append(appendedCount);
+        counts << appendedCount;
+    }
+    foreach (int position, removed) {
+        tree.add(position, -counts.at(position));
+        counts[position] = 0;
+    }
+
+    QCOMPARE(tree.size(), counts.count());
+    int sum = 0;
+    for (int i = 0; i < counts.count(); ++i) {
+        QCOMPARE(tree.sum(i), sum);
+        for (int j = 0; j < counts.at(i); ++j)
+            QCOMPARE(tree.find(sum + j), i);
+        sum += counts.at(i);
+    }
+    QCOMPARE(tree.total(), sum);
+    QCOMPARE(tree.sum(counts.count()), sum);
+    QCOMPARE(tree.find(sum), counts.count());
+}
+
+QTEST_MAIN(tst_FenwickTree)
+#include "tst_fenwicktree.moc"
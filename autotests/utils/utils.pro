@@ -1,7 +1,9 @@
 TEMPLATE = subdirs
 SUBDIRS  = \
+    bloomfilter \
     editlistview \
     edittreeview \
+    fenwicktree \
     languagemanager \
     lineedit
 
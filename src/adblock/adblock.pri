@@ -2,6 +2,7 @@ INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
 HEADERS += \
+    adblockautomaton.h \
     adblockblockednetworkreply.h \
     adblockdialog.h \
     adblockmanager.h \
@@ -9,10 +10,13 @@ HEADERS += \
     adblocknetwork.h \
     adblockpage.h \
     adblockrule.h \
+    adblockruleindex.h \
     adblockschemeaccesshandler.h \
+    adblockstringpool.h \
     adblocksubscription.h
 
 SOURCES += \
+    adblockautomaton.cpp \
     adblockblockednetworkreply.cpp \
     adblockdialog.cpp \
     adblockmanager.cpp \
@@ -20,7 +24,9 @@ SOURCES += \
     adblocknetwork.cpp \
     adblockpage.cpp \
     adblockrule.cpp \
+    adblockruleindex.cpp \
     adblockschemeaccesshandler.cpp \
+    adblockstringpool.cpp \
     adblocksubscription.cpp
 
 FORMS += \
@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "adblockautomaton.h"
+
+#include <qalgorithms.h>
+#include <qdatastream.h>
+#include <qpair.h>
+
+AdBlockAutomaton::AdBlockAutomaton()
+    : m_built(false)
+{
+}
+
+void AdBlockAutomaton::clear()
+{
+    m_keywordIds.clear();
+    m_character.clear();
+    m_firstChild.clear();
+    m_fail.clear();
+    m_output.clear();
+    m_outputLink.clear();
+    m_built = false;
+}
+
+/*
+    Returns the id of \a keyword, adding it when it is not known yet.
+    Adding a keyword invalidates the automaton until build() is called.
+ */
+int AdBlockAutomaton::addKeyword(const QString &keyword)
+{
+    Q_ASSERT(!keyword.isEmpty());
+    QHash<QString, int>::const_iterator it = m_keywordIds.constFind(keyword);
+    if (it != m_keywordIds.constEnd())
+        return it.value();
+    int id = m_keywordIds.count();
+    m_keywordIds.insert(keyword, id);
+    m_built = false;
+    return id;
+}
+
+int AdBlockAutomaton::keywordId(const QString &keyword) const
+{
+    return m_keywordIds.value(keyword, -1);
+}
+
+int AdBlockAutomaton::keywordCount() const
+{
+    return m_keywordIds.count();
+}
+
+bool AdBlockAutomaton::isBuilt() const
+{
+    return m_built;
+}
+
+void AdBlockAutomaton::build()
+{
+    m_character.clear();
+    m_firstChild.clear();
+    m_fail.clear();
+    m_output.clear();
+    m_outputLink.clear();
+
+    // In the sorted keyword list every state of the trie is a range of
+    // keywords sharing a prefix as long as the depth of the state.
+    typedef QPair<QString, int> Keyword;
+    QVector<Keyword> keywords;
+    keywords.reserve(m_keywordIds.count());
+    QHash<QString, int>::const_iterator it = m_keywordIds.constBegin();
+    for (; it != m_keywordIds.constEnd(); ++it)
+        keywords.append(Keyword(it.key(), it.value()));
+    qSort(keywords.begin(), keywords.end());
+
+    QVector<Range> states;
+    Range root = { 0, keywords.count(), 0 };
+    states.append(root);
+    m_character.append(0);
+    m_output.append(-1);
+
+    // Visiting the states in order while appending their children
+    // numbers the states breadth first.
+    for (int state = 0; state < states.count(); ++state) {
+        Range range = states.at(state);
+        m_firstChild.append(states.count());
+        int i = range.begin;
+        // a keyword ending in this state sorts before the longer ones
+        while (i < range.end && keywords.at(i).first.length() == range.depth)
+            ++i;
+        while (i < range.end) {
+            ushort character = keywords.at(i).first.at(range.depth).unicode();
+            int j = i + 1;
+            while (j < range.end && keywords.at(j).first.at(range.depth).unicode() == character)
+                ++j;
+            Range childRange = { i, j, range.depth + 1 };
+            states.append(childRange);
+            m_character.append(character);
+            m_output.append(keywords.at(i).first.length() == range.depth + 1 ? keywords.at(i).second : -1);
+            i = j;
+        }
+    }
+    m_firstChild.append(states.count());
+
+    int stateCount = states.count();
+    m_fail.fill(0, stateCount);
+    m_outputLink.fill(0, stateCount);
+    for (int state = 0; state < stateCount; ++state) {
+        for (int c = m_firstChild.at(state); c < m_firstChild.at(state + 1); ++c) {
+            if (state != 0) {
+                int fail = m_fail.at(state);
+                int next = child(fail, m_character.at(c));
+                while (!next && fail) {
+                    fail = m_fail.at(fail);
+                    next = child(fail, m_character.at(c));
+                }
+                m_fail[c] = next;
+            }
+            int fail = m_fail.at(c);
+            m_outputLink[c] = (m_output.at(fail) != -1) ? fail : m_outputLink.at(fail);
+        }
+    }
+    m_built = true;
+}
+
+int AdBlockAutomaton::child(int state, ushort character) const
+{
+    int low = m_firstChild.at(state);
+    int high = m_firstChild.at(state + 1) - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        ushort c = m_character.at(middle);
+        if (c < character)
+            low = middle + 1;
+        else if (c > character)
+            high = middle - 1;
+        else
+            return middle;
+    }
+    return 0;
+}
+
+/*
+    Appends the id of every keyword occurring in \a text to \a keywordIds,
+    once for each occurrence.
+ */
+void AdBlockAutomaton::search(const QString &text, QVector<int> &keywordIds) const
+{
+    if (!m_built || m_keywordIds.isEmpty())
+        return;
+
+    const QChar *data = text.constData();
+    const int length = text.length();
+    int state = 0;
+    for (int i = 0; i < length; ++i) {
+        ushort character = data[i].unicode();
+        int next = child(state, character);
+        while (!next && state) {
+            state = m_fail.at(state);
+            next = child(state, character);
+        }
+        state = next;
+        int output = (m_output.at(state) != -1) ? state : m_outputLink.at(state);
+        for (; output; output = m_outputLink.at(output))
+            keywordIds.append(m_output.at(output));
+    }
+}
+
+QDataStream &operator<<(QDataStream &out, const AdBlockAutomaton &automaton)
+{
+    out << automaton.m_keywordIds << automaton.m_built;
+    if (automaton.m_built) {
+        out << automaton.m_character << automaton.m_firstChild << automaton.m_fail
+            << automaton.m_output << automaton.m_outputLink;
+    }
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, AdBlockAutomaton &automaton)
+{
+    automaton.clear();
+    in >> automaton.m_keywordIds >> automaton.m_built;
+    if (automaton.m_built) {
+        in >> automaton.m_character >> automaton.m_firstChild >> automaton.m_fail
+           >> automaton.m_output >> automaton.m_outputLink;
+        int states = automaton.m_character.count();
+        if (states == 0
+            || automaton.m_firstChild.count() != states + 1
+            || automaton.m_fail.count() != states
+            || automaton.m_output.count() != states
+            || automaton.m_outputLink.count() != states) {
+            automaton.clear();
+            in.setStatus(QDataStream::ReadCorruptData);
+        }
+    }
+    return in;
+}
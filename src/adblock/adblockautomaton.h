@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef ADBLOCKAUTOMATON_H
+#define ADBLOCKAUTOMATON_H
+
+#include <qhash.h>
+#include <qstring.h>
+#include <qvector.h>
+
+class QDataStream;
+/*
+    Aho-Corasick automaton that finds all of its keywords in a text in one
+    pass over the text.
+
+    Keywords are added with addKeyword() and build() turns them into the
+    automaton.  The trie is stored in breadth first order so that the
+    children of a state are consecutive states, sorted by their character.
+ */
+class AdBlockAutomaton
+{
+
+public:
+    AdBlockAutomaton();
+
+    void clear();
+    int addKeyword(const QString &keyword);
+    int keywordId(const QString &keyword) const;
+    int keywordCount() const;
+
+    bool isBuilt() const;
+    void build();
+
+    void search(const QString &text, QVector<int> &keywordIds) const;
+
+private:
+    friend QDataStream &operator<<(QDataStream &out, const AdBlockAutomaton &automaton);
+    friend QDataStream &operator>>(QDataStream &in, AdBlockAutomaton &automaton);
+
+    // the range of sorted keywords sharing the prefix that leads to a state
+    struct Range {
+        int begin;
+        int end;
+        int depth;
+    };
+
+    int child(int state, ushort character) const;
+
+    QHash<QString, int> m_keywordIds;
+    bool m_built;
+
+    // one entry per state, the root is state 0
+    QVector<ushort> m_character;
+    QVector<int> m_firstChild;
+    QVector<int> m_fail;
+    QVector<int> m_output;
+    QVector<int> m_outputLink;
+};
+
+QDataStream &operator<<(QDataStream &out, const AdBlockAutomaton &automaton);
+QDataStream &operator>>(QDataStream &in, AdBlockAutomaton &automaton);
+
+#endif // ADBLOCKAUTOMATON_H
+
@@ -34,6 +34,7 @@
 #include "treesortfilterproxymodel.h"
 
 #include <qdesktopservices.h>
+#include <qfiledialog.h>
 #include <qmenu.h>
 #include <qurl.h>
 
@@ -62,6 +63,9 @@ AdBlockDialog::AdBlockDialog(QWidget *parent)
     actionToolButton->setIcon(QIcon(QLatin1String(":128x128/run.png")));
     actionToolButton->setPopupMode(QToolButton::InstantPopup);
 
+    treeView->setColumnHidden(1, !manager->isStatisticsEnabled());
+    treeView->setColumnHidden(2, !manager->isStatisticsEnabled());
+
     AdBlockSubscription *subscription = manager->customRules();
     QModelIndex subscriptionIndex = m_adBlockModel->index(subscription);
     treeView->expand(m_proxyModel->mapFromSource(subscriptionIndex));
@@ -96,6 +100,22 @@ void AdBlockDialog::aboutToShowActionMenu()
     connect(removeSubscription, SIGNAL(triggered()), this, SLOT(removeSubscription()));
     if (!idx.isValid())
         removeSubscription->setEnabled(false);
+
+    menu->addSeparator();
+
+    AdBlockManager *manager = AdBlockManager::instance();
+    QAction *recordStatistics = menu->addAction(tr("Record Rule Statistics"));
+    recordStatistics->setCheckable(true);
+    recordStatistics->setChecked(manager->isStatisticsEnabled());
+    connect(recordStatistics, SIGNAL(toggled(bool)), this, SLOT(setStatisticsEnabled(bool)));
+
+    QAction *resetStatistics = menu->addAction(tr("Reset Rule Statistics"));
+    connect(resetStatistics, SIGNAL(triggered()), manager, SLOT(resetStatistics()));
+    resetStatistics->setEnabled(manager->isStatisticsEnabled());
+
+    QAction *exportStatistics = menu->addAction(tr("Export Rule Statistics..."));
+    connect(exportStatistics, SIGNAL(triggered()), this, SLOT(exportStatistics()));
+    exportStatistics->setEnabled(manager->isStatisticsEnabled());
 }
 
 void AdBlockDialog::addCustomRule(const QString &rule)
@@ -148,3 +168,18 @@ void AdBlockDialog::removeSubscription()
     AdBlockManager::instance()->removeSubscription(subscription);
 }
 
+void AdBlockDialog::setStatisticsEnabled(bool enabled)
+{
+    AdBlockManager::instance()->setStatisticsEnabled(enabled);
+    treeView->setColumnHidden(1, !enabled);
+    treeView->setColumnHidden(2, !enabled);
+}
+
+void AdBlockDialog::exportStatistics()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Export Rule Statistics"),
+                                                    QLatin1String("adblock_statistics.txt"));
+    if (fileName.isEmpty())
+        return;
+    AdBlockManager::instance()->exportStatistics(fileName);
+}
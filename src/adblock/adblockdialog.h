@@ -50,6 +50,8 @@ private slots:
     void updateSubscription();
     void browseSubscriptions();
     void removeSubscription();
+    void setStatisticsEnabled(bool enabled);
+    void exportStatistics();
 
 private:
     AdBlockModel *m_adBlockModel;
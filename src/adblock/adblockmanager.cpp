@@ -32,12 +32,20 @@
 #include "adblockdialog.h"
 #include "adblocknetwork.h"
 #include "adblockpage.h"
+#include "adblockrule.h"
 #include "adblocksubscription.h"
 #include "browserapplication.h"
 #include "networkaccessmanager.h"
 
+#include <qalgorithms.h>
+#include <qdatastream.h>
+#include <qfile.h>
+#include <qhash.h>
 #include <qstringlist.h>
 #include <qsettings.h>
+#include <qtconcurrentrun.h>
+#include <qtextstream.h>
+#include <qtimer.h>
 
 #include <qdebug.h>
 
@@ -45,22 +53,36 @@
 
 AdBlockManager *AdBlockManager::s_adBlockManager = 0;
 
+// how often the rule statistics are written to disk while they are recorded
+static const int AdBlockStatisticsInterval = 5 * 60 * 1000;
+
 AdBlockManager::AdBlockManager(QObject *parent)
     : QObject(parent)
     , m_loaded(false)
     , m_enabled(true)
+    , m_rulesGeneration(0)
+    , m_statisticsEnabled(false)
     , m_saveTimer(new AutoSaver(this))
+    , m_statisticsTimer(new QTimer(this))
     , m_adBlockDialog(0)
     , m_adBlockNetwork(0)
     , m_adBlockPage(0)
 {
     connect(this, SIGNAL(rulesChanged()),
             m_saveTimer, SLOT(changeOccurred()));
+    connect(this, SIGNAL(rulesChanged()),
+            this, SLOT(nextRulesGeneration()));
+    m_statisticsTimer->setInterval(AdBlockStatisticsInterval);
+    connect(m_statisticsTimer, SIGNAL(timeout()),
+            this, SLOT(saveStatistics()));
 }
 
 AdBlockManager::~AdBlockManager()
 {
     m_saveTimer->saveIfNeccessary();
+    if (m_statisticsEnabled)
+        saveStatistics();
+    m_squeezing.waitForFinished();
 }
 
 AdBlockManager *AdBlockManager::instance()
@@ -81,6 +103,20 @@ bool AdBlockManager::isEnabled() const
     return m_enabled;
 }
 
+/*
+    Increased every time rulesChanged() is emitted so that anything caching
+    the result of a lookup can tell when it is out of date.
+ */
+int AdBlockManager::rulesGeneration() const
+{
+    return m_rulesGeneration;
+}
+
+void AdBlockManager::nextRulesGeneration()
+{
+    ++m_rulesGeneration;
+}
+
 void AdBlockManager::setEnabled(bool enabled)
 {
     if (isEnabled() == enabled)
@@ -89,6 +125,193 @@ void AdBlockManager::setEnabled(bool enabled)
     emit rulesChanged();
 }
 
+/*
+    When enabled every rule counts how often it is checked against a request
+    and how often it decides one, see AdBlockRule::hitCount().
+ */
+bool AdBlockManager::isStatisticsEnabled() const
+{
+    return m_statisticsEnabled;
+}
+
+void AdBlockManager::setStatisticsEnabled(bool enabled)
+{
+    if (!m_loaded)
+        load();
+    if (m_statisticsEnabled == enabled)
+        return;
+    if (!enabled)
+        saveStatistics();
+    m_statisticsEnabled = enabled;
+    foreach (AdBlockSubscription *subscription, m_subscriptions)
+        subscription->setStatisticsEnabled(enabled);
+    if (enabled)
+        m_statisticsTimer->start();
+    else
+        m_statisticsTimer->stop();
+    m_saveTimer->changeOccurred();
+}
+
+void AdBlockManager::resetStatistics()
+{
+    foreach (AdBlockSubscription *subscription, subscriptions()) {
+        for (int i = 0; i < subscription->ruleCount(); ++i)
+            subscription->setRuleStatistics(i, 0, 0);
+    }
+    QFile::remove(statisticsFileName());
+}
+
+QString AdBlockManager::statisticsFileName()
+{
+    return BrowserApplication::dataFilePath(QLatin1String("adblock_statistics"));
+}
+
+static const qint32 AdBlockStatisticsMagic = 0xab5;
+static const qint32 AdBlockStatisticsVersion = 1;
+
+/*
+    Only the rules that were counted are written, keyed by the location of
+    their subscription and their filter so that they survive list updates.
+ */
+void AdBlockManager::saveStatistics()
+{
+    QFile file(statisticsFileName());
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "AdBlockManager::" << __FUNCTION__ << "Unable to open statistics file for writing" << file.fileName();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << AdBlockStatisticsMagic;
+    stream << AdBlockStatisticsVersion;
+    foreach (AdBlockSubscription *subscription, m_subscriptions) {
+        QList<const AdBlockRule*> rules;
+        for (int i = 0; i < subscription->ruleCount(); ++i) {
+            const AdBlockRule *rule = subscription->rule(i);
+            if (rule->hitCount() > 0 || rule->evaluationCount() > 0)
+                rules.append(rule);
+        }
+        if (rules.isEmpty())
+            continue;
+        stream << QString::fromUtf8(subscription->location().toEncoded());
+        stream << qint32(rules.count());
+        foreach (const AdBlockRule *rule, rules) {
+            stream << rule->filter();
+            stream << qint32(rule->hitCount());
+            stream << qint32(rule->evaluationCount());
+        }
+    }
+#if defined(ADBLOCKMANAGER_DEBUG)
+    qDebug() << "AdBlockManager::" << __FUNCTION__ << file.fileName() << file.size();
+#endif
+}
+
+void AdBlockManager::loadStatistics()
+{
+    QFile file(statisticsFileName());
+    if (!file.open(QFile::ReadOnly))
+        return;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_5);
+    qint32 marker;
+    qint32 version;
+    stream >> marker;
+    stream >> version;
+    if (marker != AdBlockStatisticsMagic || version != AdBlockStatisticsVersion)
+        return;
+
+    QHash<QString, AdBlockSubscription*> subscriptions;
+    foreach (AdBlockSubscription *subscription, m_subscriptions)
+        subscriptions.insert(QString::fromUtf8(subscription->location().toEncoded()), subscription);
+
+    while (!stream.atEnd()) {
+        QString location;
+        qint32 count;
+        stream >> location;
+        stream >> count;
+        if (stream.status() != QDataStream::Ok || count < 0)
+            return;
+        QHash<QString, QPair<int, int> > statistics;
+        for (int i = 0; i < count; ++i) {
+            QString filter;
+            qint32 hitCount;
+            qint32 evaluationCount;
+            stream >> filter >> hitCount >> evaluationCount;
+            if (stream.status() != QDataStream::Ok)
+                return;
+            statistics.insert(filter, qMakePair(int(hitCount), int(evaluationCount)));
+        }
+
+        AdBlockSubscription *subscription = subscriptions.value(location);
+        if (!subscription)
+            continue;
+        for (int i = 0; i < subscription->ruleCount(); ++i) {
+            QHash<QString, QPair<int, int> >::const_iterator it = statistics.constFind(subscription->rule(i)->filter());
+            if (it != statistics.constEnd())
+                subscription->setRuleStatistics(i, it.value().first, it.value().second);
+        }
+    }
+}
+
+static bool hitCountLessThan(const AdBlockRule *first, const AdBlockRule *second)
+{
+    if (first->hitCount() != second->hitCount())
+        return first->hitCount() < second->hitCount();
+    return first->evaluationCount() > second->evaluationCount();
+}
+
+/*
+    A tab separated report with a line for every subscription followed by
+    its enabled network rules.  The rules that never decided a request come
+    first and among them the ones that were checked the most, those are the
+    ones worth pruning.
+ */
+QString AdBlockManager::statisticsReport() const
+{
+    QString report;
+    QTextStream stream(&report);
+    stream << "Subscription\tFilter\tHits\tChecks\n";
+    foreach (AdBlockSubscription *subscription, subscriptions()) {
+        QList<const AdBlockRule*> rules;
+        int unusedRules = 0;
+        for (int i = 0; i < subscription->ruleCount(); ++i) {
+            const AdBlockRule *rule = subscription->rule(i);
+            // only the network rules are counted
+            if (!rule->isEnabled() || rule->isCSSRule())
+                continue;
+            rules.append(rule);
+            if (rule->hitCount() == 0)
+                ++unusedRules;
+        }
+        qStableSort(rules.begin(), rules.end(), hitCountLessThan);
+
+        stream << subscription->title() << '\t'
+               << tr("%1 of %2 rules unused").arg(unusedRules).arg(rules.count()) << '\t'
+               << subscription->hitCount() << '\t'
+               << subscription->evaluationCount() << '\n';
+        foreach (const AdBlockRule *rule, rules) {
+            stream << subscription->title() << '\t'
+                   << rule->filter() << '\t'
+                   << rule->hitCount() << '\t'
+                   << rule->evaluationCount() << '\n';
+        }
+    }
+    stream.flush();
+    return report;
+}
+
+bool AdBlockManager::exportStatistics(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Text)) {
+        qWarning() << "AdBlockManager::" << __FUNCTION__ << "Unable to open file for writing" << fileName;
+        return false;
+    }
+    return file.write(statisticsReport().toUtf8()) != -1;
+}
+
 AdBlockNetwork *AdBlockManager::network()
 {
     if (!m_adBlockNetwork)
@@ -132,6 +355,15 @@ AdBlockSubscription *AdBlockManager::customRules()
     return customAdBlockSubscription;
 }
 
+/*
+    One pool for the strings of the rules of all subscriptions, lists
+    such as EasyList and EasyPrivacy have many filters in common.
+ */
+AdBlockStringPool *AdBlockManager::stringPool()
+{
+    return &m_stringPool;
+}
+
 QList<AdBlockSubscription*> AdBlockManager::subscriptions() const
 {
     if (!m_loaded) {
@@ -150,6 +382,7 @@ void AdBlockManager::removeSubscription(AdBlockSubscription *subscription)
 #endif
     m_saveTimer->saveIfNeccessary();
     m_subscriptions.removeOne(subscription);
+    disconnect(subscription, 0, this, 0);
     if (subscription->parent() == this)
         subscription->deleteLater();
     emit rulesChanged();
@@ -163,9 +396,78 @@ void AdBlockManager::addSubscription(AdBlockSubscription *subscription)
     qDebug() << "AdBlockManager::" << __FUNCTION__ << subscription->location();
 #endif
     m_subscriptions.append(subscription);
+    connectSubscription(subscription);
+    subscription->setStatisticsEnabled(m_statisticsEnabled);
+    emit rulesChanged();
+}
+
+void AdBlockManager::connectSubscription(AdBlockSubscription *subscription)
+{
+    connect(subscription, SIGNAL(rulesLoaded()), this, SLOT(subscriptionRulesLoaded()));
     connect(subscription, SIGNAL(rulesChanged()), this, SIGNAL(rulesChanged()));
     connect(subscription, SIGNAL(changed()), this, SIGNAL(rulesChanged()));
-    emit rulesChanged();
+}
+
+const AdBlockRule *AdBlockManager::allow(const QString &urlString) const
+{
+    return allow(AdBlockRequest(urlString));
+}
+
+const AdBlockRule *AdBlockManager::allow(const AdBlockRequest &request) const
+{
+    if (!m_loaded) {
+        AdBlockManager *that = const_cast<AdBlockManager*>(this);
+        that->load();
+    }
+    foreach (AdBlockSubscription *subscription, m_subscriptions) {
+        if (const AdBlockRule *rule = subscription->allow(request))
+            return rule;
+    }
+    return 0;
+}
+
+const AdBlockRule *AdBlockManager::block(const QString &urlString) const
+{
+    return block(AdBlockRequest(urlString));
+}
+
+/*
+    Every subscription has its own index, see AdBlockSubscription::block(),
+    so that a list is indexed in the thread that parses it and a rule that
+    is in more than one list is found in the first of them.
+ */
+const AdBlockRule *AdBlockManager::block(const AdBlockRequest &request) const
+{
+    if (!m_loaded) {
+        AdBlockManager *that = const_cast<AdBlockManager*>(this);
+        that->load();
+    }
+    foreach (AdBlockSubscription *subscription, m_subscriptions) {
+        if (const AdBlockRule *rule = subscription->block(request))
+            return rule;
+    }
+    return 0;
+}
+
+// Returns the subscription that allow() or block() found \a rule in
+AdBlockSubscription *AdBlockManager::subscription(const AdBlockRule *rule) const
+{
+    foreach (AdBlockSubscription *subscription, m_subscriptions) {
+        if (subscription->isEnabled() && subscription->containsRule(rule))
+            return subscription;
+    }
+    return 0;
+}
+
+/*
+    The old rules of the subscription are gone now, the strings only they
+    used are dropped from the pool in another thread.
+ */
+void AdBlockManager::subscriptionRulesLoaded()
+{
+    if (m_squeezing.isRunning())
+        return;
+    m_squeezing = QtConcurrent::run(&m_stringPool, &AdBlockStringPool::squeeze);
 }
 
 void AdBlockManager::save()
@@ -179,6 +481,7 @@ void AdBlockManager::save()
     QSettings settings;
     settings.beginGroup(QLatin1String("AdBlock"));
     settings.setValue(QLatin1String("enabled"), m_enabled);
+    settings.setValue(QLatin1String("statisticsEnabled"), m_statisticsEnabled);
     QStringList subscriptions;
     foreach (AdBlockSubscription *subscription, m_subscriptions) {
         if (!subscription)
@@ -187,6 +490,8 @@ void AdBlockManager::save()
         subscription->saveRules();
     }
     settings.setValue(QLatin1String("subscriptions"), subscriptions);
+    if (m_statisticsEnabled)
+        saveStatistics();
 }
 
 void AdBlockManager::load()
@@ -211,10 +516,17 @@ void AdBlockManager::load()
     foreach (const QString &subscription, subscriptions) {
         QUrl url = QUrl::fromEncoded(subscription.toUtf8());
         AdBlockSubscription *adBlockSubscription = new AdBlockSubscription(url, this);
-        connect(adBlockSubscription, SIGNAL(rulesChanged()), this, SIGNAL(rulesChanged()));
-        connect(adBlockSubscription, SIGNAL(changed()), this, SIGNAL(rulesChanged()));
+        connectSubscription(adBlockSubscription);
         m_subscriptions.append(adBlockSubscription);
     }
+
+    m_statisticsEnabled = settings.value(QLatin1String("statisticsEnabled"), m_statisticsEnabled).toBool();
+    foreach (AdBlockSubscription *subscription, m_subscriptions)
+        subscription->setStatisticsEnabled(m_statisticsEnabled);
+    if (m_statisticsEnabled) {
+        loadStatistics();
+        m_statisticsTimer->start();
+    }
 }
 
 AdBlockDialog *AdBlockManager::showDialog()
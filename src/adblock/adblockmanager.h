@@ -31,13 +31,19 @@
 
 #include <qobject.h>
 
+#include "adblockstringpool.h"
+
+#include <qfuture.h>
 #include <qpointer.h>
 
+class QTimer;
 class QUrl;
 class AutoSaver;
 class AdBlockDialog;
 class AdBlockNetwork;
 class AdBlockPage;
+class AdBlockRequest;
+class AdBlockRule;
 class AdBlockSubscription;
 class AdBlockManager : public QObject
 {
@@ -54,34 +60,59 @@ public:
 
     static AdBlockManager *instance();
     bool isEnabled() const;
+    int rulesGeneration() const;
 
     QList<AdBlockSubscription*> subscriptions() const;
     void removeSubscription(AdBlockSubscription *subscription);
     void addSubscription(AdBlockSubscription *subscription);
 
+    const AdBlockRule *allow(const QString &urlString) const;
+    const AdBlockRule *allow(const AdBlockRequest &request) const;
+    const AdBlockRule *block(const QString &urlString) const;
+    const AdBlockRule *block(const AdBlockRequest &request) const;
+    AdBlockSubscription *subscription(const AdBlockRule *rule) const;
+
     AdBlockNetwork *network();
     AdBlockPage *page();
     AdBlockSubscription *customRules();
+    AdBlockStringPool *stringPool();
+
+    bool isStatisticsEnabled() const;
+    QString statisticsReport() const;
+    bool exportStatistics(const QString &fileName) const;
 
 public slots:
     void setEnabled(bool enabled);
+    void setStatisticsEnabled(bool enabled);
+    void resetStatistics();
     AdBlockDialog *showDialog();
 
 private slots:
     void save();
+    void saveStatistics();
+    void nextRulesGeneration();
+    void subscriptionRulesLoaded();
 
 private:
+    void connectSubscription(AdBlockSubscription *subscription);
+    void loadStatistics();
+    static QString statisticsFileName();
+
     static QUrl customSubscriptionUrl();
     static AdBlockManager *s_adBlockManager;
 
     bool m_loaded;
     bool m_enabled;
+    int m_rulesGeneration;
+    bool m_statisticsEnabled;
     AutoSaver *m_saveTimer;
+    QTimer *m_statisticsTimer;
     QPointer<AdBlockDialog> m_adBlockDialog;
     AdBlockNetwork *m_adBlockNetwork;
     AdBlockPage *m_adBlockPage;
     QList<AdBlockSubscription*> m_subscriptions;
-
+    AdBlockStringPool m_stringPool;
+    QFuture<void> m_squeezing;
 };
 
 #endif // ADBLOCKMANAGER_H
@@ -48,7 +48,9 @@ const AdBlockRule AdBlockModel::rule(const QModelIndex &index) const
 {
     const AdBlockSubscription *parent = static_cast<AdBlockSubscription*>(index.internalPointer());
     Q_ASSERT(parent);
-    return parent->allRules().at(index.row());
+    const AdBlockRule *rule = parent->rule(index.row());
+    Q_ASSERT(rule);
+    return *rule;
 }
 
 AdBlockSubscription *AdBlockModel::subscription(const QModelIndex &index) const
@@ -75,6 +77,8 @@ QVariant AdBlockModel::headerData(int section, Qt::Orientation orientation, int
     if (orientation == Qt::Horizontal && role == Qt::DisplayRole) {
         switch (section) {
         case 0: return tr("Rule");
+        case 1: return tr("Hits");
+        case 2: return tr("Checks");
         }
     }
     return QAbstractItemModel::headerData(section, orientation, role);
@@ -83,10 +87,12 @@ QVariant AdBlockModel::headerData(int section, Qt::Orientation orientation, int
 QVariant AdBlockModel::data(const QModelIndex &index, int role) const
 {
     if (!index.isValid()
-        || index.model() != this
-        || index.column() != 0)
+        || index.model() != this)
         return QVariant();
 
+    if (index.column() > 0)
+        return statisticsData(index, role);
+
     switch (role) {
     case Qt::EditRole:
     case Qt::DisplayRole:
@@ -116,9 +122,39 @@ QVariant AdBlockModel::data(const QModelIndex &index, int role) const
     return QVariant();
 }
 
+/*
+    The hit and check counts of a rule, or the totals of a subscription,
+    only while the manager records them.
+ */
+QVariant AdBlockModel::statisticsData(const QModelIndex &index, int role) const
+{
+    if (!m_manager->isStatisticsEnabled())
+        return QVariant();
+
+    switch (role) {
+    case Qt::DisplayRole:
+        if (index.parent().isValid()) {
+            const AdBlockSubscription *parent = static_cast<AdBlockSubscription*>(index.internalPointer());
+            const AdBlockRule *rule = parent->rule(index.row());
+            if (rule && rule->isEnabled() && !rule->isCSSRule())
+                return index.column() == 1 ? rule->hitCount() : rule->evaluationCount();
+        } else {
+            AdBlockSubscription *sub = subscription(index);
+            if (sub)
+                return index.column() == 1 ? sub->hitCount() : sub->evaluationCount();
+        }
+        break;
+    case Qt::TextAlignmentRole:
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    default:
+        break;
+    }
+    return QVariant();
+}
+
 int AdBlockModel::columnCount(const QModelIndex &parent) const
 {
-    return (parent.column() > 0) ? 0 : 1;
+    return (parent.column() > 0) ? 0 : 3;
 }
 
 int AdBlockModel::rowCount(const QModelIndex &parent) const
@@ -133,7 +169,7 @@ int AdBlockModel::rowCount(const QModelIndex &parent) const
         return 0;
 
     const AdBlockSubscription *parentNode = subscription(parent);
-    return parentNode ? parentNode->allRules().count() : 0;
+    return parentNode ? parentNode->ruleCount() : 0;
 }
 
 QModelIndex AdBlockModel::index(int row, int column, const QModelIndex &parent) const
@@ -169,7 +205,11 @@ Qt::ItemFlags AdBlockModel::flags(const QModelIndex &index) const
 
     Qt::ItemFlags flags = Qt::ItemIsSelectable;
 
-    if (index.parent().isValid()) {
+    if (index.column() > 0) {
+        const AdBlockSubscription *parentNode = subscription(index.parent());
+        if (!index.parent().isValid() || (parentNode && parentNode->isEnabled()))
+            flags |= Qt::ItemIsEnabled;
+    } else if (index.parent().isValid()) {
         flags |= Qt::ItemIsUserCheckable | Qt::ItemIsEditable;
         const AdBlockSubscription *parentNode = subscription(index.parent());
         if (parentNode && parentNode->isEnabled())
@@ -201,7 +241,6 @@ bool AdBlockModel::removeRows(int row, int count, const QModelIndex &parent)
         if (sub) {
             disconnect(m_manager, SIGNAL(rulesChanged()), this, SLOT(rulesChanged()));
             beginRemoveRows(parent, row, row + count - 1);
-            QList<AdBlockRule> rules = sub->allRules();
             for (int i = row + count - 1; i >= row; --i)
                 sub->removeRule(i);
             endRemoveRows();
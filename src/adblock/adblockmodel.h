@@ -60,6 +60,8 @@ private slots:
     void rulesChanged();
 
 private:
+    QVariant statisticsData(const QModelIndex &index, int role) const;
+
     AdBlockManager *m_manager;
 };
 
@@ -30,15 +30,109 @@
 
 #include "adblockblockednetworkreply.h"
 #include "adblockmanager.h"
+#include "adblockrule.h"
 #include "adblocksubscription.h"
+#include "webpageproxy.h"
 
 #include <qdebug.h>
+#include <qfileinfo.h>
+#include <qwebframe.h>
 
 // #define ADBLOCKNETWORK_DEBUG
 
+// The number of urls whose decision is remembered
+static const int AdBlockNetworkCacheSize = 1000;
+
 AdBlockNetwork::AdBlockNetwork(QObject *parent)
     : QObject(parent)
+    , m_cache(AdBlockNetworkCacheSize)
+    , m_cacheGeneration(-1)
+    , m_cacheHits(0)
+    , m_cacheMisses(0)
+{
+}
+
+/*
+    QtWebKit does not say what a request is for, so it is guessed from
+    what the request looks like.  Navigations are marked by WebPage, the
+    ones for a frame inside the page are subdocuments.
+ */
+static bool isNavigation(const QNetworkRequest &request)
 {
+    return request.attribute((QNetworkRequest::Attribute)(WebPageProxy::pageAttributeId() + 1)).isValid();
+}
+
+static bool isSubFrameNavigation(const QNetworkRequest &request)
+{
+    return request.attribute((QNetworkRequest::Attribute)(WebPageProxy::pageAttributeId() + 2)).toBool();
+}
+
+static int requestType(const QNetworkRequest &request)
+{
+    if (isSubFrameNavigation(request))
+        return AdBlockRule::SubdocumentRequest;
+    if (isNavigation(request))
+        return AdBlockRule::OtherRequest;
+    if (request.rawHeader("X-Requested-With") == "XMLHttpRequest")
+        return AdBlockRule::XmlHttpRequest;
+
+    QString suffix = QFileInfo(request.url().path()).suffix().toLower();
+    if (suffix == QLatin1String("js"))
+        return AdBlockRule::ScriptRequest;
+    if (suffix == QLatin1String("css"))
+        return AdBlockRule::StyleSheetRequest;
+    if (suffix == QLatin1String("png") || suffix == QLatin1String("gif")
+        || suffix == QLatin1String("jpg") || suffix == QLatin1String("jpeg")
+        || suffix == QLatin1String("bmp") || suffix == QLatin1String("ico")
+        || suffix == QLatin1String("svg"))
+        return AdBlockRule::ImageRequest;
+    if (suffix == QLatin1String("swf"))
+        return AdBlockRule::ObjectRequest;
+    if (suffix == QLatin1String("mp3") || suffix == QLatin1String("mp4")
+        || suffix == QLatin1String("ogg") || suffix == QLatin1String("webm"))
+        return AdBlockRule::MediaRequest;
+    if (suffix == QLatin1String("woff") || suffix == QLatin1String("ttf")
+        || suffix == QLatin1String("otf") || suffix == QLatin1String("eot"))
+        return AdBlockRule::FontRequest;
+    return AdBlockRule::OtherRequest;
+}
+
+/*
+    The host of the page that made the request, the page of a frame is the
+    one in the main frame.  Loading the page itself is its own first party.
+    Without a page nothing tells whose the request is, so the url is made
+    its own first party and no third-party rule matches it.
+ */
+static QString firstPartyHost(const QNetworkRequest &request)
+{
+    if (isNavigation(request) && !isSubFrameNavigation(request))
+        return request.url().host();
+
+    QVariant variant = request.attribute((QNetworkRequest::Attribute)(WebPageProxy::pageAttributeId()));
+    WebPageProxy *webPage = static_cast<WebPageProxy*>(qvariant_cast<void*>(variant));
+    if (!webPage || !webPage->mainFrame())
+        return request.url().host();
+    return webPage->mainFrame()->url().host();
+}
+
+int AdBlockNetwork::cacheSize() const
+{
+    return m_cache.maxCost();
+}
+
+void AdBlockNetwork::setCacheSize(int size)
+{
+    m_cache.setMaxCost(size);
+}
+
+int AdBlockNetwork::cacheHits() const
+{
+    return m_cacheHits;
+}
+
+int AdBlockNetwork::cacheMisses() const
+{
+    return m_cacheMisses;
 }
 
 QNetworkReply *AdBlockNetwork::block(const QNetworkRequest &request)
@@ -52,29 +146,60 @@ QNetworkReply *AdBlockNetwork::block(const QNetworkRequest &request)
     if (!manager->isEnabled())
         return 0;
 
+    // Any change to the rules can change the decision for every url and
+    // leave the cached rule pointers dangling.
+    if (m_cacheGeneration != manager->rulesGeneration()) {
+        m_cache.clear();
+        m_cacheGeneration = manager->rulesGeneration();
+    }
+
+    // The options make the decision depend on the type and the page too
     QString urlString = QString::fromUtf8(url.toEncoded());
-    const AdBlockRule *blockedRule = 0;
-    const AdBlockSubscription *blockingSubscription = 0;
-
-    QList<AdBlockSubscription*> subscriptions = manager->subscriptions();
-    foreach (AdBlockSubscription *subscription, subscriptions) {
-        if (subscription->allow(urlString))
-            return 0;
-
-        if (const AdBlockRule *rule = subscription->block(urlString)) {
-            blockedRule = rule;
-            blockingSubscription = subscription;
-            break;
-        }
+    int type = requestType(request);
+    QString pageHost = firstPartyHost(request);
+    QString key = QString::number(type) + QLatin1Char(' ') + pageHost + QLatin1Char(' ') + urlString;
+    Decision decision;
+    if (Decision *cached = m_cache.object(key)) {
+        ++m_cacheHits;
+        decision = *cached;
+    } else {
+        ++m_cacheMisses;
+        decision = decide(AdBlockRequest(urlString, type, pageHost));
+        m_cache.insert(key, new Decision(decision));
     }
 
-    if (blockedRule) {
+    // a cached decision is still a hit, but no rule was checked for it
+    if (decision.rule && manager->isStatisticsEnabled())
+        decision.rule->addHit();
+
+    if (decision.blocked) {
 #if defined(ADBLOCKNETWORK_DEBUG)
-        qDebug() << "AdBlockNetwork::" << __FUNCTION__ << "rule:" << blockedRule->filter() << "subscription:" << blockingSubscription->title() << url;
+        qDebug() << "AdBlockNetwork::" << __FUNCTION__ << "rule:" << decision.rule->filter() << url;
 #endif
-       AdBlockBlockedNetworkReply *reply = new AdBlockBlockedNetworkReply(request, blockedRule, this);
+        AdBlockBlockedNetworkReply *reply = new AdBlockBlockedNetworkReply(request, decision.rule, this);
         return reply;
     }
     return 0;
 }
 
+AdBlockNetwork::Decision AdBlockNetwork::decide(const AdBlockRequest &request) const
+{
+    Decision decision;
+    decision.blocked = false;
+    decision.rule = 0;
+
+    AdBlockManager *manager = AdBlockManager::instance();
+    if (const AdBlockRule *rule = manager->allow(request)) {
+        decision.rule = rule;
+        return decision;
+    }
+
+    if (const AdBlockRule *rule = manager->block(request)) {
+#if defined(ADBLOCKNETWORK_DEBUG)
+        qDebug() << "AdBlockNetwork::" << __FUNCTION__ << "rule:" << rule->filter() << "subscription:" << manager->subscription(rule)->title() << request.encodedUrl();
+#endif
+        decision.blocked = true;
+        decision.rule = rule;
+    }
+    return decision;
+}
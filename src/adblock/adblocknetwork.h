@@ -31,8 +31,13 @@
 
 #include <qobject.h>
 
+#include <qcache.h>
+#include <qstring.h>
+
 class QNetworkRequest;
 class QNetworkReply;
+class AdBlockRequest;
+class AdBlockRule;
 class AdBlockNetwork : public QObject
 {
     Q_OBJECT
@@ -42,6 +47,25 @@ public:
 
     QNetworkReply *block(const QNetworkRequest &request);
 
+    int cacheSize() const;
+    void setCacheSize(int size);
+    int cacheHits() const;
+    int cacheMisses() const;
+
+private:
+    // The rule that decided whether a url is blocked, the rule is an
+    // exception rule or 0 when the url is allowed
+    struct Decision {
+        bool blocked;
+        const AdBlockRule *rule;
+    };
+
+    Decision decide(const AdBlockRequest &request) const;
+
+    QCache<QString, Decision> m_cache;
+    int m_cacheGeneration;
+    int m_cacheHits;
+    int m_cacheMisses;
 };
 
 #endif // ADBLOCKNETWORK_H
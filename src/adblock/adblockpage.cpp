@@ -38,66 +38,142 @@
 #include <qwebpage.h>
 #include <qwebframe.h>
 
+#include <qset.h>
+
 #include <qdebug.h>
 
 // #define ADBLOCKPAGE_DEBUG
 
+// The id of the style element that hides the elements on a page
+static const char *const AdBlockStyleSheetId = "arora-adblock-stylesheet";
+
 AdBlockPage::AdBlockPage(QObject *parent)
     : QObject(parent)
+    , m_rulesGeneration(-1)
 {
 }
 
-void AdBlockPage::checkRule(const AdBlockRule *rule, QWebPage *page, const QString &host)
+static inline QString hidingRule(const QString &selector)
 {
-    if (!rule->isEnabled())
-        return;
+    return selector + QLatin1String(" { display: none !important; }\n");
+}
 
-    QString filter = rule->filter();
-    int offset = filter.indexOf(QLatin1String("##"));
-    if (offset == -1)
-        return;
+// domain matches the host and all of its sub domains
+static bool matchesDomain(const QString &host, const QString &domain)
+{
+    if (!host.endsWith(domain))
+        return false;
+    int offset = host.length() - domain.length();
+    return offset == 0 || host.at(offset - 1) == QLatin1Char('.');
+}
 
-    QString selectorQuery;
-    if (offset > 0) {
-        QString domainRules = filter.mid(0, offset);
-        selectorQuery = filter.mid(offset + 2);
-        QStringList domains = domainRules.split(QLatin1Char(','));
-
-        bool match = false;
-        foreach (const QString &domain, domains) {
-            bool reverse = (domain[0] == QLatin1Char('~'));
-            if (reverse) {
-                QString xdomain = domain.mid(1);
-                if (host.endsWith(xdomain))
-                    return;
-                match = true;
-            }
-            if (host.endsWith(domain))
-                match = true;
-        }
-        if (!match)
-            return;
+bool AdBlockPage::isExcluded(const ElementHidingRule &rule, const QString &host)
+{
+    foreach (const QString &domain, rule.excludedDomains) {
+        if (matchesDomain(host, domain))
+            return true;
     }
+    return false;
+}
 
-    if (offset == 0)
-        selectorQuery = filter.mid(2);
+/*
+    Sorts the element hiding rules of all subscriptions by the domains they
+    apply to.  Rules without a domain go straight into one style sheet that
+    is shared by all hosts.
+ */
+void AdBlockPage::buildIndex()
+{
+    m_genericStyleSheet.clear();
+    m_genericRules.clear();
+    m_domainRules.clear();
 
-    Q_UNUSED(page);
-#if QT_VERSION >= 0x040600
-    QWebElement document = page->mainFrame()->documentElement();
-    QWebElementCollection elements = document.findAll(selectorQuery);
+    AdBlockManager *manager = AdBlockManager::instance();
+    QSet<QString> genericSelectors;
+    foreach (AdBlockSubscription *subscription, manager->subscriptions()) {
+        foreach (const AdBlockRule *rule, subscription->pageRules()) {
+            QString filter = rule->filter();
+            int offset = filter.indexOf(QLatin1String("##"));
+            if (offset == -1)
+                continue;
+
+            ElementHidingRule hidingRule;
+            hidingRule.selector = filter.mid(offset + 2).trimmed();
+            // anything that could end the css rule early is not a selector
+            if (hidingRule.selector.isEmpty()
+                || hidingRule.selector.contains(QLatin1Char('{'))
+                || hidingRule.selector.contains(QLatin1Char('}')))
+                continue;
+
+            QStringList includedDomains;
+            QStringList domains = filter.left(offset).toLower().split(QLatin1Char(','), QString::SkipEmptyParts);
+            foreach (const QString &domain, domains) {
+                if (domain.at(0) == QLatin1Char('~'))
+                    hidingRule.excludedDomains.append(domain.mid(1));
+                else
+                    includedDomains.append(domain);
+            }
+
+            if (!includedDomains.isEmpty()) {
+                foreach (const QString &domain, includedDomains)
+                    m_domainRules[domain].append(hidingRule);
+            } else if (!hidingRule.excludedDomains.isEmpty()) {
+                m_genericRules.append(hidingRule);
+            } else if (!genericSelectors.contains(hidingRule.selector)) {
+                genericSelectors.insert(hidingRule.selector);
+                m_genericStyleSheet += ::hidingRule(hidingRule.selector);
+            }
+        }
+    }
 #if defined(ADBLOCKPAGE_DEBUG)
-    if (elements.count() != 0)
-        qDebug() << "AdBlockPage::" << __FUNCTION__ << "blocking" << elements.count() << "items" << selectorQuery << elements.count() << "rule:" << rule->filter();
+    qDebug() << "AdBlockPage::" << __FUNCTION__ << genericSelectors.count() << m_genericRules.count() << m_domainRules.count();
 #endif
-    foreach (QWebElement element, elements) {
-        element.setStyleProperty(QLatin1String("visibility"), QLatin1String("hidden"));
-        element.removeFromDocument();
+}
+
+/*
+    Returns the style sheet that hides the elements matched by the rules
+    for \a host, only the rules for the domains the host is part of are
+    looked at.
+ */
+QString AdBlockPage::styleSheet(const QString &host)
+{
+    AdBlockManager *manager = AdBlockManager::instance();
+    if (m_rulesGeneration != manager->rulesGeneration()) {
+        buildIndex();
+        m_rulesGeneration = manager->rulesGeneration();
     }
 
-#endif
+    QString lowerHost = host.toLower();
+    QString styleSheet = m_genericStyleSheet;
+    foreach (const ElementHidingRule &rule, m_genericRules) {
+        if (!isExcluded(rule, lowerHost))
+            styleSheet += hidingRule(rule.selector);
+    }
+
+    // look up the host and every domain above it
+    QSet<QString> selectors;
+    int offset = 0;
+    while (offset != -1 && offset < lowerHost.length()) {
+        QHash<QString, QList<ElementHidingRule> >::const_iterator it = m_domainRules.constFind(lowerHost.mid(offset));
+        if (it != m_domainRules.constEnd()) {
+            foreach (const ElementHidingRule &rule, it.value()) {
+                if (selectors.contains(rule.selector) || isExcluded(rule, lowerHost))
+                    continue;
+                selectors.insert(rule.selector);
+                styleSheet += hidingRule(rule.selector);
+            }
+        }
+        offset = lowerHost.indexOf(QLatin1Char('.'), offset);
+        if (offset != -1)
+            ++offset;
+    }
+    return styleSheet;
 }
 
+/*
+    Hides the elements with one style sheet added to the page instead of
+    looking up every rule in the document.  This also hides elements that
+    are added to the page later on.
+ */
 void AdBlockPage::applyRulesToPage(QWebPage *page)
 {
     if (!page || !page->mainFrame())
@@ -106,14 +182,25 @@ void AdBlockPage::applyRulesToPage(QWebPage *page)
     if (!manager->isEnabled())
         return;
 #if QT_VERSION >= 0x040600
+    QWebElement document = page->mainFrame()->documentElement();
+    QString styleId = QLatin1String(AdBlockStyleSheetId);
+    if (!document.findFirst(QLatin1String("style#") + styleId).isNull())
+        return;
+
     QString host = page->mainFrame()->url().host();
-    QList<AdBlockSubscription*> subscriptions = manager->subscriptions();
-    foreach (AdBlockSubscription *subscription, subscriptions) {
-        QList<const AdBlockRule*> rules = subscription->pageRules();
-        foreach (const AdBlockRule *rule, rules) {
-            checkRule(rule, page, host);
-        }
-    }
+    QString css = styleSheet(host);
+    if (css.isEmpty())
+        return;
+
+    QWebElement head = document.findFirst(QLatin1String("head"));
+    if (head.isNull())
+        head = document;
+    head.appendInside(QString(QLatin1String("<style type=\"text/css\" id=\"%1\"></style>")).arg(styleId));
+    QWebElement style = head.lastChild();
+    style.setPlainText(css);
+#if defined(ADBLOCKPAGE_DEBUG)
+    qDebug() << "AdBlockPage::" << __FUNCTION__ << host << css.length();
+#endif
 #endif
 }
 
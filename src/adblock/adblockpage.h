@@ -31,7 +31,9 @@
 
 #include <qobject.h>
 
-class AdBlockRule;
+#include <qhash.h>
+#include <qstringlist.h>
+
 class QWebPage;
 class AdBlockPage : public QObject
 {
@@ -41,9 +43,22 @@ public:
     AdBlockPage(QObject *parent = 0);
 
     void applyRulesToPage(QWebPage *page);
+    QString styleSheet(const QString &host);
 
 private:
-    void checkRule(const AdBlockRule *rule, QWebPage *page, const QString &host);
+    struct ElementHidingRule {
+        QString selector;
+        QStringList excludedDomains;
+    };
+
+    void buildIndex();
+    static bool isExcluded(const ElementHidingRule &rule, const QString &host);
+
+    int m_rulesGeneration;
+    // rules without any domain to hide on
+    QString m_genericStyleSheet;
+    QList<ElementHidingRule> m_genericRules;
+    QHash<QString, QList<ElementHidingRule> > m_domainRules;
 };
 
 #endif // ADBLOCKPAGE_H
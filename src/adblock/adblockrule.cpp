@@ -29,27 +29,155 @@
 
 #include "adblockrule.h"
 
+#include "adblockstringpool.h"
 #include "adblocksubscription.h"
 
+#include <qalgorithms.h>
+#include <qdatastream.h>
 #include <qdebug.h>
+#include <qhash.h>
+#include <qmutex.h>
 #include <qregexp.h>
 #include <qurl.h>
 
 // #define ADBLOCKRULE_DEBUG
 
+/*
+    Gives every domain that a rule lists a number, so that the rules only
+    keep an array of numbers and each domain is stored once for all of the
+    rules of all of the subscriptions.  Numbers are never given back, there
+    are only as many as there are different domains in the lists.
+
+    Rules are parsed in other threads, so the table is locked.
+ */
+class AdBlockDomainTable
+{
+
+public:
+    int id(const QString &domain)
+    {
+        QMutexLocker locker(&m_mutex);
+        QHash<QString, int>::const_iterator it = m_ids.constFind(domain);
+        if (it != m_ids.constEnd())
+            return it.value();
+        int id = m_domains.count();
+        m_domains.append(domain);
+        m_ids.insert(domain, id);
+        return id;
+    }
+
+    // the numbers of the domains that are known, -1 for the others
+    QVector<int> find(const QStringList &domains)
+    {
+        QMutexLocker locker(&m_mutex);
+        QVector<int> ids(domains.count());
+        for (int i = 0; i < domains.count(); ++i)
+            ids[i] = m_ids.value(domains.at(i), -1);
+        return ids;
+    }
+
+    QStringList domains(const int *begin, const int *end)
+    {
+        QMutexLocker locker(&m_mutex);
+        QStringList domains;
+        for (const int *it = begin; it != end; ++it)
+            domains.append(m_domains.at(*it));
+        return domains;
+    }
+
+private:
+    QMutex m_mutex;
+    QHash<QString, int> m_ids;
+    QStringList m_domains;
+};
+
+Q_GLOBAL_STATIC(AdBlockDomainTable, domainTable)
+
+// The sorted numbers of the domains, without duplicates
+static QVector<int> domainIds(const QStringList &domains)
+{
+    QVector<int> ids;
+    foreach (const QString &domain, domains)
+        ids.append(domainTable()->id(domain));
+    qSort(ids);
+    QVector<int> unique;
+    unique.reserve(ids.count());
+    for (int i = 0; i < ids.count(); ++i) {
+        if (i == 0 || ids.at(i) != ids.at(i - 1))
+            unique.append(ids.at(i));
+    }
+    return unique;
+}
+
 AdBlockRule::AdBlockRule(const QString &filter)
+    : m_regExp(0)
+    , m_includedDomainCount(0)
 {
     setFilter(filter);
 }
 
+/*
+    The compiled regular expression is not copied, the copy compiles its
+    own the first time it is used.
+ */
+AdBlockRule::AdBlockRule(const AdBlockRule &other)
+    : m_filter(other.m_filter)
+    , m_pattern(other.m_pattern)
+    , m_cssRule(other.m_cssRule)
+    , m_exception(other.m_exception)
+    , m_enabled(other.m_enabled)
+    , m_regExpRule(other.m_regExpRule)
+    , m_matchCase(other.m_matchCase)
+    , m_regExp(0)
+    , m_requestTypes(other.m_requestTypes)
+    , m_thirdParty(other.m_thirdParty)
+    , m_firstParty(other.m_firstParty)
+    , m_domains(other.m_domains)
+    , m_includedDomainCount(other.m_includedDomainCount)
+    , m_hitCount(int(other.m_hitCount))
+    , m_evaluationCount(int(other.m_evaluationCount))
+{
+}
+
+AdBlockRule::~AdBlockRule()
+{
+    delete m_regExp;
+}
+
+AdBlockRule &AdBlockRule::operator=(const AdBlockRule &other)
+{
+    if (this == &other)
+        return *this;
+    m_filter = other.m_filter;
+    m_pattern = other.m_pattern;
+    m_cssRule = other.m_cssRule;
+    m_exception = other.m_exception;
+    m_enabled = other.m_enabled;
+    m_regExpRule = other.m_regExpRule;
+    m_matchCase = other.m_matchCase;
+    delete m_regExp;
+    m_regExp = 0;
+    m_requestTypes = other.m_requestTypes;
+    m_thirdParty = other.m_thirdParty;
+    m_firstParty = other.m_firstParty;
+    m_domains = other.m_domains;
+    m_includedDomainCount = other.m_includedDomainCount;
+    m_hitCount = int(other.m_hitCount);
+    m_evaluationCount = int(other.m_evaluationCount);
+    return *this;
+}
+
 QString AdBlockRule::filter() const
 {
     return m_filter;
 }
 
+// A new filter starts without statistics
 void AdBlockRule::setFilter(const QString &filter)
 {
     m_filter = filter;
+    m_hitCount = 0;
+    m_evaluationCount = 0;
 
     m_cssRule = false;
     m_enabled = true;
@@ -76,20 +204,119 @@ void AdBlockRule::setFilter(const QString &filter)
         }
     }
     int options = parsedLine.indexOf(QLatin1String("$"), 0);
+    QStringList optionList;
     if (options >= 0) {
-        m_options = parsedLine.mid(options + 1).split(QLatin1Char(','));
+        optionList = parsedLine.mid(options + 1).split(QLatin1Char(','));
         parsedLine = parsedLine.left(options);
     }
 
     setPattern(parsedLine, regExpRule);
+    parseOptions(optionList);
+}
+
+static int requestType(const QString &option)
+{
+    QString type = option;
+    type.replace(QLatin1Char('_'), QLatin1Char('-'));
+    if (type == QLatin1String("other"))
+        return AdBlockRule::OtherRequest;
+    if (type == QLatin1String("script"))
+        return AdBlockRule::ScriptRequest;
+    if (type == QLatin1String("image") || type == QLatin1String("background"))
+        return AdBlockRule::ImageRequest;
+    if (type == QLatin1String("stylesheet"))
+        return AdBlockRule::StyleSheetRequest;
+    if (type == QLatin1String("object"))
+        return AdBlockRule::ObjectRequest;
+    if (type == QLatin1String("xmlhttprequest"))
+        return AdBlockRule::XmlHttpRequest;
+    if (type == QLatin1String("object-subrequest"))
+        return AdBlockRule::ObjectSubrequest;
+    if (type == QLatin1String("subdocument"))
+        return AdBlockRule::SubdocumentRequest;
+    if (type == QLatin1String("media"))
+        return AdBlockRule::MediaRequest;
+    if (type == QLatin1String("font"))
+        return AdBlockRule::FontRequest;
+    return 0;
+}
+
+/*
+    Turns the options into the request types, party and domains the rule
+    is restricted to.  A rule with an option that is not supported can not
+    be evaluated correctly and never matches.
+ */
+void AdBlockRule::parseOptions(const QStringList &options)
+{
+    m_matchCase = false;
+    m_thirdParty = false;
+    m_firstParty = false;
+    m_domains.clear();
+    m_includedDomainCount = 0;
+
+    QStringList includedDomains;
+    QStringList excludedDomains;
+    int includedTypes = 0;
+    int excludedTypes = 0;
+    bool supported = true;
+    foreach (const QString &rawOption, options) {
+        QString option = rawOption.trimmed();
+        bool negate = option.startsWith(QLatin1Char('~'));
+        if (negate)
+            option = option.mid(1);
 
-    if (m_options.contains(QLatin1String("match-case"))) {
-        m_regExp.setCaseSensitivity(Qt::CaseSensitive);
-        m_options.removeOne(QLatin1String("match-case"));
+        if (option == QLatin1String("match-case") && !negate) {
+            m_matchCase = true;
+        } else if (option == QLatin1String("third-party")) {
+            if (negate)
+                m_firstParty = true;
+            else
+                m_thirdParty = true;
+        } else if (option.startsWith(QLatin1String("domain=")) && !negate) {
+            QStringList domains = option.mid(7).toLower().split(QLatin1Char('|'), QString::SkipEmptyParts);
+            foreach (const QString &domain, domains) {
+                if (domain.startsWith(QLatin1Char('~')))
+                    excludedDomains.append(domain.mid(1));
+                else
+                    includedDomains.append(domain);
+            }
+        } else if (int type = requestType(option)) {
+            if (negate)
+                excludedTypes |= type;
+            else
+                includedTypes |= type;
+        } else {
+#if defined(ADBLOCKRULE_DEBUG)
+            qDebug() << "AdBlockRule::" << __FUNCTION__ << "option is not supported" << option << m_filter;
+#endif
+            supported = false;
+        }
     }
+
+    setDomains(domainIds(includedDomains), domainIds(excludedDomains));
+
+    if (!supported)
+        m_requestTypes = 0;
+    else if (includedTypes)
+        m_requestTypes = includedTypes & ~excludedTypes;
+    else
+        m_requestTypes = AllRequestTypes & ~excludedTypes;
 }
 
+/*
+    Matches the url alone, the domain options are checked against the host
+    of the url itself.
+ */
 bool AdBlockRule::networkMatch(const QString &encodedUrl) const
+{
+    return networkMatch(AdBlockRequest(encodedUrl));
+}
+
+/*
+    The options are checked first, they only test bits and look up the
+    domains of the page so that most rules fail before the url is looked at.
+ */
+bool AdBlockRule::networkMatch(const AdBlockRequest &request) const
 {
     if (m_cssRule) {
 #if defined(ADBLOCKRULE_DEBUG)
@@ -105,44 +332,60 @@ bool AdBlockRule::networkMatch(const QString &encodedUrl) const
         return false;
     }
 
-    bool matched = m_regExp.indexIn(encodedUrl) != -1;
-
-    if (matched
-        && !m_options.isEmpty()) {
-
-        // we only support domain right now
-        if (m_options.count() == 1) {
-            foreach (const QString &option, m_options) {
-                if (option.startsWith(QLatin1String("domain="))) {
-                    QUrl url = QUrl::fromEncoded(encodedUrl.toUtf8());
-                    QString host = url.host();
-                    QStringList domainOptions = option.mid(7).split(QLatin1Char('|'));
-                    foreach (QString domainOption, domainOptions) {
-                        bool negate = domainOption.at(0) == QLatin1Char('~');
-                        if (negate)
-                            domainOption = domainOption.mid(1);
-                        bool hostMatched = domainOption == host;
-                        if (hostMatched && !negate)
-                            return true;
-                        if (!hostMatched && negate)
-                            return true;
-                    }
-                }
-            }
-        }
-
-#if defined(ADBLOCKRULE_DEBUG)
-        qDebug() << "AdBlockRule::" << __FUNCTION__ << "options are currently not supported" << m_options;
-#endif
+    if (!(m_requestTypes & request.type()))
         return false;
-    }
+    if ((m_thirdParty && !request.isThirdParty())
+        || (m_firstParty && request.isThirdParty()))
+        return false;
+    if (!domainMatch(request))
+        return false;
+
+    bool matched;
+    if (m_regExpRule)
+        matched = regExpMatch(request.encodedUrl());
+    else
+        matched = patternMatch(request.encodedUrl());
 #if defined(ADBLOCKRULE_DEBUG)
-    //qDebug() << "AdBlockRule::" << __FUNCTION__ << encodedUrl << "MATCHED" << matched << filter();
+    //qDebug() << "AdBlockRule::" << __FUNCTION__ << request.encodedUrl() << "MATCHED" << matched << filter();
 #endif
 
     return matched;
 }
 
+/*
+    The included domains come first in the one array, both parts are
+    sorted so that the domains of a page can be looked up in either.
+ */
+void AdBlockRule::setDomains(const QVector<int> &includedDomains, const QVector<int> &excludedDomains)
+{
+    m_domains = includedDomains;
+    m_domains += excludedDomains;
+    m_domains.squeeze();
+    m_includedDomainCount = includedDomains.count();
+}
+
+// The most specific domain of the page that is listed decides
+bool AdBlockRule::domainMatch(const AdBlockRequest &request) const
+{
+    if (m_domains.isEmpty())
+        return true;
+
+    const int *included = m_domains.constData();
+    const int *excluded = included + m_includedDomainCount;
+    const int *end = included + m_domains.count();
+    const QVector<int> &domains = request.domainIds();
+    for (int i = 0; i < domains.count(); ++i) {
+        int domain = domains.at(i);
+        if (domain == -1)
+            continue;
+        if (qBinaryFind(excluded, end, domain) != end)
+            return false;
+        if (qBinaryFind(included, excluded, domain) != excluded)
+            return true;
+    }
+    return m_includedDomainCount == 0;
+}
+
 bool AdBlockRule::isException() const
 {
     return m_exception;
@@ -168,9 +411,48 @@ void AdBlockRule::setEnabled(bool enabled)
     }
 }
 
-QString AdBlockRule::regExpPattern() const
+/*
+    Replaces the filter by the copy in \a pool.  The pattern is usually the
+    whole filter, in which case it shares its data.  The domains are already
+    shared through their numbers.
+ */
+void AdBlockRule::internStrings(AdBlockStringPool *pool)
+{
+    if (!pool)
+        return;
+    m_filter = pool->intern(m_filter);
+    if (m_pattern == m_filter)
+        m_pattern = m_filter;
+}
+
+int AdBlockRule::hitCount() const
+{
+    return m_hitCount;
+}
+
+int AdBlockRule::evaluationCount() const
+{
+    return m_evaluationCount;
+}
+
+/*
+    The counters are only statistics, nothing is ordered by them, so they
+    are increased without any memory barrier from whatever thread matches.
+ */
+void AdBlockRule::addHit() const
+{
+    m_hitCount.fetchAndAddRelaxed(1);
+}
+
+void AdBlockRule::addEvaluation() const
+{
+    m_evaluationCount.fetchAndAddRelaxed(1);
+}
+
+void AdBlockRule::setStatistics(int hitCount, int evaluationCount)
 {
-    return m_regExp.pattern();
+    m_hitCount = hitCount;
+    m_evaluationCount = evaluationCount;
 }
 
 static QString convertPatternToRegExp(const QString &wildcardPattern) {
@@ -192,7 +474,377 @@ static QString convertPatternToRegExp(const QString &wildcardPattern) {
 
 void AdBlockRule::setPattern(const QString &pattern, bool isRegExp)
 {
-    m_regExp = QRegExp(isRegExp ? pattern : convertPatternToRegExp(pattern),
-                           Qt::CaseInsensitive, QRegExp::RegExp2);
+    m_pattern = pattern;
+    m_regExpRule = isRegExp;
+    delete m_regExp;
+    m_regExp = 0;
 }
 
+QString AdBlockRule::regExpPattern() const
+{
+    if (m_regExpRule)
+        return m_pattern;
+    return convertPatternToRegExp(m_pattern);
+}
+
+/*
+    Most rules are never the candidate for any url, so the regular
+    expression is only compiled once a url actually reaches this rule.
+ */
+bool AdBlockRule::regExpMatch(const QString &encodedUrl) const
+{
+    if (!m_regExp) {
+#if defined(ADBLOCKRULE_DEBUG)
+        qDebug() << "AdBlockRule::" << __FUNCTION__ << "compiling" << m_pattern;
+#endif
+        m_regExp = new QRegExp(m_pattern,
+                               m_matchCase ? Qt::CaseSensitive : Qt::CaseInsensitive,
+                               QRegExp::RegExp2);
+    }
+    return m_regExp->indexIn(encodedUrl) != -1;
+}
+
+
+// The parts of the pattern that convertPatternToRegExp() turns into anchors
+struct PatternBody {
+    int begin;
+    int end;
+    bool domainAnchor;
+    bool startAnchor;
+    bool endAnchor;
+};
+
+static PatternBody patternBody(const QString &pattern)
+{
+    PatternBody body;
+    const QChar *data = pattern.constData();
+    body.begin = 0;
+    body.end = pattern.length();
+    body.domainAnchor = false;
+    body.startAnchor = false;
+    body.endAnchor = false;
+
+    if (body.end >= 2
+        && data[body.end - 1] == QLatin1Char('|')
+        && data[body.end - 2] == QLatin1Char('^'))
+        --body.end;
+    while (body.begin < body.end && data[body.begin] == QLatin1Char('*'))
+        ++body.begin;
+    while (body.end > body.begin && data[body.end - 1] == QLatin1Char('*'))
+        --body.end;
+
+    if (body.end - body.begin >= 2
+        && data[body.begin] == QLatin1Char('|')
+        && data[body.begin + 1] == QLatin1Char('|')) {
+        body.domainAnchor = true;
+        body.begin += 2;
+    } else if (body.end > body.begin && data[body.begin] == QLatin1Char('|')) {
+        body.startAnchor = true;
+        ++body.begin;
+    }
+    if (body.end > body.begin && data[body.end - 1] == QLatin1Char('|')) {
+        body.endAnchor = true;
+        --body.end;
+    }
+    return body;
+}
+
+/*
+    Returns the lower case literal parts of the pattern, the text between
+    wildcards and separator placeholders.  Every url matched by the rule
+    contains all of them.  Parts shorter than three characters are skipped
+    and regular expression rules have no keywords.
+ */
+QStringList AdBlockRule::keywords() const
+{
+    QStringList keywords;
+    if (m_regExpRule || m_cssRule)
+        return keywords;
+
+    PatternBody body = patternBody(m_pattern);
+    const QChar *data = m_pattern.constData();
+    int i = body.begin;
+    while (i < body.end) {
+        int start = i;
+        while (i < body.end
+               && data[i] != QLatin1Char('*')
+               && data[i] != QLatin1Char('^'))
+            ++i;
+        if (i - start >= 3)
+            keywords.append(m_pattern.mid(start, i - start).toLower());
+        ++i;
+    }
+    return keywords;
+}
+
+static inline bool isWordCharacter(const QChar &c)
+{
+    return c.isLetterOrNumber() || c.isMark() || c == QLatin1Char('_');
+}
+
+// The separator placeholder ^, (?:[^\w\d\-.%]|$) in the regular expression
+static inline bool isSeparator(const QChar &c)
+{
+    return !isWordCharacter(c)
+        && c != QLatin1Char('-')
+        && c != QLatin1Char('.')
+        && c != QLatin1Char('%');
+}
+
+// Returns the offset after the segment when it matches at pos, otherwise -1
+static int matchSegment(const QChar *text, int length, int pos,
+                        const QChar *segment, int segmentLength, bool matchCase)
+{
+    for (int i = 0; i < segmentLength; ++i) {
+        if (segment[i] == QLatin1Char('^')) {
+            // the placeholder also matches the end of the url
+            if (pos == length)
+                continue;
+            if (!isSeparator(text[pos]))
+                return -1;
+        } else if (pos == length
+                   || (text[pos] != segment[i]
+                       && (matchCase || text[pos].toLower() != segment[i].toLower()))) {
+            return -1;
+        }
+        ++pos;
+    }
+    return pos;
+}
+
+/*
+    Matches the wildcard separated segments of the body against text
+    starting at pos.  Taking the first match of every segment is enough as
+    a segment only consumes less than its length at the end of the text.
+ */
+static bool matchBody(const QChar *text, int length, int pos,
+                      const QChar *body, int bodyLength,
+                      bool startAnchor, bool endAnchor, bool matchCase)
+{
+    int segmentStart = 0;
+    bool first = true;
+    while (true) {
+        int segmentEnd = segmentStart;
+        while (segmentEnd < bodyLength && body[segmentEnd] != QLatin1Char('*'))
+            ++segmentEnd;
+        const QChar *segment = body + segmentStart;
+        int segmentLength = segmentEnd - segmentStart;
+        bool last = (segmentEnd == bodyLength);
+
+        if (first && startAnchor) {
+            int end = matchSegment(text, length, pos, segment, segmentLength, matchCase);
+            if (end == -1 || (last && endAnchor && end != length))
+                return false;
+            pos = end;
+        } else if (last && endAnchor) {
+            int i = qMax(pos, length - segmentLength);
+            while (i <= length && matchSegment(text, length, i, segment, segmentLength, matchCase) != length)
+                ++i;
+            if (i > length)
+                return false;
+            pos = length;
+        } else {
+            int end = -1;
+            for (int i = pos; end == -1 && i <= length; ++i)
+                end = matchSegment(text, length, i, segment, segmentLength, matchCase);
+            if (end == -1)
+                return false;
+            pos = end;
+        }
+
+        if (last)
+            return true;
+        first = false;
+        segmentStart = segmentEnd + 1;
+    }
+}
+
+/*
+    Matches the wildcard pattern without going through QRegExp, with the
+    same result as the regular expression built by convertPatternToRegExp().
+ */
+bool AdBlockRule::patternMatch(const QString &encodedUrl) const
+{
+    PatternBody body = patternBody(m_pattern);
+    const QChar *bodyData = m_pattern.constData() + body.begin;
+    const int bodyLength = body.end - body.begin;
+    const QChar *text = encodedUrl.constData();
+    const int length = encodedUrl.length();
+
+    if (!body.domainAnchor)
+        return matchBody(text, length, 0, bodyData, bodyLength,
+                         body.startAnchor, body.endAnchor, m_matchCase);
+
+    // ^[\w\-]+:\/+(?!\/)(?:[^\/]+\.)?
+    int i = 0;
+    while (i < length && (isWordCharacter(text[i]) || text[i] == QLatin1Char('-')))
+        ++i;
+    if (i == 0 || i == length || text[i] != QLatin1Char(':'))
+        return false;
+    ++i;
+    if (i == length || text[i] != QLatin1Char('/'))
+        return false;
+    while (i < length && text[i] == QLatin1Char('/'))
+        ++i;
+
+    int hostStart = i;
+    if (matchBody(text, length, hostStart, bodyData, bodyLength,
+                  true, body.endAnchor, m_matchCase))
+        return true;
+    for (int j = hostStart + 1; j < length && text[j] != QLatin1Char('/'); ++j) {
+        if (text[j] == QLatin1Char('.')
+            && matchBody(text, length, j + 1, bodyData, bodyLength,
+                         true, body.endAnchor, m_matchCase))
+            return true;
+    }
+    return false;
+}
+
+enum RuleFlag {
+    CssRuleFlag = 0x01,
+    ExceptionFlag = 0x02,
+    EnabledFlag = 0x04,
+    RegExpRuleFlag = 0x08,
+    MatchCaseFlag = 0x10,
+    ThirdPartyFlag = 0x20,
+    FirstPartyFlag = 0x40
+};
+
+/*
+    Writes the already parsed rule so that reading it back does not have
+    to go through setFilter() again.
+ */
+QDataStream &operator<<(QDataStream &out, const AdBlockRule &rule)
+{
+    quint8 flags = 0;
+    if (rule.m_cssRule)
+        flags |= CssRuleFlag;
+    if (rule.m_exception)
+        flags |= ExceptionFlag;
+    if (rule.m_enabled)
+        flags |= EnabledFlag;
+    if (rule.m_regExpRule)
+        flags |= RegExpRuleFlag;
+    if (rule.m_matchCase)
+        flags |= MatchCaseFlag;
+    if (rule.m_thirdParty)
+        flags |= ThirdPartyFlag;
+    if (rule.m_firstParty)
+        flags |= FirstPartyFlag;
+    // the numbers are only valid in this process, the domains are written
+    const int *included = rule.m_domains.constData();
+    const int *excluded = included + rule.m_includedDomainCount;
+    const int *end = included + rule.m_domains.count();
+    out << rule.m_filter << rule.m_pattern << flags << qint32(rule.m_requestTypes)
+        << domainTable()->domains(included, excluded)
+        << domainTable()->domains(excluded, end);
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, AdBlockRule &rule)
+{
+    quint8 flags;
+    qint32 requestTypes;
+    QStringList includedDomains;
+    QStringList excludedDomains;
+    in >> rule.m_filter >> rule.m_pattern >> flags >> requestTypes
+       >> includedDomains >> excludedDomains;
+    rule.setDomains(domainIds(includedDomains), domainIds(excludedDomains));
+    if (rule.m_pattern == rule.m_filter)
+        rule.m_pattern = rule.m_filter;
+    rule.m_requestTypes = requestTypes;
+    rule.m_thirdParty = flags & ThirdPartyFlag;
+    rule.m_firstParty = flags & FirstPartyFlag;
+    rule.m_cssRule = flags & CssRuleFlag;
+    rule.m_exception = flags & ExceptionFlag;
+    rule.m_enabled = flags & EnabledFlag;
+    rule.m_regExpRule = flags & RegExpRuleFlag;
+    rule.m_matchCase = flags & MatchCaseFlag;
+    delete rule.m_regExp;
+    rule.m_regExp = 0;
+    return in;
+}
+
+/*
+    The most common second level domains under which anyone can register a
+    name, the sites below them are told apart by their third label.
+ */
+static const char * const publicSuffixes[] = {
+    "ac.uk", "co.uk", "gov.uk", "ltd.uk", "me.uk", "net.uk", "org.uk", "plc.uk",
+    "asn.au", "com.au", "edu.au", "gov.au", "id.au", "net.au", "org.au",
+    "ac.jp", "co.jp", "go.jp", "ne.jp", "or.jp",
+    "ac.nz", "co.nz", "geek.nz", "net.nz", "org.nz",
+    "ac.za", "co.za", "org.za",
+    "co.id", "co.il", "co.in", "co.kr", "co.th",
+    "com.ar", "com.br", "com.cn", "com.hk", "com.mx", "com.my",
+    "com.pl", "com.sg", "com.tr", "com.tw", "com.ua",
+    "net.br", "net.cn", "org.br", "org.cn",
+    0
+};
+
+static bool isPublicSuffix(const QString &domain)
+{
+    for (int i = 0; publicSuffixes[i]; ++i) {
+        if (domain == QLatin1String(publicSuffixes[i]))
+            return true;
+    }
+    return false;
+}
+
+/*
+    Without the whole list of public suffixes two hosts are taken to be the
+    same site when one is below the other or when they have more than their
+    top level domain in common, unless that is one of the public suffixes
+    above.  Telling a site apart from its own hosts would block their
+    content, so when in doubt the hosts are the same site.
+ */
+static bool isSameSite(const QString &host, const QString &otherHost)
+{
+    if (host == otherHost)
+        return true;
+    // an address is only the same site as itself
+    if (host.at(host.length() - 1).isDigit()
+        || otherHost.at(otherHost.length() - 1).isDigit())
+        return false;
+
+    QStringList labels = host.split(QLatin1Char('.'));
+    QStringList otherLabels = otherHost.split(QLatin1Char('.'));
+    int common = 0;
+    while (common < labels.count() && common < otherLabels.count()
+           && labels.at(labels.count() - 1 - common) == otherLabels.at(otherLabels.count() - 1 - common))
+        ++common;
+    if (common == labels.count() || common == otherLabels.count())
+        return true;
+    if (common < 2)
+        return false;
+    if (common > 2)
+        return true;
+    return !isPublicSuffix(labels.at(labels.count() - 2) + QLatin1Char('.') + labels.last());
+}
+
+/*
+    A request without a page is third party, unless there is no host to
+    tell.  Without a page the domain options look at the host of the url.
+ */
+AdBlockRequest::AdBlockRequest(const QString &encodedUrl, int type, const QString &firstPartyHost)
+    : m_encodedUrl(encodedUrl)
+    , m_type(type)
+    , m_thirdParty(false)
+{
+    QString host = QUrl::fromEncoded(encodedUrl.toUtf8()).host().toLower();
+    QString pageHost = firstPartyHost.toLower();
+    if (!host.isEmpty())
+        m_thirdParty = pageHost.isEmpty() || !isSameSite(host, pageHost);
+    if (pageHost.isEmpty())
+        pageHost = host;
+
+    QStringList domains;
+    int offset = 0;
+    while (offset != -1 && offset < pageHost.length()) {
+        domains.append(pageHost.mid(offset));
+        offset = pageHost.indexOf(QLatin1Char('.'), offset);
+        if (offset != -1)
+            ++offset;
+    }
+    m_domainIds = domainTable()->find(domains);
+}
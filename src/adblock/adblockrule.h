@@ -29,21 +29,45 @@
 #ifndef ADBLOCKRULE_H
 #define ADBLOCKRULE_H
 
+#include <qatomic.h>
 #include <qstringlist.h>
+#include <qvector.h>
 
+class QDataStream;
 class QUrl;
 class QRegExp;
+class AdBlockRequest;
+class AdBlockStringPool;
 class AdBlockRule
 {
 
 public:
+    // The kinds of requests the options of a rule can restrict it to
+    enum RequestType {
+        OtherRequest = 0x0001,
+        ScriptRequest = 0x0002,
+        ImageRequest = 0x0004,
+        StyleSheetRequest = 0x0008,
+        ObjectRequest = 0x0010,
+        XmlHttpRequest = 0x0020,
+        ObjectSubrequest = 0x0040,
+        SubdocumentRequest = 0x0080,
+        MediaRequest = 0x0100,
+        FontRequest = 0x0200,
+        AllRequestTypes = 0x03ff
+    };
+
     AdBlockRule(const QString &filter = QString());
+    AdBlockRule(const AdBlockRule &other);
+    ~AdBlockRule();
+    AdBlockRule &operator=(const AdBlockRule &other);
 
     QString filter() const;
     void setFilter(const QString &filter);
 
     bool isCSSRule() const { return m_cssRule; }
     bool networkMatch(const QString &encodedUrl) const;
+    bool networkMatch(const AdBlockRequest &request) const;
 
     bool isException() const;
     void setException(bool exception);
@@ -54,15 +78,78 @@ public:
     QString regExpPattern() const;
     void setPattern(const QString &pattern, bool isRegExp);
 
+    QStringList keywords() const;
+    void internStrings(AdBlockStringPool *pool);
+
+    // how often the rule decided a request and how often it was checked
+    int hitCount() const;
+    int evaluationCount() const;
+    void addHit() const;
+    void addEvaluation() const;
+    void setStatistics(int hitCount, int evaluationCount);
+
 private:
+    friend QDataStream &operator<<(QDataStream &out, const AdBlockRule &rule);
+    friend QDataStream &operator>>(QDataStream &in, AdBlockRule &rule);
+
+    void parseOptions(const QStringList &options);
+    void setDomains(const QVector<int> &includedDomains, const QVector<int> &excludedDomains);
+    bool domainMatch(const AdBlockRequest &request) const;
+    bool patternMatch(const QString &encodedUrl) const;
+    bool regExpMatch(const QString &encodedUrl) const;
+
     QString m_filter;
+    QString m_pattern;
 
     bool m_cssRule;
     bool m_exception;
     bool m_enabled;
-    QRegExp m_regExp;
-    QStringList m_options;
+    bool m_regExpRule;
+    bool m_matchCase;
+    // only regular expression rules have one, compiled on first use
+    mutable QRegExp *m_regExp;
+
+    // the parsed $options, 0 request types when an option is not supported
+    int m_requestTypes;
+    bool m_thirdParty;
+    bool m_firstParty;
+    // the numbers of the included domains and then of the excluded ones
+    QVector<int> m_domains;
+    int m_includedDomainCount;
+
+    mutable QAtomicInt m_hitCount;
+    mutable QAtomicInt m_evaluationCount;
 };
 
+/*
+    A request as the rules see it: the url together with the kind of
+    request and the host of the page that made it.  Everything the options
+    of a rule are checked against is worked out once when it is created.
+ */
+class AdBlockRequest
+{
+
+public:
+    explicit AdBlockRequest(const QString &encodedUrl = QString(),
+                            int type = AdBlockRule::OtherRequest,
+                            const QString &firstPartyHost = QString());
+
+    QString encodedUrl() const { return m_encodedUrl; }
+    int type() const { return m_type; }
+    bool isThirdParty() const { return m_thirdParty; }
+    // the numbers of the domains of the page from the most specific one
+    // down, -1 for a domain that no rule lists
+    const QVector<int> &domainIds() const { return m_domainIds; }
+
+private:
+    QString m_encodedUrl;
+    int m_type;
+    bool m_thirdParty;
+    QVector<int> m_domainIds;
+};
+
+QDataStream &operator<<(QDataStream &out, const AdBlockRule &rule);
+QDataStream &operator>>(QDataStream &in, AdBlockRule &rule);
+
 #endif // ADBLOCKRULE_H
 
@@ -0,0 +1,346 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "adblockruleindex.h"
+
+#include "adblockrule.h"
+
+#include <qalgorithms.h>
+#include <qdatastream.h>
+#include <qdebug.h>
+
+// #define ADBLOCKRULEINDEX_DEBUG
+
+// m_ruleKeywords values of the rules that are not filed under a keyword
+enum {
+    FallbackRule = -1,
+    PendingRule = -2
+};
+
+AdBlockRuleIndex::AdBlockRuleIndex()
+    : m_emptyKeywords(0)
+    , m_statisticsEnabled(false)
+{
+}
+
+void AdBlockRuleIndex::clear()
+{
+    m_automaton.clear();
+    m_keywordRules.clear();
+    m_fallbackRules.clear();
+    m_pendingRules.clear();
+    m_ruleKeywords.clear();
+    m_emptyKeywords = 0;
+}
+
+int AdBlockRuleIndex::count() const
+{
+    return m_ruleKeywords.count();
+}
+
+int AdBlockRuleIndex::keywordCount() const
+{
+    return m_automaton.keywordCount();
+}
+
+bool AdBlockRuleIndex::contains(const AdBlockRule *rule) const
+{
+    return m_ruleKeywords.contains(rule);
+}
+
+/*
+    Returns the id of the keyword to file a rule with \a keywords under or
+    -1 when none of them is in the automaton and \a addKeyword is false.
+ */
+int AdBlockRuleIndex::keywordId(const QStringList &keywords, bool addKeyword)
+{
+    // Prefer the keyword with the fewest rules so far so that common
+    // keywords such as "http://" or ".com/" do not end up with huge buckets.
+    QString bestKeyword;
+    int bestCount = -1;
+    foreach (const QString &keyword, keywords) {
+        int id = m_automaton.keywordId(keyword);
+        if (id == -1 && !addKeyword)
+            continue;
+        int count = (id == -1) ? 0 : m_keywordRules.at(id).count();
+        if (bestCount == -1
+            || count < bestCount
+            || (count == bestCount && keyword.length() > bestKeyword.length())) {
+            bestKeyword = keyword;
+            bestCount = count;
+        }
+    }
+    if (bestCount == -1)
+        return -1;
+    int id = m_automaton.addKeyword(bestKeyword);
+    if (id >= m_keywordRules.count()) {
+        m_emptyKeywords += id + 1 - m_keywordRules.count();
+        m_keywordRules.resize(id + 1);
+    }
+    return id;
+}
+
+void AdBlockRuleIndex::fileRule(const AdBlockRule *rule, int id)
+{
+    if (m_keywordRules.at(id).isEmpty())
+        --m_emptyKeywords;
+    m_keywordRules[id].append(rule);
+    m_ruleKeywords.insert(rule, id);
+}
+
+/*
+    Once the automaton is built a rule that only has new keywords is kept
+    in a list of pending rules, which are checked one by one like the
+    fallback rules.  The automaton is only built again when there are
+    enough of them, so that adding a rule stays cheap.
+ */
+void AdBlockRuleIndex::addRule(const AdBlockRule *rule)
+{
+    if (!rule || m_ruleKeywords.contains(rule))
+        return;
+
+    QStringList keywords = rule->keywords();
+    if (keywords.isEmpty()) {
+#if defined(ADBLOCKRULEINDEX_DEBUG)
+        qDebug() << "AdBlockRuleIndex::" << __FUNCTION__ << "no keyword for" << rule->filter();
+#endif
+        m_fallbackRules.append(rule);
+        m_ruleKeywords.insert(rule, FallbackRule);
+        return;
+    }
+
+    int id = keywordId(keywords, !m_automaton.isBuilt());
+    if (id == -1) {
+        m_pendingRules.append(rule);
+        m_ruleKeywords.insert(rule, PendingRule);
+        if (m_pendingRules.count() > qMax(16, m_automaton.keywordCount() / 8))
+            build();
+        return;
+    }
+    fileRule(rule, id);
+}
+
+/*
+    The keyword of the rule stays in the automaton, an empty list of rules
+    costs less than building the automaton again.  Once there are enough
+    keywords without any rule the index is rebuilt without them, like it
+    is built again when there are enough pending rules.
+ */
+void AdBlockRuleIndex::removeRule(const AdBlockRule *rule)
+{
+    QHash<const AdBlockRule*, int>::iterator it = m_ruleKeywords.find(rule);
+    if (it == m_ruleKeywords.end())
+        return;
+    int id = it.value();
+    m_ruleKeywords.erase(it);
+    if (id == FallbackRule)
+        m_fallbackRules.removeOne(rule);
+    else if (id == PendingRule)
+        m_pendingRules.removeOne(rule);
+    else if (m_keywordRules[id].removeOne(rule) && m_keywordRules.at(id).isEmpty())
+        ++m_emptyKeywords;
+
+    if (m_emptyKeywords > qMax(16, m_automaton.keywordCount() / 8))
+        rebuild();
+}
+
+/*
+    Files every rule again and builds a new automaton that only has the
+    keywords of the rules that are left.
+ */
+void AdBlockRuleIndex::rebuild()
+{
+#if defined(ADBLOCKRULEINDEX_DEBUG)
+    qDebug() << "AdBlockRuleIndex::" << __FUNCTION__ << m_emptyKeywords << m_automaton.keywordCount();
+#endif
+    QList<const AdBlockRule*> rules;
+    for (int i = 0; i < m_keywordRules.count(); ++i)
+        rules += m_keywordRules.at(i);
+    rules += m_pendingRules;
+    bool built = m_automaton.isBuilt();
+
+    m_automaton.clear();
+    m_keywordRules.clear();
+    m_pendingRules.clear();
+    m_emptyKeywords = 0;
+    foreach (const AdBlockRule *rule, rules)
+        fileRule(rule, keywordId(rule->keywords(), true));
+    if (built && m_automaton.keywordCount() > 0)
+        m_automaton.build();
+}
+
+/*
+    Files the pending rules under their keywords and builds the automaton
+    right away instead of on the first match.
+ */
+void AdBlockRuleIndex::build()
+{
+#if defined(ADBLOCKRULEINDEX_DEBUG)
+    qDebug() << "AdBlockRuleIndex::" << __FUNCTION__ << m_pendingRules.count();
+#endif
+    QList<const AdBlockRule*> pendingRules = m_pendingRules;
+    m_pendingRules.clear();
+    foreach (const AdBlockRule *rule, pendingRules)
+        fileRule(rule, keywordId(rule->keywords(), true));
+
+    if (m_automaton.keywordCount() > 0 && !m_automaton.isBuilt())
+        m_automaton.build();
+}
+
+// Counts every rule that is checked against a request, see AdBlockRule::evaluationCount()
+void AdBlockRuleIndex::setStatisticsEnabled(bool enabled)
+{
+    m_statisticsEnabled = enabled;
+}
+
+const AdBlockRule *AdBlockRuleIndex::match(const QString &encodedUrl) const
+{
+    return match(AdBlockRequest(encodedUrl));
+}
+
+const AdBlockRule *AdBlockRuleIndex::match(const AdBlockRequest &request) const
+{
+    if (m_ruleKeywords.isEmpty())
+        return 0;
+
+    if (m_automaton.keywordCount() > 0) {
+        if (!m_automaton.isBuilt())
+            m_automaton.build();
+
+        QVector<int> keywordIds;
+        m_automaton.search(request.encodedUrl().toLower(), keywordIds);
+        qSort(keywordIds.begin(), keywordIds.end());
+        for (int i = 0; i < keywordIds.count(); ++i) {
+            int id = keywordIds.at(i);
+            if (i > 0 && id == keywordIds.at(i - 1))
+                continue;
+            const QList<const AdBlockRule*> &rules = m_keywordRules.at(id);
+            for (int j = 0; j < rules.count(); ++j) {
+                if (m_statisticsEnabled)
+                    rules.at(j)->addEvaluation();
+                if (rules.at(j)->networkMatch(request))
+                    return rules.at(j);
+            }
+        }
+    }
+
+    for (int i = 0; i < m_fallbackRules.count(); ++i) {
+        if (m_statisticsEnabled)
+            m_fallbackRules.at(i)->addEvaluation();
+        if (m_fallbackRules.at(i)->networkMatch(request))
+            return m_fallbackRules.at(i);
+    }
+
+    for (int i = 0; i < m_pendingRules.count(); ++i) {
+        if (m_statisticsEnabled)
+            m_pendingRules.at(i)->addEvaluation();
+        if (m_pendingRules.at(i)->networkMatch(request))
+            return m_pendingRules.at(i);
+    }
+    return 0;
+}
+
+/*
+    Writes the index with every rule replaced by its offset in the list the
+    rules are stored in, see load().
+ */
+void AdBlockRuleIndex::save(QDataStream &out, const QHash<const AdBlockRule*, int> &ruleOffsets)
+{
+    build();
+    out << m_automaton;
+    out << qint32(m_keywordRules.count());
+    for (int i = 0; i < m_keywordRules.count(); ++i)
+        saveRules(out, m_keywordRules.at(i), ruleOffsets);
+    saveRules(out, m_fallbackRules, ruleOffsets);
+}
+
+/*
+    Reads an index written by save(), \a rules has to be the same list of
+    rules the offsets were taken from.
+ */
+bool AdBlockRuleIndex::load(QDataStream &in, const QList<AdBlockRule*> &rules)
+{
+    clear();
+
+    qint32 keywordCount;
+    in >> m_automaton;
+    in >> keywordCount;
+    if (in.status() != QDataStream::Ok
+        || keywordCount != m_automaton.keywordCount()) {
+        clear();
+        return false;
+    }
+
+    m_keywordRules.resize(keywordCount);
+    for (int i = 0; i < keywordCount; ++i) {
+        if (!loadRules(in, m_keywordRules[i], rules)) {
+            clear();
+            return false;
+        }
+    }
+    if (!loadRules(in, m_fallbackRules, rules)) {
+        clear();
+        return false;
+    }
+
+    for (int i = 0; i < m_keywordRules.count(); ++i) {
+        if (m_keywordRules.at(i).isEmpty())
+            ++m_emptyKeywords;
+        foreach (const AdBlockRule *rule, m_keywordRules.at(i))
+            m_ruleKeywords.insert(rule, i);
+    }
+    foreach (const AdBlockRule *rule, m_fallbackRules)
+        m_ruleKeywords.insert(rule, FallbackRule);
+    return true;
+}
+
+void AdBlockRuleIndex::saveRules(QDataStream &out, const QList<const AdBlockRule*> &rules,
+                                 const QHash<const AdBlockRule*, int> &ruleOffsets)
+{
+    out << qint32(rules.count());
+    for (int i = 0; i < rules.count(); ++i)
+        out << qint32(ruleOffsets.value(rules.at(i), -1));
+}
+
+bool AdBlockRuleIndex::loadRules(QDataStream &in, QList<const AdBlockRule*> &rules,
+                                 const QList<AdBlockRule*> &allRules)
+{
+    qint32 count;
+    in >> count;
+    if (in.status() != QDataStream::Ok || count < 0)
+        return false;
+    for (int i = 0; i < count; ++i) {
+        qint32 offset;
+        in >> offset;
+        if (in.status() != QDataStream::Ok
+            || offset < 0 || offset >= allRules.count())
+            return false;
+        rules.append(allRules.at(offset));
+    }
+    return true;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef ADBLOCKRULEINDEX_H
+#define ADBLOCKRULEINDEX_H
+
+#include "adblockautomaton.h"
+
+#include <qhash.h>
+#include <qlist.h>
+#include <qstringlist.h>
+#include <qvector.h>
+
+class AdBlockRequest;
+class AdBlockRule;
+class QDataStream;
+
+/*
+    Index over network rules that only evaluates the rules that can possibly
+    match a url.
+
+    Every rule is filed under one of its keywords, see AdBlockRule::keywords(),
+    preferring the keyword shared by the fewest rules.  All keywords are
+    compiled into one AdBlockAutomaton so that a single pass over the url
+    finds the candidate rules, which then check their anchors and separators.
+    Rules without a keyword are kept in a fallback list that is always checked.
+
+    Removing a rule only looks at the pointer, so it is safe to remove rules
+    that have already been deleted.
+ */
+class AdBlockRuleIndex
+{
+
+public:
+    AdBlockRuleIndex();
+
+    void clear();
+    void addRule(const AdBlockRule *rule);
+    void removeRule(const AdBlockRule *rule);
+    bool contains(const AdBlockRule *rule) const;
+    int count() const;
+    int keywordCount() const;
+
+    void build();
+    void setStatisticsEnabled(bool enabled);
+    const AdBlockRule *match(const QString &encodedUrl) const;
+    const AdBlockRule *match(const AdBlockRequest &request) const;
+
+    void save(QDataStream &out, const QHash<const AdBlockRule*, int> &ruleOffsets);
+    bool load(QDataStream &in, const QList<AdBlockRule*> &rules);
+
+private:
+    int keywordId(const QStringList &keywords, bool addKeyword);
+    void fileRule(const AdBlockRule *rule, int id);
+    void rebuild();
+
+    static void saveRules(QDataStream &out, const QList<const AdBlockRule*> &rules,
+                          const QHash<const AdBlockRule*, int> &ruleOffsets);
+    static bool loadRules(QDataStream &in, QList<const AdBlockRule*> &rules,
+                          const QList<AdBlockRule*> &allRules);
+
+    mutable AdBlockAutomaton m_automaton;
+    QVector<QList<const AdBlockRule*> > m_keywordRules;
+    QList<const AdBlockRule*> m_fallbackRules;
+    QList<const AdBlockRule*> m_pendingRules;
+    // the keyword id every rule is filed under
+    QHash<const AdBlockRule*, int> m_ruleKeywords;
+    // keywords in the automaton that no rule is filed under any more
+    int m_emptyKeywords;
+    bool m_statisticsEnabled;
+};
+
+#endif // ADBLOCKRULEINDEX_H
+
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "adblockstringpool.h"
+
+#include <qdebug.h>
+
+// #define ADBLOCKSTRINGPOOL_DEBUG
+
+AdBlockStringPool::AdBlockStringPool()
+{
+}
+
+/*
+    Returns the pooled copy of \a string, which shares its data with every
+    other string interned with the same contents.
+ */
+QString AdBlockStringPool::intern(const QString &string)
+{
+    if (string.isEmpty())
+        return QString();
+    QMutexLocker locker(&m_mutex);
+    QSet<QString>::const_iterator it = m_strings.constFind(string);
+    if (it != m_strings.constEnd())
+        return *it;
+    return *m_strings.insert(string);
+}
+
+int AdBlockStringPool::count() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_strings.count();
+}
+
+/*
+    Drops the strings that only the pool still holds, such as the ones of
+    the rules of a list that was updated.
+ */
+void AdBlockStringPool::squeeze()
+{
+    QMutexLocker locker(&m_mutex);
+#if defined(ADBLOCKSTRINGPOOL_DEBUG)
+    int count = m_strings.count();
+#endif
+    QSet<QString>::iterator it = m_strings.begin();
+    while (it != m_strings.end()) {
+        if (it->isDetached())
+            it = m_strings.erase(it);
+        else
+            ++it;
+    }
+#if defined(ADBLOCKSTRINGPOOL_DEBUG)
+    qDebug() << "AdBlockStringPool::" << __FUNCTION__ << count << "->" << m_strings.count();
+#endif
+}
@@ -28,26 +28,157 @@
 
 #include "adblocksubscription.h"
 
+#include "adblockmanager.h"
+#include "adblockstringpool.h"
 #include "browserapplication.h"
 #include "networkaccessmanager.h"
 
 #include <qcryptographichash.h>
+#include <qdatastream.h>
 #include <qdebug.h>
 #include <qfile.h>
+#include <qfileinfo.h>
+#include <qfuturewatcher.h>
+#include <qmutex.h>
 #include <qnetworkreply.h>
+#include <qtconcurrentrun.h>
+#include <qtemporaryfile.h>
 #include <qtextstream.h>
+#include <qwaitcondition.h>
 
 // #define ADBLOCKSUBSCRIPTION_DEBUG
 
+/*
+    The rules of a list together with their indexes, built away from the
+    rest of the subscription so that it can be done in another thread.
+ */
+struct AdBlockSubscription::ParsedRules
+{
+    ParsedRules(AdBlockStringPool *pool) : stringPool(pool) {}
+    ~ParsedRules() { qDeleteAll(rules); }
+
+    AdBlockStringPool *stringPool;
+    QList<AdBlockRule*> rules;
+    AdBlockRuleIndex networkExceptionRules;
+    AdBlockRuleIndex networkBlockRules;
+    QList<const AdBlockRule*> pageRules;
+};
+
+/*
+    The data of a list that is being downloaded.  The GUI thread appends
+    every piece as it arrives and the parsing job takes it from there, so
+    that the rules are parsed while the rest of the list is still on its
+    way without the network callbacks doing any of the work.
+ */
+class AdBlockSubscription::DownloadBuffer
+{
+
+public:
+    DownloadBuffer() : m_finished(false), m_aborted(false) {}
+
+    void append(const QByteArray &data)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_data += data;
+        m_changed.wakeAll();
+    }
+
+    // nothing is appended any more and the rules file has the whole list
+    void finish()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_finished = true;
+        m_changed.wakeAll();
+    }
+
+    // the list is not used, the parsing job stops as soon as it can
+    void abort()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_aborted = true;
+        m_changed.wakeAll();
+    }
+
+    bool isAborted() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_aborted;
+    }
+
+    /*
+        Waits for more data and moves it into \a data.  Returns false once
+        the download is finished and all of the data was taken, or when it
+        was aborted.
+     */
+    bool take(QByteArray &data)
+    {
+        QMutexLocker locker(&m_mutex);
+        while (m_data.isEmpty() && !m_finished && !m_aborted)
+            m_changed.wait(&m_mutex);
+        if (m_aborted || m_data.isEmpty())
+            return false;
+        data = m_data;
+        m_data.clear();
+        return true;
+    }
+
+private:
+    mutable QMutex m_mutex;
+    QWaitCondition m_changed;
+    QByteArray m_data;
+    bool m_finished;
+    bool m_aborted;
+};
+
+static void indexRules(const QList<AdBlockRule*> &rules,
+                       AdBlockRuleIndex &networkExceptionRules,
+                       AdBlockRuleIndex &networkBlockRules,
+                       QList<const AdBlockRule*> &pageRules)
+{
+    for (int i = 0; i < rules.count(); ++i) {
+        const AdBlockRule *rule = rules.at(i);
+        if (!rule->isEnabled())
+            continue;
+
+        if (rule->isCSSRule()) {
+            pageRules.append(rule);
+            continue;
+        }
+
+        if (rule->isException()) {
+            networkExceptionRules.addRule(rule);
+        } else {
+            networkBlockRules.addRule(rule);
+        }
+    }
+    networkExceptionRules.build();
+    networkBlockRules.build();
+}
+
 AdBlockSubscription::AdBlockSubscription(const QUrl &url, QObject *parent)
     : QObject(parent)
     , m_url(url.toEncoded())
     , m_enabled(false)
+    , m_statisticsEnabled(false)
     , m_downloading(0)
+    , m_downloadFile(0)
+    , m_downloadBuffer(0)
+    , m_parsing(0)
 {
     parseUrl(url);
 }
 
+AdBlockSubscription::~AdBlockSubscription()
+{
+    discardDownload();
+    if (m_parsing) {
+        m_parsing->waitForFinished();
+        delete m_parsing->result();
+    }
+    delete m_downloadBuffer;
+    qDeleteAll(m_rules);
+}
+
 void AdBlockSubscription::parseUrl(const QUrl &url)
 {
 #if defined(ADBLOCKSUBSCRIPTION_DEBUG)
@@ -64,6 +195,8 @@ void AdBlockSubscription::parseUrl(const QUrl &url)
     QByteArray lastUpdateByteArray = url.encodedQueryItemValue("lastUpdate");
     QString lastUpdateString = QUrl::fromPercentEncoding(lastUpdateByteArray);
     m_lastUpdate = QDateTime::fromString(lastUpdateString, Qt::ISODate);
+    m_lastModified = QUrl::fromPercentEncoding(url.encodedQueryItemValue("lastModified")).toLatin1();
+    m_entityTag = QUrl::fromPercentEncoding(url.encodedQueryItemValue("etag")).toLatin1();
     loadRules();
 }
 
@@ -82,6 +215,10 @@ QUrl AdBlockSubscription::url() const
         queryItems.append(Query(QLatin1String("enabled"), QLatin1String("false")));
     if (m_lastUpdate.isValid())
         queryItems.append(Query(QLatin1String("lastUpdate"), m_lastUpdate.toString(Qt::ISODate)));
+    if (!m_lastModified.isEmpty())
+        queryItems.append(Query(QLatin1String("lastModified"), QString::fromLatin1(m_lastModified)));
+    if (!m_entityTag.isEmpty())
+        queryItems.append(Query(QLatin1String("etag"), QString::fromLatin1(m_entityTag)));
     url.setQueryItems(queryItems);
     return url;
 }
@@ -96,7 +233,6 @@ void AdBlockSubscription::setEnabled(bool enabled)
     if (m_enabled == enabled)
         return;
     m_enabled = enabled;
-    populateCache();
     emit changed();
 }
 
@@ -124,6 +260,8 @@ void AdBlockSubscription::setLocation(const QUrl &url)
         return;
     m_location = url.toEncoded();
     m_lastUpdate = QDateTime();
+    m_lastModified.clear();
+    m_entityTag.clear();
     emit changed();
 }
 
@@ -145,48 +283,83 @@ QString AdBlockSubscription::rulesFileName() const
     return fileName;
 }
 
+/*
+    The parsed rules are cached next to the downloaded lists, local lists
+    get their cache in the data directory as well.
+ */
+QString AdBlockSubscription::cacheFileName() const
+{
+    if (m_location.isEmpty())
+        return QString();
+
+    QByteArray sha1 = QCryptographicHash::hash(m_location, QCryptographicHash::Sha1).toHex();
+    QString fileName = BrowserApplication::dataFilePath(QString(QLatin1String("adblock_subscription_%1.cache")).arg(QLatin1String(sha1)));
+    return fileName;
+}
+
+/*
+    The rules of the subscriptions of a manager share the strings pool of
+    the manager, see AdBlockManager::stringPool().
+ */
+AdBlockStringPool *AdBlockSubscription::stringPool() const
+{
+    AdBlockManager *manager = qobject_cast<AdBlockManager*>(parent());
+    return manager ? manager->stringPool() : 0;
+}
+
+// The list is downloaded next to the rules file so that it stays intact
+QString AdBlockSubscription::downloadFileName() const
+{
+    return rulesFileName() + QLatin1String(".download");
+}
+
 void AdBlockSubscription::loadRules()
 {
     QString fileName = rulesFileName();
 #if defined(ADBLOCKSUBSCRIPTION_DEBUG)
     qDebug() << "AdBlockSubscription::" << __FUNCTION__ << fileName;
 #endif
-    QFile file(fileName);
-    if (file.exists()) {
-        if (!file.open(QFile::ReadOnly)) {
+    QFileInfo fileInfo(fileName);
+    if (fileInfo.exists() && loadCache()) {
+        emit rulesLoaded();
+        emit rulesChanged();
+    } else if (fileInfo.exists()) {
+        if (!fileInfo.isReadable()) {
             qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to open adblock file for reading" << fileName;
         } else {
-            QTextStream textStream(&file);
-            QString header = textStream.readLine(1024);
-            if (!header.startsWith(QLatin1String("[Adblock"))) {
-                qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "adblock file does not start with [Adblock" << fileName << "Header:" << header;
-                file.close();
-                file.remove();
-                m_lastUpdate = QDateTime();
-            } else {
-                m_rules.clear();
-                while (!textStream.atEnd()) {
-                    QString line = textStream.readLine();
-                    m_rules.append(AdBlockRule(line));
-                }
-                populateCache();
-                emit rulesChanged();
-            }
+            // whether the list is out of date is known once it is parsed
+            parseRulesFile();
+            return;
         }
     }
+    updateIfOutOfDate();
+}
 
+void AdBlockSubscription::updateIfOutOfDate()
+{
     if (!m_lastUpdate.isValid()
         || m_lastUpdate.addDays(7) < QDateTime::currentDateTime()) {
         updateNow();
     }
 }
 
+/*
+    Reading, parsing and indexing the rules file is done in another thread,
+    the current rules keep being used until the new ones are ready.
+ */
+void AdBlockSubscription::parseRulesFile()
+{
+    m_parsing = new QFutureWatcher<ParsedRules*>(this);
+    connect(m_parsing, SIGNAL(finished()), this, SLOT(rulesParsed()));
+    m_parsing->setFuture(QtConcurrent::run(parseRules, rulesFileName(), cacheFileName(), stringPool()));
+}
+
 void AdBlockSubscription::updateNow()
 {
 #if defined(ADBLOCKSUBSCRIPTION_DEBUG)
     qDebug() << "AdBlockSubscription::" << __FUNCTION__ << location();
 #endif
-    if (m_downloading) {
+    if (m_downloading || m_parsing) {
 #if defined(ADBLOCKSUBSCRIPTION_DEBUG)
         qDebug() << "AdBlockSubscription::" << __FUNCTION__ << "already downloading, stopping";
 #endif
@@ -210,10 +383,99 @@ void AdBlockSubscription::updateNow()
         return;
     }
 
-    QNetworkRequest request(location());
-    QNetworkReply *reply = BrowserApplication::networkAccessManager()->get(request);
-    m_downloading = reply;
-    connect(reply, SIGNAL(finished()), this, SLOT(rulesDownloaded()));
+    download(location());
+}
+
+/*
+    When there is a list already the server is asked to only send it again
+    if it changed since it was downloaded.
+ */
+void AdBlockSubscription::download(const QUrl &url)
+{
+    QNetworkRequest request(url);
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork);
+    request.setAttribute(QNetworkRequest::CacheSaveControlAttribute, false);
+    if (QFile::exists(rulesFileName())) {
+        if (!m_lastModified.isEmpty())
+            request.setRawHeader("If-Modified-Since", m_lastModified);
+        if (!m_entityTag.isEmpty())
+            request.setRawHeader("If-None-Match", m_entityTag);
+    }
+    m_downloading = BrowserApplication::networkAccessManager()->get(request);
+    connect(m_downloading, SIGNAL(readyRead()), this, SLOT(rulesDataAvailable()));
+    connect(m_downloading, SIGNAL(finished()), this, SLOT(rulesDownloaded()));
+}
+
+void AdBlockSubscription::rulesDataAvailable()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || reply != m_downloading)
+        return;
+
+    if (!readDownloadedRules(reply, false)) {
+        discardDownload();
+        m_downloading = 0;
+        disconnect(reply, 0, this, 0);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
+/*
+    Writes the data that has arrived so far to the download file and hands
+    it to the job that parses it, see parseDownload().  The job is started
+    once the first line shows that the data is an adblock list, until then
+    the line is left in the reply unless the reply is \a finished.
+    Returns false when the data is not an adblock list.
+ */
+bool AdBlockSubscription::readDownloadedRules(QNetworkReply *reply, bool finished)
+{
+    // the body of a redirect or a not modified reply is not a list
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status >= 300) {
+        reply->readAll();
+        return true;
+    }
+
+    if (!m_downloadFile) {
+        if (!reply->canReadLine() && !(finished && reply->bytesAvailable() > 0))
+            return true;
+        QByteArray header = reply->canReadLine() ? reply->readLine() : reply->readAll();
+        if (!header.startsWith("[Adblock")) {
+            qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "adblock file does not start with [Adblock" << location() << "Header:" << header.left(1024);
+            return false;
+        }
+        m_downloadFile = new QFile(downloadFileName());
+        if (!m_downloadFile->open(QFile::WriteOnly | QFile::Truncate)) {
+            qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to open adblock file for writing:" << m_downloadFile->fileName();
+            return false;
+        }
+        m_downloadFile->write(header);
+
+        m_downloadBuffer = new DownloadBuffer;
+        m_parsing = new QFutureWatcher<ParsedRules*>(this);
+        connect(m_parsing, SIGNAL(finished()), this, SLOT(rulesParsed()));
+        m_parsing->setFuture(QtConcurrent::run(parseDownload, m_downloadBuffer,
+                                               rulesFileName(), cacheFileName(), stringPool()));
+    }
+
+    QByteArray data = reply->readAll();
+    if (!data.isEmpty()) {
+        m_downloadFile->write(data);
+        m_downloadBuffer->append(data);
+    }
+    return true;
+}
+
+void AdBlockSubscription::discardDownload()
+{
+    if (m_downloadBuffer)
+        m_downloadBuffer->abort();
+    if (m_downloadFile) {
+        m_downloadFile->remove();
+        delete m_downloadFile;
+        m_downloadFile = 0;
+    }
 }
 
 void AdBlockSubscription::rulesDownloaded()
@@ -228,14 +490,25 @@ void AdBlockSubscription::rulesDownloaded()
 #endif
         return;
     }
+    m_downloading = 0;
 
-    QByteArray response = reply->readAll();
+    bool isList = reply->error() == QNetworkReply::NoError
+                  && readDownloadedRules(reply, true);
     QUrl redirect = reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl();
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray lastModified = reply->rawHeader("Last-Modified");
+    QByteArray entityTag = reply->rawHeader("ETag");
     reply->close();
     reply->deleteLater();
 
     if (reply->error() != QNetworkReply::NoError) {
         qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "error" << reply->errorString();
+        discardDownload();
+        return;
+    }
+
+    if (!isList) {
+        discardDownload();
         return;
     }
 
@@ -243,28 +516,187 @@ void AdBlockSubscription::rulesDownloaded()
 #if defined(ADBLOCKSUBSCRIPTION_DEBUG)
         qDebug() << "AdBlockSubscription::" << __FUNCTION__ << "redirect to:" << redirect;
 #endif
-        QNetworkRequest request(redirect);
-        m_downloading = BrowserApplication::networkAccessManager()->get(request);
-        connect(m_downloading, SIGNAL(finished()), this, SLOT(rulesDownloaded()));
+        discardDownload();
+        download(redirect);
+        return;
+    }
+
+    if (status == 304) {
+#if defined(ADBLOCKSUBSCRIPTION_DEBUG)
+        qDebug() << "AdBlockSubscription::" << __FUNCTION__ << "not modified";
+#endif
+        m_lastUpdate = QDateTime::currentDateTime();
+        emit changed();
         return;
     }
 
-    if (response.isEmpty()) {
+    if (!m_downloadFile) {
         qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "empty response";
+        discardDownload();
         return;
     }
 
     QString fileName = rulesFileName();
-    QFile file(fileName);
-    if (!file.open(QFile::ReadWrite)) {
-        qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to open adblock file for writing:" << fileName;
+    m_downloadFile->close();
+    QFile::remove(fileName);
+    if (!m_downloadFile->rename(fileName)) {
+        qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to replace adblock file:" << fileName;
+        discardDownload();
         return;
     }
-    file.write(response);
+    delete m_downloadFile;
+    m_downloadFile = 0;
+    m_lastModified = lastModified;
+    m_entityTag = entityTag;
     m_lastUpdate = QDateTime::currentDateTime();
-    loadRules();
+
+    // the cache can only be written for the renamed file
+    m_downloadBuffer->finish();
     emit changed();
-    m_downloading = 0;
+}
+
+void AdBlockSubscription::rulesParsed()
+{
+    ParsedRules *parsedRules = m_parsing->result();
+    m_parsing->deleteLater();
+    m_parsing = 0;
+    bool downloaded = (m_downloadBuffer != 0);
+    delete m_downloadBuffer;
+    m_downloadBuffer = 0;
+#if defined(ADBLOCKSUBSCRIPTION_DEBUG)
+    qDebug() << "AdBlockSubscription::" << __FUNCTION__ << rulesFileName() << (parsedRules != 0);
+#endif
+    // a download that was not used leaves the current list alone
+    if (!parsedRules && downloaded)
+        return;
+
+    if (!parsedRules) {
+        QFile::remove(rulesFileName());
+        m_lastUpdate = QDateTime();
+        emit changed();
+    } else {
+        setRules(parsedRules);
+        emit rulesLoaded();
+        emit rulesChanged();
+    }
+    updateIfOutOfDate();
+}
+
+/*
+    Reads the list, indexes its rules and writes the cache for them.  This
+    only uses its arguments so it can run in any thread.  Returns 0 when
+    the file is not an adblock list.
+ */
+AdBlockSubscription::ParsedRules *AdBlockSubscription::parseRules(const QString &rulesFileName,
+        const QString &cacheFileName, AdBlockStringPool *stringPool)
+{
+    QFile file(rulesFileName);
+    if (!file.open(QFile::ReadOnly)) {
+        qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to open adblock file for reading" << rulesFileName;
+        return 0;
+    }
+    QTextStream textStream(&file);
+    textStream.setCodec("UTF-8");
+    QString header = textStream.readLine(1024);
+    if (!header.startsWith(QLatin1String("[Adblock"))) {
+        qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "adblock file does not start with [Adblock" << rulesFileName << "Header:" << header;
+        return 0;
+    }
+
+    ParsedRules *parsedRules = new ParsedRules(stringPool);
+    while (!textStream.atEnd()) {
+        QString line = textStream.readLine();
+        parsedRules->rules.append(new AdBlockRule(line));
+    }
+    return indexParsedRules(parsedRules, rulesFileName, cacheFileName);
+}
+
+static void appendRule(QList<AdBlockRule*> &rules, QByteArray line)
+{
+    while (line.endsWith('\n') || line.endsWith('\r'))
+        line.chop(1);
+    rules.append(new AdBlockRule(QString::fromUtf8(line)));
+}
+
+/*
+    Parses the lines of a list while it is downloaded, the header has
+    already been checked.  Once the download is finished the rules are
+    indexed and the cache is written.  This only uses its arguments so it
+    can run in any thread.  Returns 0 when the download was aborted.
+ */
+AdBlockSubscription::ParsedRules *AdBlockSubscription::parseDownload(DownloadBuffer *downloadBuffer,
+        const QString &rulesFileName, const QString &cacheFileName, AdBlockStringPool *stringPool)
+{
+    ParsedRules *parsedRules = new ParsedRules(stringPool);
+    QByteArray pending;
+    QByteArray data;
+    while (downloadBuffer->take(data)) {
+        pending += data;
+        int start = 0;
+        int end;
+        while ((end = pending.indexOf('\n', start)) != -1) {
+            appendRule(parsedRules->rules, pending.mid(start, end - start));
+            start = end + 1;
+        }
+        pending.remove(0, start);
+    }
+
+    if (downloadBuffer->isAborted()) {
+        delete parsedRules;
+        return 0;
+    }
+    if (!pending.isEmpty())
+        appendRule(parsedRules->rules, pending);
+    return indexParsedRules(parsedRules, rulesFileName, cacheFileName);
+}
+
+/*
+    Indexes the parsed rules and writes the cache for them.  This only uses
+    its arguments so it can run in any thread, the subscription just swaps
+    the finished indexes in, see setRules().
+ */
+AdBlockSubscription::ParsedRules *AdBlockSubscription::indexParsedRules(ParsedRules *parsedRules,
+        const QString &rulesFileName, const QString &cacheFileName)
+{
+    if (parsedRules->stringPool) {
+        foreach (AdBlockRule *rule, parsedRules->rules)
+            rule->internStrings(parsedRules->stringPool);
+    }
+    indexRules(parsedRules->rules, parsedRules->networkExceptionRules,
+               parsedRules->networkBlockRules, parsedRules->pageRules);
+    writeCache(cacheFileName, rulesFileName, parsedRules->rules,
+               parsedRules->networkExceptionRules, parsedRules->networkBlockRules);
+    return parsedRules;
+}
+
+/*
+    Takes over the rules and deletes parsedRules, a rule that was already
+    in the subscription keeps its statistics.
+ */
+void AdBlockSubscription::setRules(ParsedRules *parsedRules)
+{
+    QHash<QString, const AdBlockRule*> countedRules;
+    foreach (const AdBlockRule *rule, m_rules) {
+        if (rule->hitCount() > 0 || rule->evaluationCount() > 0)
+            countedRules.insert(rule->filter(), rule);
+    }
+    if (!countedRules.isEmpty()) {
+        foreach (AdBlockRule *rule, parsedRules->rules) {
+            const AdBlockRule *oldRule = countedRules.value(rule->filter());
+            if (oldRule)
+                rule->setStatistics(oldRule->hitCount(), oldRule->evaluationCount());
+        }
+    }
+
+    qDeleteAll(m_rules);
+    m_rules = parsedRules->rules;
+    parsedRules->rules.clear();
+    m_networkExceptionRules = parsedRules->networkExceptionRules;
+    m_networkBlockRules = parsedRules->networkBlockRules;
+    m_networkExceptionRules.setStatisticsEnabled(m_statisticsEnabled);
+    m_networkBlockRules.setStatisticsEnabled(m_statisticsEnabled);
+    m_pageRules = parsedRules->pageRules;
+    delete parsedRules;
 }
 
 void AdBlockSubscription::saveRules()
@@ -276,6 +708,10 @@ void AdBlockSubscription::saveRules()
     if (fileName.isEmpty())
         return;
 
+    // the file already has the rules that are being parsed
+    if (m_parsing)
+        return;
+
     QFile file(fileName);
     if (!file.open(QFile::ReadWrite | QIODevice::Truncate)) {
         qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to open adblock file for writing:" << fileName;
@@ -284,36 +720,202 @@ void AdBlockSubscription::saveRules()
 
     QTextStream textStream(&file);
     textStream << "[Adblock Plus 0.7.1]" << endl;
-    foreach (const AdBlockRule &rule, m_rules)
-        textStream << rule.filter() << endl;
+    foreach (const AdBlockRule *rule, m_rules)
+        textStream << rule->filter() << endl;
+    file.close();
+    saveCache();
+}
+
+static const qint32 AdBlockCacheMagic = 0xab;
+static const qint32 AdBlockCacheVersion = 5;
+
+/*
+    Loads the rules from the cache written by saveCache() when it is still
+    up to date with the rules file.  The cache holds the parsed rules
+    together with their indexes so that none of the rules has to be parsed
+    or indexed again.
+ */
+bool AdBlockSubscription::loadCache()
+{
+    QString fileName = cacheFileName();
+    if (fileName.isEmpty())
+        return false;
+
+    QFile cacheFile(fileName);
+    if (!cacheFile.open(QFile::ReadOnly))
+        return false;
+    QByteArray buffer = cacheFile.readAll();
+    QDataStream stream(buffer);
+    stream.setVersion(QDataStream::Qt_4_5);
+
+    qint32 marker;
+    qint32 version;
+    stream >> marker;
+    stream >> version;
+    if (marker != AdBlockCacheMagic || version != AdBlockCacheVersion)
+        return false;
+
+    QFileInfo rulesFileInfo(rulesFileName());
+    qint64 rulesFileSize;
+    QDateTime rulesFileModified;
+    stream >> rulesFileSize;
+    stream >> rulesFileModified;
+    if (rulesFileSize != rulesFileInfo.size()
+        || rulesFileModified != rulesFileInfo.lastModified()) {
+#if defined(ADBLOCKSUBSCRIPTION_DEBUG)
+        qDebug() << "AdBlockSubscription::" << __FUNCTION__ << "out of date" << fileName;
+#endif
+        return false;
+    }
+
+    qint32 count;
+    stream >> count;
+    if (stream.status() != QDataStream::Ok || count < 0)
+        return false;
+    qDeleteAll(m_rules);
+    m_rules.clear();
+    AdBlockStringPool *pool = stringPool();
+    for (int i = 0; i < count; ++i) {
+        AdBlockRule *rule = new AdBlockRule;
+        stream >> *rule;
+        if (stream.status() != QDataStream::Ok) {
+            delete rule;
+            qDeleteAll(m_rules);
+            m_rules.clear();
+            populateCache();
+            return false;
+        }
+        rule->internStrings(pool);
+        m_rules.append(rule);
+    }
+
+    m_pageRules.clear();
+    for (int i = 0; i < m_rules.count(); ++i) {
+        const AdBlockRule *rule = m_rules.at(i);
+        if (rule->isEnabled() && rule->isCSSRule())
+            m_pageRules.append(rule);
+    }
+    if (!m_networkExceptionRules.load(stream, m_rules)
+        || !m_networkBlockRules.load(stream, m_rules)) {
+        qDeleteAll(m_rules);
+        m_rules.clear();
+        populateCache();
+        return false;
+    }
+    return true;
+}
+
+void AdBlockSubscription::saveCache()
+{
+    writeCache(cacheFileName(), rulesFileName(), m_rules,
+               m_networkExceptionRules, m_networkBlockRules);
+}
+
+void AdBlockSubscription::writeCache(const QString &cacheFileName, const QString &rulesFileName,
+                                     const QList<AdBlockRule*> &rules,
+                                     AdBlockRuleIndex &networkExceptionRules,
+                                     AdBlockRuleIndex &networkBlockRules)
+{
+    QFileInfo rulesFileInfo(rulesFileName);
+    if (cacheFileName.isEmpty() || !rulesFileInfo.exists())
+        return;
+
+    // A cache that is half written must never be seen
+    QTemporaryFile cacheFile(cacheFileName + QLatin1String(".XXXXXX"));
+    if (!cacheFile.open()) {
+        qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to open adblock cache for writing:" << cacheFile.fileName();
+        return;
+    }
+    QDataStream stream(&cacheFile);
+    stream.setVersion(QDataStream::Qt_4_5);
+
+    stream << AdBlockCacheMagic;
+    stream << AdBlockCacheVersion;
+    stream << rulesFileInfo.size();
+    stream << rulesFileInfo.lastModified();
+
+    QHash<const AdBlockRule*, int> ruleOffsets;
+    stream << qint32(rules.count());
+    for (int i = 0; i < rules.count(); ++i) {
+        stream << *rules.at(i);
+        ruleOffsets.insert(rules.at(i), i);
+    }
+    networkExceptionRules.save(stream, ruleOffsets);
+    networkBlockRules.save(stream, ruleOffsets);
+    cacheFile.flush();
+    if (stream.status() != QDataStream::Ok || cacheFile.error() != QFile::NoError) {
+        qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to write adblock cache:" << cacheFile.fileName();
+        return;
+    }
+
+    QFile::remove(cacheFileName);
+    if (!cacheFile.rename(cacheFileName)) {
+        qWarning() << "AdBlockSubscription::" << __FUNCTION__ << "Unable to replace adblock cache:" << cacheFileName;
+        return;
+    }
+    cacheFile.setAutoRemove(false);
 }
 
 QList<const AdBlockRule*> AdBlockSubscription::pageRules() const
 {
+    if (!isEnabled())
+        return QList<const AdBlockRule*>();
     return m_pageRules;
 }
 
 const AdBlockRule *AdBlockSubscription::allow(const QString &urlString) const
 {
-    foreach (const AdBlockRule *rule, m_networkExceptionRules) {
-        if (rule->networkMatch(urlString))
-            return rule;
-    }
-    return 0;
+    return allow(AdBlockRequest(urlString));
+}
+
+const AdBlockRule *AdBlockSubscription::allow(const AdBlockRequest &request) const
+{
+    if (!isEnabled())
+        return 0;
+    return m_networkExceptionRules.match(request);
 }
 
 const AdBlockRule *AdBlockSubscription::block(const QString &urlString) const
 {
-    foreach (const AdBlockRule *rule, m_networkBlockRules) {
-        if (rule->networkMatch(urlString))
-            return rule;
-    }
-    return 0;
+    return block(AdBlockRequest(urlString));
+}
+
+const AdBlockRule *AdBlockSubscription::block(const AdBlockRequest &request) const
+{
+    if (!isEnabled())
+        return 0;
+    return m_networkBlockRules.match(request);
+}
+
+// Whether \a rule is one of the network rules allow() or block() can return
+bool AdBlockSubscription::containsRule(const AdBlockRule *rule) const
+{
+    return m_networkExceptionRules.contains(rule)
+        || m_networkBlockRules.contains(rule);
 }
 
 QList<AdBlockRule> AdBlockSubscription::allRules() const
 {
-    return m_rules;
+    QList<AdBlockRule> rules;
+    foreach (const AdBlockRule *rule, m_rules)
+        rules.append(*rule);
+    return rules;
+}
+
+int AdBlockSubscription::ruleCount() const
+{
+    return m_rules.count();
+}
+
+/*
+    The rules are never moved, the pointer stays valid until the rule is
+    removed from the subscription.
+ */
+const AdBlockRule *AdBlockSubscription::rule(int offset) const
+{
+    if (offset < 0 || offset >= m_rules.count())
+        return 0;
+    return m_rules.at(offset);
 }
 
 void AdBlockSubscription::addRule(const AdBlockRule &rule)
@@ -321,8 +923,10 @@ void AdBlockSubscription::addRule(const AdBlockRule &rule)
 #if defined(ADBLOCKSUBSCRIPTION_DEBUG)
     qDebug() << "AdBlockSubscription::" << __FUNCTION__ << rule.filter();
 #endif
-    m_rules.append(rule);
-    populateCache();
+    AdBlockRule *newRule = new AdBlockRule(rule);
+    newRule->internStrings(stringPool());
+    m_rules.append(newRule);
+    cacheRule(newRule);
     emit rulesChanged();
 }
 
@@ -333,43 +937,81 @@ void AdBlockSubscription::removeRule(int offset)
 #endif
     if (offset < 0 || offset >= m_rules.count())
         return;
-    m_rules.removeAt(offset);
-    populateCache();
+    AdBlockRule *rule = m_rules.takeAt(offset);
+    uncacheRule(rule);
+    delete rule;
     emit rulesChanged();
 }
 
+// The rule is changed in place so that its pointer stays the same
 void AdBlockSubscription::replaceRule(const AdBlockRule &rule, int offset)
 {
     if (offset < 0 || offset >= m_rules.count())
         return;
-    m_rules[offset] = rule;
-    populateCache();
+    AdBlockRule *oldRule = m_rules.at(offset);
+    uncacheRule(oldRule);
+    *oldRule = rule;
+    oldRule->internStrings(stringPool());
+    cacheRule(oldRule);
     emit rulesChanged();
 }
 
-void AdBlockSubscription::populateCache()
+void AdBlockSubscription::setRuleStatistics(int offset, int hitCount, int evaluationCount)
 {
-    m_networkExceptionRules.clear();
-    m_networkBlockRules.clear();
-    m_pageRules.clear();
-    if (!isEnabled())
+    if (offset < 0 || offset >= m_rules.count())
         return;
+    m_rules.at(offset)->setStatistics(hitCount, evaluationCount);
+}
 
-    for (int i = 0; i < m_rules.count(); ++i) {
-        const AdBlockRule *rule = &m_rules.at(i);
-        if (!rule->isEnabled())
-            continue;
+int AdBlockSubscription::hitCount() const
+{
+    int count = 0;
+    foreach (const AdBlockRule *rule, m_rules)
+        count += rule->hitCount();
+    return count;
+}
 
-        if (rule->isCSSRule()) {
-            m_pageRules.append(rule);
-            continue;
-        }
+int AdBlockSubscription::evaluationCount() const
+{
+    int count = 0;
+    foreach (const AdBlockRule *rule, m_rules)
+        count += rule->evaluationCount();
+    return count;
+}
 
-        if (rule->isException()) {
-            m_networkExceptionRules.append(rule);
-        } else {
-            m_networkBlockRules.append(rule);
-        }
-    }
+// Counts every rule that is checked against a request, see AdBlockRuleIndex::setStatisticsEnabled()
+void AdBlockSubscription::setStatisticsEnabled(bool enabled)
+{
+    m_statisticsEnabled = enabled;
+    m_networkExceptionRules.setStatisticsEnabled(enabled);
+    m_networkBlockRules.setStatisticsEnabled(enabled);
+}
+
+void AdBlockSubscription::cacheRule(const AdBlockRule *rule)
+{
+    if (!rule->isEnabled())
+        return;
+
+    if (rule->isCSSRule())
+        m_pageRules.append(rule);
+    else if (rule->isException())
+        m_networkExceptionRules.addRule(rule);
+    else
+        m_networkBlockRules.addRule(rule);
+}
+
+void AdBlockSubscription::uncacheRule(const AdBlockRule *rule)
+{
+    m_networkExceptionRules.removeRule(rule);
+    m_networkBlockRules.removeRule(rule);
+    m_pageRules.removeOne(rule);
+}
+
+void AdBlockSubscription::populateCache()
+{
+    m_networkExceptionRules.clear();
+    m_networkBlockRules.clear();
+    m_pageRules.clear();
+    indexRules(m_rules, m_networkExceptionRules, m_networkBlockRules, m_pageRules);
 }
 
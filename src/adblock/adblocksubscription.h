@@ -32,12 +32,16 @@
 #include <qobject.h>
 
 #include "adblockrule.h"
+#include "adblockruleindex.h"
 
 #include <qlist.h>
 #include <qdatetime.h>
 
+template <typename T> class QFutureWatcher;
+class QFile;
 class QNetworkReply;
 class QUrl;
+class AdBlockStringPool;
 class AdBlockSubscription : public QObject
 {
     Q_OBJECT
@@ -45,9 +49,11 @@ class AdBlockSubscription : public QObject
 signals:
     void changed();
     void rulesChanged();
+    void rulesLoaded();
 
 public:
     AdBlockSubscription(const QUrl &url, QObject *parent = 0);
+    ~AdBlockSubscription();
     QUrl url() const;
 
     bool isEnabled() const;
@@ -65,36 +71,82 @@ public:
     void saveRules();
 
     const AdBlockRule *allow(const QString &urlString) const;
+    const AdBlockRule *allow(const AdBlockRequest &request) const;
     const AdBlockRule *block(const QString &urlString) const;
+    const AdBlockRule *block(const AdBlockRequest &request) const;
     QList<const AdBlockRule*> pageRules() const;
+    bool containsRule(const AdBlockRule *rule) const;
 
     QList<AdBlockRule> allRules() const;
+    int ruleCount() const;
+    const AdBlockRule *rule(int offset) const;
     void addRule(const AdBlockRule &rule);
     void removeRule(int offset);
     void replaceRule(const AdBlockRule &rule, int offset);
+    void setRuleStatistics(int offset, int hitCount, int evaluationCount);
+
+    int hitCount() const;
+    int evaluationCount() const;
+    void setStatisticsEnabled(bool enabled);
 
 private slots:
+    void rulesDataAvailable();
     void rulesDownloaded();
+    void rulesParsed();
 
 private:
+    struct ParsedRules;
+    class DownloadBuffer;
+    static ParsedRules *parseRules(const QString &rulesFileName,
+            const QString &cacheFileName, AdBlockStringPool *stringPool);
+    static ParsedRules *parseDownload(DownloadBuffer *downloadBuffer,
+            const QString &rulesFileName, const QString &cacheFileName,
+            AdBlockStringPool *stringPool);
+    static ParsedRules *indexParsedRules(ParsedRules *parsedRules,
+            const QString &rulesFileName, const QString &cacheFileName);
+    void parseRulesFile();
+    void download(const QUrl &url);
+    bool readDownloadedRules(QNetworkReply *reply, bool finished);
+    void discardDownload();
+    static void writeCache(const QString &cacheFileName, const QString &rulesFileName,
+                           const QList<AdBlockRule*> &rules,
+                           AdBlockRuleIndex &networkExceptionRules,
+                           AdBlockRuleIndex &networkBlockRules);
+    void setRules(ParsedRules *parsedRules);
     void populateCache();
+    void cacheRule(const AdBlockRule *rule);
+    void uncacheRule(const AdBlockRule *rule);
     QString rulesFileName() const;
+    QString cacheFileName() const;
+    QString downloadFileName() const;
+    AdBlockStringPool *stringPool() const;
     void parseUrl(const QUrl &url);
     void loadRules();
+    void updateIfOutOfDate();
+    bool loadCache();
+    void saveCache();
 
     QByteArray m_url;
 
     QString m_title;
     QByteArray m_location;
     QDateTime m_lastUpdate;
+    QByteArray m_lastModified;
+    QByteArray m_entityTag;
     bool m_enabled;
+    bool m_statisticsEnabled;
 
     QNetworkReply *m_downloading;
-    QList<AdBlockRule> m_rules;
-
-    // sorted list
-    QList<const AdBlockRule*> m_networkExceptionRules;
-    QList<const AdBlockRule*> m_networkBlockRules;
+    QFile *m_downloadFile;
+    // the data the parsing job of a download is waiting for
+    DownloadBuffer *m_downloadBuffer;
+    QFutureWatcher<ParsedRules*> *m_parsing;
+    QList<AdBlockRule*> m_rules;
+
+    // the enabled rules, kept while the subscription is disabled so that
+    // enabling it again does not have to index them
+    AdBlockRuleIndex m_networkExceptionRules;
+    AdBlockRuleIndex m_networkBlockRules;
     QList<const AdBlockRule*> m_pageRules;
 };
 
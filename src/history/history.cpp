@@ -67,6 +67,8 @@
 #include "historymanager.h"
 #include "treesortfilterproxymodel.h"
 
+#include <math.h>
+
 #include <qbuffer.h>
 #include <qclipboard.h>
 #include <qdesktopservices.h>
@@ -93,8 +95,14 @@ HistoryModel::HistoryModel(HistoryManager *history, QObject *parent)
     Q_ASSERT(m_history);
     connect(m_history, SIGNAL(historyReset()),
             this, SLOT(historyReset()));
+    connect(m_history, SIGNAL(entryAboutToBeRemoved(int)),
+            this, SLOT(entryAboutToBeRemoved(int)));
     connect(m_history, SIGNAL(entryRemoved(const HistoryEntry &)),
-            this, SLOT(historyReset()));
+            this, SLOT(entryRemoved()));
+    connect(m_history, SIGNAL(entriesAboutToExpire(int)),
+            this, SLOT(entriesAboutToExpire(int)));
+    connect(m_history, SIGNAL(entriesExpired(int)),
+            this, SLOT(entriesExpired()));
 
     connect(m_history, SIGNAL(entryAdded(const HistoryEntry &)),
             this, SLOT(entryAdded()));
@@ -102,6 +110,11 @@ HistoryModel::HistoryModel(HistoryManager *history, QObject *parent)
             this, SLOT(entryUpdated(int)));
 }
 
+HistoryManager *HistoryModel::historyManager() const
+{
+    return m_history;
+}
+
 void HistoryModel::historyReset()
 {
     reset();
@@ -113,6 +126,28 @@ void HistoryModel::entryAdded()
     endInsertRows();
 }
 
+void HistoryModel::entryAboutToBeRemoved(int offset)
+{
+    beginRemoveRows(QModelIndex(), offset, offset);
+}
+
+void HistoryModel::entryRemoved()
+{
+    endRemoveRows();
+}
+
+// The expired entries are the last rows
+void HistoryModel::entriesAboutToExpire(int count)
+{
+    int rows = rowCount();
+    beginRemoveRows(QModelIndex(), rows - count, rows - 1);
+}
+
+void HistoryModel::entriesExpired()
+{
+    endRemoveRows();
+}
+
 void HistoryModel::entryUpdated(int offset)
 {
     QModelIndex idx = index(offset, 0);
@@ -133,34 +168,35 @@ QVariant HistoryModel::headerData(int section, Qt::Orientation orientation, int
 
 QVariant HistoryModel::data(const QModelIndex &index, int role) const
 {
-    QList<HistoryEntry> lst = m_history->history();
-    if (index.row() < 0 || index.row() >= lst.size())
+    // only look up the columns of the store the role needs
+    const HistoryStore &store = m_history->historyStore();
+    int row = index.row();
+    if (row < 0 || row >= store.count())
         return QVariant();
 
-    const HistoryEntry &item = lst.at(index.row());
     switch (role) {
     case DateTimeRole:
-        return item.dateTime;
+        return store.dateTime(row);
     case DateRole:
-        return item.dateTime.date();
+        return store.dateTime(row).date();
     case UrlRole:
-        return QUrl(item.url);
+        return QUrl(store.url(row));
     case UrlStringRole:
-        return item.url;
+        return store.url(row);
     case TitleRole:
-        return item.userTitle();
+        return HistoryEntry(store.url(row), QDateTime(), store.title(row)).userTitle();
     case Qt::DisplayRole:
     case Qt::EditRole: {
         switch (index.column()) {
         case 0:
-            return item.userTitle();
+            return HistoryEntry(store.url(row), QDateTime(), store.title(row)).userTitle();
         case 1:
-            return item.url;
+            return store.url(row);
         }
     }
     case Qt::DecorationRole:
         if (index.column() == 0) {
-            return BrowserApplication::instance()->icon(item.url);
+            return BrowserApplication::instance()->icon(store.url(row));
         }
     }
     return QVariant();
@@ -173,22 +209,20 @@ int HistoryModel::columnCount(const QModelIndex &parent) const
 
 int HistoryModel::rowCount(const QModelIndex &parent) const
 {
-    return (parent.isValid()) ? 0 : m_history->history().count();
+    return (parent.isValid()) ? 0 : m_history->historyStore().count();
 }
 
 bool HistoryModel::removeRows(int row, int count, const QModelIndex &parent)
 {
-    if (parent.isValid())
+    // the rows are only the newest visits until the history is loaded
+    if (parent.isValid() || m_history->isLoading())
         return false;
-    int lastRow = row + count - 1;
-    beginRemoveRows(parent, row, lastRow);
-    QList<HistoryEntry> lst = m_history->history();
-    for (int i = lastRow; i >= row; --i)
-        lst.removeAt(i);
-    disconnect(m_history, SIGNAL(historyReset()), this, SLOT(historyReset()));
-    m_history->setHistory(lst);
-    connect(m_history, SIGNAL(historyReset()), this, SLOT(historyReset()));
-    endRemoveRows();
+    if (row < 0 || count < 1 || row + count > rowCount())
+        return false;
+    // every visit is removed on its own so that it is a record in the
+    // journal instead of the whole history being written again
+    for (int i = row + count - 1; i >= row; --i)
+        m_history->removeHistoryEntry(i);
     return true;
 }
 
@@ -358,7 +392,7 @@ bool HistoryMenu::prePopulated()
 
 void HistoryMenu::postPopulated()
 {
-    if (m_history->history().count() > 0)
+    if (m_history->historyStore().count() > 0)
         addSeparator();
 
     QAction *showAllAction = new QAction(tr("Show All History"), this);
@@ -466,6 +500,9 @@ void HistoryDialog::copy()
     clipboard->setText(url);
 }
 
+// the frecency of a visit halves every thirty days
+static const qreal FrecencyHalfLife = 30 * 24 * 60 * 60;
+
 HistoryFilterModel::HistoryFilterModel(QAbstractItemModel *sourceModel, QObject *parent)
     : QAbstractProxyModel(parent)
     , m_loaded(false)
@@ -479,13 +516,15 @@ int HistoryFilterModel::historyLocation(const QString &url) const
     if (!m_historyHash.contains(url))
         return 0;
 
-    return sourceModel()->rowCount() - m_historyHash.value(url);
+    return sourceRow(m_historyHash.value(url));
 }
 
 QVariant HistoryFilterModel::data(const QModelIndex &index, int role) const
 {
     if (role == FrecencyRole && index.isValid()) {
-        return m_filteredRows[index.row()].frecency;
+        // the frecencies are kept as of the reference time, decay them to now
+        qreal decay = pow(2.0, QDateTime::currentDateTime().secsTo(m_referenceTime) / FrecencyHalfLife);
+        return qRound(m_frecencies.at(int(index.internalId())) * decay);
     }
 
     return QAbstractProxyModel::data(index, role);
@@ -499,6 +538,8 @@ void HistoryFilterModel::setSourceModel(QAbstractItemModel *newSourceModel)
                    this, SLOT(dataChanged(const QModelIndex &, const QModelIndex &)));
         disconnect(sourceModel(), SIGNAL(rowsInserted(const QModelIndex &, int, int)),
                    this, SLOT(sourceRowsInserted(const QModelIndex &, int, int)));
+        disconnect(sourceModel(), SIGNAL(rowsAboutToBeRemoved(const QModelIndex &, int, int)),
+                   this, SLOT(sourceRowsAboutToBeRemoved(const QModelIndex &, int, int)));
         disconnect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
                    this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
     }
@@ -512,6 +553,8 @@ void HistoryFilterModel::setSourceModel(QAbstractItemModel *newSourceModel)
                 this, SLOT(sourceDataChanged(const QModelIndex &, const QModelIndex &)));
         connect(sourceModel(), SIGNAL(rowsInserted(const QModelIndex &, int, int)),
                 this, SLOT(sourceRowsInserted(const QModelIndex &, int, int)));
+        connect(sourceModel(), SIGNAL(rowsAboutToBeRemoved(const QModelIndex &, int, int)),
+                this, SLOT(sourceRowsAboutToBeRemoved(const QModelIndex &, int, int)));
         connect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
                 this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
     }
@@ -527,11 +570,6 @@ QVariant HistoryFilterModel::headerData(int section, Qt::Orientation orientation
     return sourceModel()->headerData(section, orientation, role);
 }
 
-void HistoryFilterModel::recalculateFrecencies()
-{
-    sourceReset();
-}
-
 void HistoryFilterModel::sourceReset()
 {
     m_loaded = false;
@@ -554,26 +592,20 @@ int HistoryFilterModel::columnCount(const QModelIndex &parent) const
 QModelIndex HistoryFilterModel::mapToSource(const QModelIndex &proxyIndex) const
 {
     load();
-    int sourceRow = sourceModel()->rowCount() - proxyIndex.internalId();
-    return sourceModel()->index(sourceRow, proxyIndex.column());
+    if (!proxyIndex.isValid())
+        return QModelIndex();
+    return sourceModel()->index(sourceRow(int(proxyIndex.internalId())), proxyIndex.column());
 }
 
 QModelIndex HistoryFilterModel::mapFromSource(const QModelIndex &sourceIndex) const
 {
     load();
     QString url = sourceIndex.data(HistoryModel::UrlStringRole).toString();
-    if (!m_historyHash.contains(url))
-        return QModelIndex();
-
-    int sourceOffset = sourceModel()->rowCount() - sourceIndex.row();
-
-    QList<HistoryData>::iterator pos = qBinaryFind(m_filteredRows.begin(),
-        m_filteredRows.end(), HistoryData(sourceOffset, -1));
-
-    if (pos == m_filteredRows.end())
+    QHash<QString, int>::const_iterator it = m_historyHash.constFind(url);
+    if (it == m_historyHash.constEnd() || it.value() != sourceSlot(sourceIndex.row()))
         return QModelIndex();
 
-    return createIndex(pos - m_filteredRows.begin(), sourceIndex.column(), sourceOffset);
+    return createIndex(proxyRow(it.value()), sourceIndex.column(), it.value());
 }
 
 QModelIndex HistoryFilterModel::index(int row, int column, const QModelIndex &parent) const
@@ -583,7 +615,7 @@ QModelIndex HistoryFilterModel::index(int row, int column, const QModelIndex &pa
         || column < 0 || column >= columnCount(parent))
         return QModelIndex();
 
-    return createIndex(row, column, m_filteredRows[row].tailOffset);
+    return createIndex(row, column, proxySlot(row));
 }
 
 QModelIndex HistoryFilterModel::parent(const QModelIndex &) const
@@ -595,23 +627,25 @@ void HistoryFilterModel::load() const
 {
     if (m_loaded)
         return;
-    m_filteredRows.clear();
+    int rows = sourceModel()->rowCount();
+    m_visits.clear(rows, 1);
+    m_newestVisits.clear(rows);
+    m_frecencies.fill(0, rows);
     m_historyHash.clear();
-    m_historyHash.reserve(sourceModel()->rowCount());
-    m_scaleTime = QDateTime::currentDateTime();
-    for (int i = 0; i < sourceModel()->rowCount(); ++i) {
+    m_historyHash.reserve(rows);
+    m_referenceTime = QDateTime::currentDateTime();
+    for (int i = 0; i < rows; ++i) {
         QModelIndex idx = sourceModel()->index(i, 0);
         QString url = idx.data(HistoryModel::UrlStringRole).toString();
-        if (!m_historyHash.contains(url)) {
-            int sourceOffset = sourceModel()->rowCount() - i;
-            m_filteredRows.append(HistoryData(sourceOffset, frecencyScore(idx)));
-            m_historyHash.insert(url, sourceOffset);
+        QHash<QString, int>::const_iterator it = m_historyHash.constFind(url);
+        if (it == m_historyHash.constEnd()) {
+            int slot = rows - 1 - i;
+            m_newestVisits.add(slot, 1);
+            m_frecencies[slot] = frecencyScore(idx);
+            m_historyHash.insert(url, slot);
         } else {
             // we already know about this url: just increment its frecency score
-            QList<HistoryData>::iterator pos = qBinaryFind(m_filteredRows.begin(),
-                m_filteredRows.end(), HistoryData(m_historyHash[url], -1));
-            Q_ASSERT(pos != m_filteredRows.end());
-            pos->frecency += frecencyScore(idx);
+            m_frecencies[it.value()] += frecencyScore(idx);
         }
     }
     m_loaded = true;
@@ -625,74 +659,142 @@ void HistoryFilterModel::sourceRowsInserted(const QModelIndex &parent, int start
         return;
     QModelIndex idx = sourceModel()->index(start, 0, parent);
     QString url = idx.data(HistoryModel::UrlStringRole).toString();
-    int currentFrecency = 0;
+    int slot = m_visits.size();
+    m_visits.append(1);
+    m_newestVisits.append(0);
+    m_frecencies.append(frecencyScore(idx));
     if (m_historyHash.contains(url)) {
-        QList<HistoryData>::iterator pos = qBinaryFind(m_filteredRows.begin(),
-            m_filteredRows.end(), HistoryData(m_historyHash[url], -1));
-        Q_ASSERT(pos != m_filteredRows.end());
-        int realRow = pos - m_filteredRows.begin();
-        currentFrecency = pos->frecency;
+        int newestSlot = m_historyHash.value(url);
+        int realRow = proxyRow(newestSlot);
+        m_frecencies[slot] += m_frecencies.at(newestSlot);
         beginRemoveRows(QModelIndex(), realRow, realRow);
-        m_filteredRows.erase(pos);
+        m_newestVisits.add(newestSlot, -1);
         m_historyHash.remove(url);
         endRemoveRows();
     }
     beginInsertRows(QModelIndex(), 0, 0);
-    m_filteredRows.insert(0, HistoryData(sourceModel()->rowCount(), frecencyScore(idx) + currentFrecency));
-    m_historyHash.insert(url, sourceModel()->rowCount());
+    m_newestVisits.add(slot, 1);
+    m_historyHash.insert(url, slot);
     endInsertRows();
 }
 
-void HistoryFilterModel::sourceRowsRemoved(const QModelIndex &, int start, int end)
+/*
+    The urls whose newest visit is removed lose their row here and get it
+    back at their next newest visit, if they have one, once the source has
+    removed the rows.  The other urls only lose the frecency of the removed
+    visits.
+*/
+void HistoryFilterModel::sourceRowsAboutToBeRemoved(const QModelIndex &parent, int start, int end)
 {
-    Q_UNUSED(start);
-    Q_UNUSED(end);
-    sourceReset();
+    m_removedSlots.clear();
+    m_olderSlots.clear();
+    if (!m_loaded || parent.isValid())
+        return;
+
+    QList<QPair<int, QString> > removedRows;
+    for (int i = start; i <= end; ++i) {
+        QModelIndex idx = sourceModel()->index(i, 0);
+        QString url = idx.data(HistoryModel::UrlStringRole).toString();
+        int slot = sourceSlot(i);
+        int newestSlot = m_historyHash.value(url);
+        m_removedSlots.append(slot);
+        m_frecencies[newestSlot] -= frecencyScore(idx);
+        if (slot != newestSlot)
+            continue;
+        removedRows.append(qMakePair(proxyRow(slot), url));
+        int olderRow = olderVisit(url, end);
+        if (olderRow != -1)
+            m_olderSlots.insert(url, sourceSlot(olderRow));
+    }
+
+    // remove the rows from the bottom up, one block of adjacent rows at a time
+    qSort(removedRows.begin(), removedRows.end());
+    while (!removedRows.isEmpty()) {
+        int last = removedRows.count() - 1;
+        int first = last;
+        while (first > 0 && removedRows.at(first - 1).first == removedRows.at(first).first - 1)
+            --first;
+        beginRemoveRows(QModelIndex(), removedRows.at(first).first, removedRows.at(last).first);
+        for (int i = first; i <= last; ++i) {
+            const QString &url = removedRows.at(i).second;
+            int newestSlot = m_historyHash.take(url);
+            m_newestVisits.add(newestSlot, -1);
+            if (m_olderSlots.contains(url))
+                m_frecencies[m_olderSlots.value(url)] = m_frecencies.at(newestSlot);
+        }
+        endRemoveRows();
+        removedRows.erase(removedRows.begin() + first, removedRows.end());
+    }
+}
+
+void HistoryFilterModel::sourceRowsRemoved(const QModelIndex &parent, int start, int end)
+{
+    if (!m_loaded || parent.isValid())
+        return;
+    // loaded since the rows were about to be removed
+    if (m_removedSlots.count() != end - start + 1) {
+        sourceReset();
+        return;
+    }
+
+    foreach (int slot, m_removedSlots)
+        m_visits.add(slot, -1);
+    m_removedSlots.clear();
+
+    QHash<QString, int>::const_iterator it;
+    for (it = m_olderSlots.constBegin(); it != m_olderSlots.constEnd(); ++it) {
+        // the slot is not counted yet, every newer one is in front of it
+        int row = m_newestVisits.total() - m_newestVisits.sum(it.value());
+        beginInsertRows(QModelIndex(), row, row);
+        m_newestVisits.add(it.value(), 1);
+        m_historyHash.insert(it.key(), it.value());
+        endInsertRows();
+    }
+    m_olderSlots.clear();
 }
 
 /*
     Removing a continuous block of rows will remove filtered rows too as this is
-    the users intention.
+    the users intention.  The urls that still have older visits come back.
 */
 bool HistoryFilterModel::removeRows(int row, int count, const QModelIndex &parent)
 {
     if (row < 0 || count <= 0 || row + count > rowCount(parent) || parent.isValid())
         return false;
-    int lastRow = row + count - 1;
-    disconnect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
-               this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
-    beginRemoveRows(parent, row, lastRow);
-    int oldCount = rowCount();
-    int start = sourceModel()->rowCount() - m_filteredRows[row].tailOffset;
-    int end = sourceModel()->rowCount() - m_filteredRows[lastRow].tailOffset;
-    sourceModel()->removeRows(start, end - start + 1);
-    endRemoveRows();
-    connect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
-            this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
-    m_loaded = false;
-    if (oldCount - count != rowCount())
-        reset();
-    return true;
+    int start = sourceRow(proxySlot(row));
+    int end = sourceRow(proxySlot(row + count - 1));
+    return sourceModel()->removeRows(start, end - start + 1);
 }
 
-int HistoryFilterModel::frecencyScore(const QModelIndex &sourceIndex) const
+// The source row of the newest visit of url older than row, or -1
+int HistoryFilterModel::olderVisit(const QString &url, int row) const
 {
-    QDateTime loadTime = sourceModel()->data(sourceIndex, HistoryModel::DateTimeRole).toDateTime();
-    int days = loadTime.daysTo(m_scaleTime);
+    // the history store knows the visits of every url
+    if (HistoryModel *historyModel = qobject_cast<HistoryModel*>(sourceModel())) {
+        foreach (int offset, historyModel->historyManager()->historyStore().visits(url)) {
+            if (offset > row)
+                return offset;
+        }
+        return -1;
+    }
 
-    if (days <= 1) {
-        return 100;
-    } else if (days < 5) { // within the last 4 days
-        return 90;
-    } else if (days < 15) { // within the last two weeks
-        return 70;
-    } else if (days < 31) { // within the last month
-        return 50;
-    } else if (days < 91) { // within the last 3 months
-        return 30;
+    for (int i = row + 1; i < sourceModel()->rowCount(); ++i) {
+        if (sourceModel()->index(i, 0).data(HistoryModel::UrlStringRole).toString() == url)
+            return i;
     }
+    return -1;
+}
 
-    return 10;
+/*
+    Every visit adds 100 to the frecency of its url as of when it was made,
+    which then halves every FrecencyHalfLife seconds.  The frecencies are
+    all kept as of m_referenceTime so that a visit only adds its own score
+    and their order does not change as time passes.
+*/
+qreal HistoryFilterModel::frecencyScore(const QModelIndex &sourceIndex) const
+{
+    QDateTime loadTime = sourceModel()->data(sourceIndex, HistoryModel::DateTimeRole).toDateTime();
+    return 100 * pow(2.0, m_referenceTime.secsTo(loadTime) / FrecencyHalfLife);
 }
 
 HistoryTreeModel::HistoryTreeModel(QAbstractItemModel *sourceModel, QObject *parent)
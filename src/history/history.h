@@ -63,6 +63,7 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
+#include "fenwicktree.h"
 #include "modelmenu.h"
 
 #include <qdatetime.h>
@@ -71,6 +72,7 @@
 #include <qsortfilterproxymodel.h>
 #include <qtimer.h>
 #include <qurl.h>
+#include <qvector.h>
 
 #include <qwebhistoryinterface.h>
 
@@ -82,6 +84,10 @@ class HistoryModel : public QAbstractTableModel
 public slots:
     void historyReset();
     void entryAdded();
+    void entryAboutToBeRemoved(int offset);
+    void entryRemoved();
+    void entriesAboutToExpire(int count);
+    void entriesExpired();
     void entryUpdated(int offset);
 
 public:
@@ -95,6 +101,7 @@ public:
     };
 
     HistoryModel(HistoryManager *history, QObject *parent = 0);
+    HistoryManager *historyManager() const;
     QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
     int columnCount(const QModelIndex &parent = QModelIndex()) const;
@@ -107,8 +114,10 @@ private:
 
 /*!
     Proxy model that will remove any duplicate entries.
-    Both m_sourceRow and m_historyHash store their offsets not from
-    the front of the list, but as offsets from the back.
+    Every visit of the source has a slot, numbered from the oldest visit
+    when the history is loaded, that it keeps while visits are added and
+    removed around it.  The rows and the source rows are found from the
+    slots by counting in Fenwick trees.
   */
 class HistoryFilterModel : public QAbstractProxyModel
 {
@@ -137,41 +146,42 @@ public:
     bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex());
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
 
-    void recalculateFrecencies();
-
 private slots:
     void sourceReset();
     void sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
     void sourceRowsInserted(const QModelIndex &parent, int start, int end);
+    void sourceRowsAboutToBeRemoved(const QModelIndex &parent, int start, int end);
     void sourceRowsRemoved(const QModelIndex &, int, int);
 
 private:
     void load() const;
-
-    struct HistoryData {
-        int tailOffset;
-        int frecency;
-
-        HistoryData(int off, int f = 0) : tailOffset(off), frecency(f) { }
-
-        bool operator==(const HistoryData &other) const {
-            return (tailOffset == other.tailOffset)
-                && (frecency == -1 || other.frecency == -1 || frecency == other.frecency);
-        }
-        bool operator!=(const HistoryData &other) const {
-            return !(*this == other);
-        }
-        // like the actual history entries, our index mapping data is sorted in reverse
-        bool operator<(const HistoryData &other) const {
-            return (tailOffset > other.tailOffset);
-        }
-    };
-    int frecencyScore(const QModelIndex &sourceIndex) const;
-
-    mutable QList<HistoryData> m_filteredRows;
+    qreal frecencyScore(const QModelIndex &sourceIndex) const;
+    int olderVisit(const QString &url, int row) const;
+
+    int sourceRow(int slot) const
+        { return m_visits.total() - 1 - m_visits.sum(slot); }
+    int sourceSlot(int sourceRow) const
+        { return m_visits.find(m_visits.total() - 1 - sourceRow); }
+    int proxyRow(int slot) const
+        { return m_newestVisits.total() - 1 - m_newestVisits.sum(slot); }
+    int proxySlot(int proxyRow) const
+        { return m_newestVisits.find(m_newestVisits.total() - 1 - proxyRow); }
+
+    // the slots of the visits in the source and of the newest visit of every url
+    mutable FenwickTree m_visits;
+    mutable FenwickTree m_newestVisits;
+    // the frecency of every url in the slot of its newest visit
+    mutable QVector<qreal> m_frecencies;
+    // the slot of the newest visit of every url
     mutable QHash<QString, int> m_historyHash;
     mutable bool m_loaded;
-    mutable QDateTime m_scaleTime;
+    // the time the frecencies are as of
+    mutable QDateTime m_referenceTime;
+
+    // The slots of the source rows being removed and of the visits that
+    // become the newest ones of their urls once they are.
+    QList<int> m_removedSlots;
+    QHash<QString, int> m_olderSlots;
 };
 
 /*
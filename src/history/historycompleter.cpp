@@ -19,6 +19,8 @@
 
 #include "historycompleter.h"
 
+#include "historymanager.h"
+
 #include <qevent.h>
 #include <qfontmetrics.h>
 #include <qheaderview.h>
@@ -58,12 +60,474 @@ int HistoryCompletionView::sizeHintForRow(int row) const
 }
 
 HistoryCompletionModel::HistoryCompletionModel(QObject *parent)
-    : QSortFilterProxyModel(parent)
+    : QAbstractProxyModel(parent)
+    , m_allRows(true)
+    , m_sortColumn(-1)
+    , m_sortOrder(Qt::AscendingOrder)
     , m_searchMatcher(QString(), Qt::CaseInsensitive, QRegExp::FixedString)
     , m_wordMatcher(QString(), Qt::CaseInsensitive)
     , m_isValid(false)
 {
-    setDynamicSortFilter(true);
+}
+
+void HistoryCompletionModel::setSourceModel(QAbstractItemModel *newSourceModel)
+{
+    if (sourceModel()) {
+        disconnect(sourceModel(), SIGNAL(modelReset()), this, SLOT(sourceReset()));
+        disconnect(sourceModel(), SIGNAL(layoutChanged()), this, SLOT(sourceReset()));
+        disconnect(sourceModel(), SIGNAL(rowsInserted(const QModelIndex &, int, int)),
+                   this, SLOT(sourceRowsInserted(const QModelIndex &, int, int)));
+        disconnect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
+                   this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
+        disconnect(sourceModel(), SIGNAL(dataChanged(const QModelIndex &, const QModelIndex &)),
+                   this, SLOT(sourceDataChanged(const QModelIndex &, const QModelIndex &)));
+    }
+
+    QAbstractProxyModel::setSourceModel(newSourceModel);
+
+    if (sourceModel()) {
+        connect(sourceModel(), SIGNAL(modelReset()), this, SLOT(sourceReset()));
+        connect(sourceModel(), SIGNAL(layoutChanged()), this, SLOT(sourceReset()));
+        connect(sourceModel(), SIGNAL(rowsInserted(const QModelIndex &, int, int)),
+                this, SLOT(sourceRowsInserted(const QModelIndex &, int, int)));
+        connect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
+                this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
+        connect(sourceModel(), SIGNAL(dataChanged(const QModelIndex &, const QModelIndex &)),
+                this, SLOT(sourceDataChanged(const QModelIndex &, const QModelIndex &)));
+    }
+    sourceReset();
+}
+
+void HistoryCompletionModel::sourceReset()
+{
+    filter();
+    reset();
+}
+
+// Only the inserted rows are checked, the others just move down
+void HistoryCompletionModel::sourceRowsInserted(const QModelIndex &parent, int start, int end)
+{
+    if (parent.isValid())
+        return;
+    if (m_allRows) {
+        beginInsertRows(QModelIndex(), start, end);
+        endInsertRows();
+        return;
+    }
+    shiftRows(start, end - start + 1);
+    for (int i = start; i <= end; ++i) {
+        if (filterAcceptsRow(i, QModelIndex()))
+            insertRow(i);
+    }
+}
+
+void HistoryCompletionModel::sourceRowsRemoved(const QModelIndex &parent, int start, int end)
+{
+    if (parent.isValid())
+        return;
+    if (m_allRows) {
+        beginRemoveRows(QModelIndex(), start, end);
+        endRemoveRows();
+        return;
+    }
+    for (int i = end; i >= start; --i)
+        removeRow(i);
+    shiftRows(end + 1, start - end - 1);
+}
+
+// A changed row can start or stop matching or be scored differently
+void HistoryCompletionModel::sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if (topLeft.parent().isValid())
+        return;
+    if (m_allRows) {
+        emit dataChanged(mapFromSource(topLeft), mapFromSource(bottomRight));
+        return;
+    }
+    for (int i = topLeft.row(); i <= bottomRight.row(); ++i)
+        updateRow(i);
+}
+
+// The store behind the HistoryFilterModel this model is usually set on
+const HistoryStore *HistoryCompletionModel::historyStore() const
+{
+    HistoryFilterModel *filterModel = qobject_cast<HistoryFilterModel*>(sourceModel());
+    if (!filterModel)
+        return 0;
+    HistoryModel *historyModel = qobject_cast<HistoryModel*>(filterModel->sourceModel());
+    if (!historyModel)
+        return 0;
+    return &historyModel->historyManager()->historyStore();
+}
+
+/*
+    Finds the rows that match the search string.  The urls the index finds
+    are only candidates, each one is still checked by filterAcceptsRow().
+ */
+void HistoryCompletionModel::filter()
+{
+    m_sourceRows.clear();
+    m_rankedRows.clear();
+    m_rankedScores.clear();
+    m_candidates.clear();
+    m_proxyRows.clear();
+    // nothing is completed without a search string, so it is not sorted
+    m_allRows = m_searchString.isEmpty() || !sourceModel();
+    if (m_allRows)
+        return;
+
+    QVector<int> offsets;
+    const HistoryStore *store = historyStore();
+    if (store && store->matchingUrls(m_searchString, offsets)) {
+        QAbstractProxyModel *filterModel = static_cast<QAbstractProxyModel*>(sourceModel());
+        QAbstractItemModel *historyModel = filterModel->sourceModel();
+        foreach (int offset, offsets) {
+            QModelIndex idx = filterModel->mapFromSource(historyModel->index(offset, 0));
+            if (idx.isValid() && filterAcceptsRow(idx.row(), QModelIndex()))
+                m_sourceRows.append(idx.row());
+        }
+        qSort(m_sourceRows.begin(), m_sourceRows.end());
+    } else {
+        int rows = sourceModel()->rowCount();
+        for (int i = 0; i < rows; ++i) {
+            if (filterAcceptsRow(i, QModelIndex()))
+                m_sourceRows.append(i);
+        }
+    }
+
+    if (m_sortColumn != -1)
+        sortRows();
+}
+
+/*
+    Checks only the rows that matched the previous search string, which
+    the current one starts with.
+ */
+void HistoryCompletionModel::narrowRows()
+{
+    QList<int> rows;
+    foreach (int row, m_sourceRows) {
+        if (filterAcceptsRow(row, QModelIndex()))
+            rows.append(row);
+    }
+    m_sourceRows = rows;
+    m_proxyRows.clear();
+
+    // the word boundary bonus depends on the search string
+    if (m_sortColumn != -1)
+        sortRows();
+}
+
+// the rows ranked at a time, a few more than the popup shows
+static const int RankedBatchSize = 32;
+
+/*
+    Every row is scored once and the scores are arranged in a heap, then
+    only the best rows are taken out of it.  The rest are ranked when the
+    view scrolls to them.
+ */
+void HistoryCompletionModel::sortRows()
+{
+    m_rankedRows.clear();
+    m_rankedScores.clear();
+    m_proxyRows.clear();
+    m_candidates.resize(m_sourceRows.count());
+    for (int i = 0; i < m_sourceRows.count(); ++i) {
+        Candidate &candidate = m_candidates[i];
+        candidate.sourceRow = m_sourceRows.at(i);
+        candidate.score = score(sourceModel()->index(candidate.sourceRow, m_sortColumn));
+    }
+    for (int i = m_candidates.count() / 2 - 1; i >= 0; --i)
+        siftDown(i);
+    rankRows(RankedBatchSize);
+}
+
+void HistoryCompletionModel::rankRows(int count)
+{
+    while (count-- > 0 && !m_candidates.isEmpty()) {
+        if (!m_proxyRows.isEmpty())
+            m_proxyRows.insert(m_candidates.first().sourceRow, m_rankedRows.count());
+        m_rankedRows.append(m_candidates.first().sourceRow);
+        m_rankedScores.append(m_candidates.first().score);
+        m_candidates[0] = m_candidates.last();
+        m_candidates.resize(m_candidates.count() - 1);
+        if (!m_candidates.isEmpty())
+            siftDown(0);
+    }
+}
+
+// Equal scores keep the order of the source, which is the newest first
+bool HistoryCompletionModel::ranksBefore(const Candidate &left, const Candidate &right) const
+{
+    if (left.score != right.score) {
+        if (m_sortOrder == Qt::DescendingOrder)
+            return left.score < right.score;
+        return left.score > right.score;
+    }
+    return left.sourceRow < right.sourceRow;
+}
+
+void HistoryCompletionModel::siftDown(int i)
+{
+    int count = m_candidates.count();
+    Candidate candidate = m_candidates.at(i);
+    while (2 * i + 1 < count) {
+        int child = 2 * i + 1;
+        if (child + 1 < count && ranksBefore(m_candidates.at(child + 1), m_candidates.at(child)))
+            ++child;
+        if (!ranksBefore(m_candidates.at(child), candidate))
+            break;
+        m_candidates[i] = m_candidates.at(child);
+        i = child;
+    }
+    m_candidates[i] = candidate;
+}
+
+void HistoryCompletionModel::siftUp(int i)
+{
+    Candidate candidate = m_candidates.at(i);
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!ranksBefore(candidate, m_candidates.at(parent)))
+            break;
+        m_candidates[i] = m_candidates.at(parent);
+        i = parent;
+    }
+    m_candidates[i] = candidate;
+}
+
+// The row of \a sourceRow in rows() or -1, rows waiting to be ranked have none
+int HistoryCompletionModel::proxyRow(int sourceRow) const
+{
+    if (m_proxyRows.isEmpty()) {
+        const QList<int> &proxyRows = rows();
+        m_proxyRows.reserve(proxyRows.count());
+        for (int i = 0; i < proxyRows.count(); ++i)
+            m_proxyRows.insert(proxyRows.at(i), i);
+    }
+    return m_proxyRows.value(sourceRow, -1);
+}
+
+// Moves the source rows from \a start on by \a count, they keep their order
+void HistoryCompletionModel::shiftRows(int start, int count)
+{
+    for (int i = 0; i < m_sourceRows.count(); ++i) {
+        if (m_sourceRows.at(i) >= start)
+            m_sourceRows[i] += count;
+    }
+    for (int i = 0; i < m_rankedRows.count(); ++i) {
+        if (m_rankedRows.at(i) >= start)
+            m_rankedRows[i] += count;
+    }
+    for (int i = 0; i < m_candidates.count(); ++i) {
+        if (m_candidates.at(i).sourceRow >= start)
+            m_candidates[i].sourceRow += count;
+    }
+    m_proxyRows.clear();
+}
+
+/*
+    Adds a matching source row.  When sorted it is ranked right away if it
+    ranks before the rows that wait to be ranked, otherwise it waits too.
+ */
+void HistoryCompletionModel::insertRow(int sourceRow)
+{
+    QList<int>::iterator it = qLowerBound(m_sourceRows.begin(), m_sourceRows.end(), sourceRow);
+    int row = it - m_sourceRows.begin();
+    if (m_sortColumn == -1)
+        beginInsertRows(QModelIndex(), row, row);
+    m_sourceRows.insert(it, sourceRow);
+    m_proxyRows.clear();
+    if (m_sortColumn == -1) {
+        endInsertRows();
+        return;
+    }
+
+    Candidate candidate;
+    candidate.sourceRow = sourceRow;
+    candidate.score = score(sourceModel()->index(sourceRow, m_sortColumn));
+    if (!m_candidates.isEmpty()) {
+        bool waits = m_rankedRows.isEmpty();
+        if (!waits) {
+            Candidate last;
+            last.sourceRow = m_rankedRows.last();
+            last.score = m_rankedScores.last();
+            waits = !ranksBefore(candidate, last);
+        }
+        if (waits) {
+            m_candidates.append(candidate);
+            siftUp(m_candidates.count() - 1);
+            return;
+        }
+    }
+
+    int first = 0;
+    int count = m_rankedRows.count();
+    while (count > 0) {
+        int step = count / 2;
+        Candidate ranked;
+        ranked.sourceRow = m_rankedRows.at(first + step);
+        ranked.score = m_rankedScores.at(first + step);
+        if (ranksBefore(ranked, candidate)) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    beginInsertRows(QModelIndex(), first, first);
+    m_rankedRows.insert(first, sourceRow);
+    m_rankedScores.insert(first, candidate.score);
+    endInsertRows();
+}
+
+void HistoryCompletionModel::removeRow(int sourceRow)
+{
+    QList<int>::iterator it = qBinaryFind(m_sourceRows.begin(), m_sourceRows.end(), sourceRow);
+    if (it == m_sourceRows.end())
+        return;
+    int row = proxyRow(sourceRow);
+    if (row != -1)
+        beginRemoveRows(QModelIndex(), row, row);
+    m_sourceRows.erase(it);
+    if (m_sortColumn != -1 && row != -1) {
+        m_rankedRows.removeAt(row);
+        m_rankedScores.remove(row);
+    } else if (m_sortColumn != -1) {
+        int i = 0;
+        while (m_candidates.at(i).sourceRow != sourceRow)
+            ++i;
+        m_candidates[i] = m_candidates.last();
+        m_candidates.resize(m_candidates.count() - 1);
+        if (i < m_candidates.count()) {
+            siftDown(i);
+            siftUp(i);
+        }
+    }
+    m_proxyRows.clear();
+    if (row != -1)
+        endRemoveRows();
+}
+
+void HistoryCompletionModel::updateRow(int sourceRow)
+{
+    bool matched = qBinaryFind(m_sourceRows.begin(), m_sourceRows.end(), sourceRow) != m_sourceRows.end();
+    if (!filterAcceptsRow(sourceRow, QModelIndex())) {
+        if (matched)
+            removeRow(sourceRow);
+        return;
+    }
+    if (!matched) {
+        insertRow(sourceRow);
+        return;
+    }
+
+    int row = proxyRow(sourceRow);
+    if (m_sortColumn != -1) {
+        int newScore = score(sourceModel()->index(sourceRow, m_sortColumn));
+        int oldScore = -1;
+        if (row != -1) {
+            oldScore = m_rankedScores.at(row);
+        } else {
+            for (int i = 0; i < m_candidates.count(); ++i) {
+                if (m_candidates.at(i).sourceRow == sourceRow)
+                    oldScore = m_candidates.at(i).score;
+            }
+        }
+        if (newScore != oldScore) {
+            removeRow(sourceRow);
+            insertRow(sourceRow);
+            return;
+        }
+    }
+    if (row != -1)
+        emit dataChanged(index(row, 0), index(row, columnCount() - 1));
+}
+
+bool HistoryCompletionModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && !m_candidates.isEmpty();
+}
+
+void HistoryCompletionModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent))
+        return;
+    int first = m_rankedRows.count();
+    int count = qMin(RankedBatchSize, m_candidates.count());
+    beginInsertRows(QModelIndex(), first, first + count - 1);
+    rankRows(count);
+    endInsertRows();
+}
+
+/*
+    The rows that match do not depend on the order, only the rows that
+    already matched the search string are ranked again.  The rows are
+    already ranked for the search string when neither the column nor the
+    order changes, so every row is scored once per search string.
+ */
+void HistoryCompletionModel::sort(int column, Qt::SortOrder order)
+{
+    if (column == m_sortColumn && order == m_sortOrder)
+        return;
+
+    m_sortColumn = column;
+    m_sortOrder = order;
+    emit layoutAboutToBeChanged();
+    if (m_sortColumn != -1 && !m_allRows) {
+        sortRows();
+    } else {
+        m_rankedRows.clear();
+        m_rankedScores.clear();
+        m_candidates.clear();
+        m_proxyRows.clear();
+    }
+    emit layoutChanged();
+}
+
+QModelIndex HistoryCompletionModel::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    if (!sourceIndex.isValid())
+        return QModelIndex();
+    int row = m_allRows ? sourceIndex.row() : proxyRow(sourceIndex.row());
+    if (row == -1)
+        return QModelIndex();
+    return createIndex(row, sourceIndex.column());
+}
+
+QModelIndex HistoryCompletionModel::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!proxyIndex.isValid() || !sourceModel())
+        return QModelIndex();
+    int row = m_allRows ? proxyIndex.row() : rows().at(proxyIndex.row());
+    return sourceModel()->index(row, proxyIndex.column());
+}
+
+QModelIndex HistoryCompletionModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (row < 0 || row >= rowCount(parent)
+        || column < 0 || column >= columnCount(parent))
+        return QModelIndex();
+    return createIndex(row, column);
+}
+
+QModelIndex HistoryCompletionModel::parent(const QModelIndex &) const
+{
+    return QModelIndex();
+}
+
+int HistoryCompletionModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid() || !sourceModel())
+        return 0;
+    return m_allRows ? sourceModel()->rowCount() : rows().count();
+}
+
+int HistoryCompletionModel::columnCount(const QModelIndex &parent) const
+{
+    if (parent.isValid() || !sourceModel())
+        return 0;
+    return sourceModel()->columnCount();
 }
 
 QVariant HistoryCompletionModel::data(const QModelIndex &index, int role) const
@@ -78,7 +542,7 @@ QVariant HistoryCompletionModel::data(const QModelIndex &index, int role) const
     }
 
     if (role == Qt::FontRole && index.column() == 1) {
-        QFont font = qvariant_cast<QFont>(QSortFilterProxyModel::data(index, role));
+        QFont font = qvariant_cast<QFont>(QAbstractProxyModel::data(index, role));
         font.setWeight(QFont::Light);
         return font;
     }
@@ -86,7 +550,7 @@ QVariant HistoryCompletionModel::data(const QModelIndex &index, int role) const
     if (role == Qt::DisplayRole)
         role = (index.column() == 0) ? HistoryModel::UrlStringRole : HistoryModel::TitleRole;
 
-    return QSortFilterProxyModel::data(index, role);
+    return QAbstractProxyModel::data(index, role);
 }
 
 QString HistoryCompletionModel::searchString() const
@@ -99,10 +563,17 @@ void HistoryCompletionModel::setSearchString(const QString &str)
     if (str == m_searchString)
         return;
 
+    // a longer search string can only match rows that matched before
+    bool narrow = !m_allRows && str.startsWith(m_searchString);
+
     m_searchString = str;
     m_searchMatcher.setPattern(str);
     m_wordMatcher.setPattern(QLatin1String("\\b") + QRegExp::escape(str));
-    invalidateFilter();
+    if (narrow)
+        narrowRows();
+    else
+        filter();
+    reset();
 }
 
 bool HistoryCompletionModel::isValid() const
@@ -140,28 +611,24 @@ bool HistoryCompletionModel::filterAcceptsRow(int source_row, const QModelIndex
     return false;
 }
 
-bool HistoryCompletionModel::lessThan(const QModelIndex &left, const QModelIndex &right) const
+int HistoryCompletionModel::score(const QModelIndex &sourceIndex) const
 {
     // We give a bonus to hits that match on a word boundary so that e.g. "dot.kde.org"
     // is a better result for typing "dot" than "slashdot.org". However, we only look
     // for the string in the host name, not the entire url, since while it makes sense
     // to e.g. give "www.phoronix.com" a bonus for "ph", it does _not_ make sense to
     // give "www.yadda.com/foo.php" the bonus.
-    int frecency_l = sourceModel()->data(left, HistoryFilterModel::FrecencyRole).toInt();
-    QString url_l = sourceModel()->data(left, HistoryModel::UrlRole).toUrl().host();
-    QString title_l = sourceModel()->data(left, HistoryModel::TitleRole).toString();
-
-    if (m_wordMatcher.indexIn(url_l) != -1 || m_wordMatcher.indexIn(title_l) != -1)
-        frecency_l *= 2;
+    int frecency = sourceModel()->data(sourceIndex, HistoryFilterModel::FrecencyRole).toInt();
+    QString host = sourceModel()->data(sourceIndex, HistoryModel::UrlRole).toUrl().host();
+    if (m_wordMatcher.indexIn(host) != -1)
+        return frecency * 2;
 
-    int frecency_r = sourceModel()->data(right, HistoryFilterModel::FrecencyRole).toInt();
-    QString url_r = sourceModel()->data(right, HistoryModel::UrlRole).toUrl().host();
-    QString title_r = sourceModel()->data(right, HistoryModel::TitleRole).toString();
-    if (m_wordMatcher.indexIn(url_r) != -1 || m_wordMatcher.indexIn(title_r) != -1)
-        frecency_r *= 2;
+    QString title = sourceModel()->data(sourceIndex, HistoryModel::TitleRole).toString();
+    if (m_wordMatcher.indexIn(title) != -1)
+        return frecency * 2;
 
-    // sort results in descending frecency-derived score
-    return (frecency_r < frecency_l);
+    // results are sorted in descending frecency-derived score
+    return frecency;
 }
 
 HistoryCompleter::HistoryCompleter(QObject *parent)
@@ -23,11 +23,13 @@
 
 #include "history.h"
 
+#include <qabstractproxymodel.h>
 #include <qcompleter.h>
+#include <qhash.h>
 #include <qregexp.h>
-#include <qsortfilterproxymodel.h>
 #include <qtableview.h>
 #include <qtimer.h>
+#include <qvector.h>
 
 class QResizeEvent;
 class HistoryCompletionView : public QTableView
@@ -52,7 +54,13 @@ protected:
 // abuse QCompleter::pathFromIndex() to return a url that does not start with what
 // the user typed -- but is what they were looking for.
 
-class HistoryCompletionModel : public QSortFilterProxyModel
+// The rows are the ones of the HistoryFilterModel that match the search
+// string, when the urls are found in the trigram index of the HistoryStore
+// only they are checked instead of every row.  Rows the source inserts,
+// removes or changes are checked one at a time.
+
+class HistoryStore;
+class HistoryCompletionModel : public QAbstractProxyModel
 {
     Q_OBJECT
     Q_PROPERTY(QString searchString READ searchString WRITE setSearchString)
@@ -70,11 +78,62 @@ public:
 
     virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
 
+    void setSourceModel(QAbstractItemModel *sourceModel);
+    QModelIndex mapFromSource(const QModelIndex &sourceIndex) const;
+    QModelIndex mapToSource(const QModelIndex &proxyIndex) const;
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const;
+    QModelIndex parent(const QModelIndex &index = QModelIndex()) const;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder);
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+
 protected:
     virtual bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const;
-    virtual bool lessThan(const QModelIndex &left, const QModelIndex &right) const;
+    virtual int score(const QModelIndex &sourceIndex) const;
+
+private slots:
+    void sourceReset();
+    void sourceRowsInserted(const QModelIndex &parent, int start, int end);
+    void sourceRowsRemoved(const QModelIndex &parent, int start, int end);
+    void sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
 
 private:
+    struct Candidate {
+        int sourceRow;
+        int score;
+    };
+
+    const HistoryStore *historyStore() const;
+    const QList<int> &rows() const
+        { return m_sortColumn == -1 ? m_sourceRows : m_rankedRows; }
+    void filter();
+    void narrowRows();
+    void sortRows();
+    void rankRows(int count);
+    inline bool ranksBefore(const Candidate &left, const Candidate &right) const;
+    void siftDown(int i);
+    void siftUp(int i);
+    int proxyRow(int sourceRow) const;
+    void shiftRows(int start, int count);
+    void insertRow(int sourceRow);
+    void removeRow(int sourceRow);
+    void updateRow(int sourceRow);
+
+    // the source rows, all of them in order while m_allRows
+    QList<int> m_sourceRows;
+    bool m_allRows;
+    // When sorted only the best rows are ranked, the others wait in a
+    // heap of scored candidates until the view fetches more.
+    QList<int> m_rankedRows;
+    QVector<int> m_rankedScores;
+    QVector<Candidate> m_candidates;
+    // the row of every source row in rows(), built when it is first needed
+    mutable QHash<int, int> m_proxyRows;
+    int m_sortColumn;
+    Qt::SortOrder m_sortOrder;
+
     QString m_searchString;
     QRegExp m_searchMatcher;
     QRegExp m_wordMatcher;
@@ -70,13 +70,18 @@
 #include <qdesktopservices.h>
 #include <qdir.h>
 #include <qfile.h>
+#include <qfileinfo.h>
+#include <qfuturewatcher.h>
 #include <qsettings.h>
+#include <qtconcurrentrun.h>
 #include <qtemporaryfile.h>
 #include <qwebhistoryinterface.h>
 #include <qwebsettings.h>
 
 #include <qdebug.h>
 
+// #define HISTORYMANAGER_DEBUG
+
 QString HistoryEntry::userTitle() const
 {
     // when there is no title try to generate one from the url
@@ -89,12 +94,509 @@ QString HistoryEntry::userTitle() const
     return title;
 }
 
+// a timestamp for an invalid QDateTime
+static const qint64 InvalidTimestamp = Q_INT64_C(-0x7fffffffffffffff) - 1;
+static const qint64 MSecsPerDay = Q_INT64_C(86400000);
+
+HistoryStore::HistoryStore()
+    : m_firstVisit(0)
+    , m_removedVisits(0)
+{
+}
+
+HistoryEntry HistoryStore::at(int offset) const
+{
+    int i = index(offset);
+    return HistoryEntry(m_urls.at(m_urlColumn.at(i)),
+                        fromTimestamp(m_timeColumn.at(i)),
+                        m_titles.at(m_titleColumn.at(i)));
+}
+
+int HistoryStore::internUrl(const QString &url)
+{
+    QHash<QString, int>::const_iterator it = m_urlIds.constFind(url);
+    if (it != m_urlIds.constEnd())
+        return it.value();
+    int id = m_urls.count();
+    m_urls.append(url);
+    m_urlIds.insert(url, id);
+    m_urlVisits.append(QVector<int>());
+    m_urlTitles.append(-1);
+    if (m_urlFilter.isFull())
+        rebuildUrlFilter();
+    else
+        m_urlFilter.insert(url);
+    return id;
+}
+
+int HistoryStore::internTitle(const QString &title)
+{
+    QHash<QString, int>::const_iterator it = m_titleIds.constFind(title);
+    if (it != m_titleIds.constEnd())
+        return it.value();
+    int id = m_titles.count();
+    m_titles.append(title);
+    m_titleIds.insert(title, id);
+    return id;
+}
+
+void HistoryStore::prepend(const HistoryEntry &entry)
+{
+    int url = internUrl(entry.url);
+    int title = internTitle(entry.title);
+    if (m_urlVisits.at(url).isEmpty())
+        indexText(url, entry.url);
+    m_urlVisits[url].append(m_firstVisit + m_timeColumn.count());
+    m_urlColumn.append(url);
+    m_titleColumn.append(title);
+    indexTitle(url, title);
+    m_timeColumn.append(toTimestamp(entry.dateTime));
+    m_liveVisits.append(1);
+}
+
+void HistoryStore::setTitle(int offset, const QString &title)
+{
+    int i = index(offset);
+    m_titleColumn[i] = internTitle(title);
+    indexTitle(m_urlColumn.at(i), m_titleColumn.at(i));
+}
+
+/*
+    The removed visit leaves its slot behind so that only the visits of its
+    url change, the slots are dropped once there are more of them than
+    there are visits.
+ */
+void HistoryStore::removeAt(int offset)
+{
+    int i = index(offset);
+    QVector<int> &visits = m_urlVisits[m_urlColumn.at(i)];
+    visits.erase(qLowerBound(visits.begin(), visits.end(), m_firstVisit + i));
+    if (visits.isEmpty())
+        unindexUrl(m_urlColumn.at(i));
+    m_urlColumn[i] = -1;
+    m_liveVisits.add(i, -1);
+    ++m_removedVisits;
+    if (m_removedVisits > count())
+        compact();
+}
+
+// Removes the \a count oldest visits
+void HistoryStore::removeLast(int count)
+{
+    count = qMin(count, this->count());
+    if (count == 0)
+        return;
+    int slots = (m_removedVisits == 0) ? count : m_liveVisits.find(count - 1) + 1;
+    // the oldest visit is the oldest of its url too
+    for (int i = 0; i < slots; ++i) {
+        int url = m_urlColumn.at(i);
+        if (url == -1) {
+            --m_removedVisits;
+            continue;
+        }
+        m_urlVisits[url].remove(0);
+        if (m_urlVisits.at(url).isEmpty())
+            unindexUrl(url);
+    }
+    m_firstVisit += slots;
+    m_urlColumn.remove(0, slots);
+    m_titleColumn.remove(0, slots);
+    m_timeColumn.remove(0, slots);
+    if (m_removedVisits == 0)
+        m_liveVisits.clear(m_timeColumn.count(), 1);
+    else
+        compact();
+}
+
+/*
+    Drops the slots of the removed visits and numbers the visits again, the
+    trigrams of titles the urls no longer have are dropped as well.
+ */
+void HistoryStore::compact()
+{
+    int count = 0;
+    for (int i = 0; i < m_urlColumn.count(); ++i) {
+        if (m_urlColumn.at(i) == -1)
+            continue;
+        m_urlColumn[count] = m_urlColumn.at(i);
+        m_titleColumn[count] = m_titleColumn.at(i);
+        m_timeColumn[count] = m_timeColumn.at(i);
+        ++count;
+    }
+    m_urlColumn.resize(count);
+    m_titleColumn.resize(count);
+    m_timeColumn.resize(count);
+
+    m_firstVisit = 0;
+    for (int i = 0; i < m_urlVisits.count(); ++i)
+        m_urlVisits[i].clear();
+    for (int i = 0; i < count; ++i)
+        m_urlVisits[m_urlColumn.at(i)].append(i);
+    m_liveVisits.clear(count, 1);
+    m_removedVisits = 0;
+    rebuildTrigrams();
+}
+
+int HistoryStore::indexOf(const HistoryEntry &entry) const
+{
+    int url = urlId(entry.url);
+    int title = m_titleIds.value(entry.title, -1);
+    if (url == -1 || title == -1)
+        return -1;
+    qint64 timestamp = toTimestamp(entry.dateTime);
+    const QVector<int> &visits = m_urlVisits.at(url);
+    for (int i = visits.count() - 1; i >= 0; --i) {
+        int column = visits.at(i) - m_firstVisit;
+        if (m_titleColumn.at(column) == title
+            && m_timeColumn.at(column) == timestamp)
+            return offsetOf(column);
+    }
+    return -1;
+}
+
+// Returns the offset of the newest visit of \a url at \a timestamp or -1
+int HistoryStore::indexOf(const QString &url, qint64 timestamp) const
+{
+    int id = urlId(url);
+    if (id == -1)
+        return -1;
+    const QVector<int> &visits = m_urlVisits.at(id);
+    for (int i = visits.count() - 1; i >= 0; --i) {
+        int column = visits.at(i) - m_firstVisit;
+        if (m_timeColumn.at(column) == timestamp)
+            return offsetOf(column);
+    }
+    return -1;
+}
+
+/*
+    Most urls asked about were never visited, the filter answers that
+    without looking the url up in m_urlIds.
+ */
+bool HistoryStore::contains(const QString &url) const
+{
+    if (!m_urlFilter.mightContain(url))
+        return false;
+    int id = urlId(url);
+    return id != -1 && !m_urlVisits.at(id).isEmpty();
+}
+
+// Sizes the filter for twice the urls there are now and adds them all
+void HistoryStore::rebuildUrlFilter()
+{
+    m_urlFilter.clear(qMax(1024, m_urls.count() * 2));
+    for (int i = 0; i < m_urls.count(); ++i)
+        m_urlFilter.insert(m_urls.at(i));
+}
+
+// The case folded trigrams of \a text, each one once
+static QVector<quint64> trigrams(const QString &text)
+{
+    QVector<quint64> result;
+    if (text.length() < 3)
+        return result;
+    result.reserve(text.length() - 2);
+    QString folded = text.toCaseFolded();
+    const ushort *data = folded.utf16();
+    for (int i = 0; i + 2 < folded.length(); ++i)
+        result.append((quint64(data[i]) << 32) | (quint64(data[i + 1]) << 16) | data[i + 2]);
+    qSort(result.begin(), result.end());
+    int count = 0;
+    for (int i = 0; i < result.count(); ++i) {
+        if (i == 0 || result.at(i) != result.at(count - 1))
+            result[count++] = result.at(i);
+    }
+    result.resize(count);
+    return result;
+}
+
+// Files \a urlId under the trigrams of \a text, the lists stay sorted
+void HistoryStore::indexText(int urlId, const QString &text)
+{
+    foreach (quint64 trigram, trigrams(text)) {
+        QVector<int> &urls = m_trigramUrls[trigram];
+        if (urls.isEmpty() || urls.last() < urlId) {
+            urls.append(urlId);
+            continue;
+        }
+        QVector<int>::iterator it = qLowerBound(urls.begin(), urls.end(), urlId);
+        if (*it != urlId)
+            urls.insert(it, urlId);
+    }
+}
+
+/*
+    A url is filed under the trigrams of every title it had, the ones it
+    no longer has only make it a candidate that matches() turns down until
+    rebuildTrigrams() drops them.
+ */
+void HistoryStore::indexTitle(int urlId, int titleId)
+{
+    if (m_urlTitles.at(urlId) == titleId)
+        return;
+    m_urlTitles[urlId] = titleId;
+    indexText(urlId, m_titles.at(titleId));
+}
+
+// Takes \a urlId out of the lists of the trigrams of \a text
+void HistoryStore::unindexText(int urlId, const QString &text)
+{
+    foreach (quint64 trigram, trigrams(text)) {
+        QHash<quint64, QVector<int> >::iterator it = m_trigramUrls.find(trigram);
+        if (it == m_trigramUrls.end())
+            continue;
+        QVector<int> &urls = it.value();
+        QVector<int>::iterator found = qBinaryFind(urls.begin(), urls.end(), urlId);
+        if (found != urls.end())
+            urls.erase(found);
+        if (urls.isEmpty())
+            m_trigramUrls.erase(it);
+    }
+}
+
+// A url without visits is taken out of the trigrams of its url and title
+void HistoryStore::unindexUrl(int urlId)
+{
+    unindexText(urlId, m_urls.at(urlId));
+    if (m_urlTitles.at(urlId) != -1)
+        unindexText(urlId, m_titles.at(m_urlTitles.at(urlId)));
+    m_urlTitles[urlId] = -1;
+}
+
+// Files every url with visits under its url and the titles of its visits
+void HistoryStore::rebuildTrigrams()
+{
+    m_trigramUrls.clear();
+    m_urlTitles.fill(-1, m_urls.count());
+    for (int i = 0; i < m_urls.count(); ++i) {
+        if (!m_urlVisits.at(i).isEmpty())
+            indexText(i, m_urls.at(i));
+    }
+    for (int i = 0; i < m_urlColumn.count(); ++i) {
+        if (m_urlColumn.at(i) != -1)
+            indexTitle(m_urlColumn.at(i), m_titleColumn.at(i));
+    }
+}
+
+/*
+    Sets \a offsets to the newest visit of every url whose url or a title
+    might contain \a text, in no particular order.  Returns false when
+    \a text is too short to be looked up and every url has to be checked.
+ */
+bool HistoryStore::matchingUrls(const QString &text, QVector<int> &offsets) const
+{
+    offsets.clear();
+    QVector<quint64> keys = trigrams(text);
+    if (keys.isEmpty())
+        return false;
+
+    // start from the shortest list, every other one can only make it shorter
+    QList<const QVector<int>*> lists;
+    foreach (quint64 key, keys) {
+        QHash<quint64, QVector<int> >::const_iterator it = m_trigramUrls.constFind(key);
+        if (it == m_trigramUrls.constEnd())
+            return true;
+        lists.append(&it.value());
+    }
+    int shortest = 0;
+    for (int i = 1; i < lists.count(); ++i) {
+        if (lists.at(i)->count() < lists.at(shortest)->count())
+            shortest = i;
+    }
+
+    foreach (int id, *lists.at(shortest)) {
+        if (m_urlVisits.at(id).isEmpty())
+            continue;
+        bool inAll = true;
+        for (int i = 0; inAll && i < lists.count(); ++i) {
+            if (i != shortest)
+                inAll = qBinaryFind(lists.at(i)->begin(), lists.at(i)->end(), id) != lists.at(i)->end();
+        }
+        if (inAll)
+            offsets.append(offsetOf(m_urlVisits.at(id).last() - m_firstVisit));
+    }
+    return true;
+}
+
+// Returns the offsets of the visits of \a url, the newest one first
+QList<int> HistoryStore::visits(const QString &url) const
+{
+    QList<int> offsets;
+    int id = urlId(url);
+    if (id == -1)
+        return offsets;
+    const QVector<int> &visits = m_urlVisits.at(id);
+    for (int i = visits.count() - 1; i >= 0; --i)
+        offsets.append(offsetOf(visits.at(i) - m_firstVisit));
+    return offsets;
+}
+
+// Returns the offset of the newest visit of \a url or -1
+int HistoryStore::lastVisit(const QString &url) const
+{
+    int id = urlId(url);
+    if (id == -1 || m_urlVisits.at(id).isEmpty())
+        return -1;
+    return offsetOf(m_urlVisits.at(id).last() - m_firstVisit);
+}
+
+// The number of oldest visits that are not newer than \a timestamp
+int HistoryStore::expiredCount(qint64 timestamp) const
+{
+    int slots = 0;
+    while (slots < m_timeColumn.count() && m_timeColumn.at(slots) <= timestamp)
+        ++slots;
+    return (m_removedVisits == 0) ? slots : m_liveVisits.sum(slots);
+}
+
+void HistoryStore::clear()
+{
+    m_urls.clear();
+    m_urlIds.clear();
+    m_titles.clear();
+    m_titleIds.clear();
+    m_urlVisits.clear();
+    m_urlTitles.clear();
+    m_trigramUrls.clear();
+    m_urlFilter.clear(0);
+    m_firstVisit = 0;
+    m_urlColumn.clear();
+    m_titleColumn.clear();
+    m_timeColumn.clear();
+    m_liveVisits.clear();
+    m_removedVisits = 0;
+}
+
+QList<HistoryEntry> HistoryStore::toList() const
+{
+    QList<HistoryEntry> entries;
+    entries.reserve(count());
+    for (int i = 0; i < count(); ++i)
+        entries.append(at(i));
+    return entries;
+}
+
+/*
+    Replaces the visits with \a entries, newest first, the urls and titles
+    that are no longer used are dropped.
+ */
+void HistoryStore::setEntries(const QList<HistoryEntry> &entries)
+{
+    clear();
+    m_urlColumn.reserve(entries.count());
+    m_titleColumn.reserve(entries.count());
+    m_timeColumn.reserve(entries.count());
+    for (int i = entries.count() - 1; i >= 0; --i)
+        prepend(entries.at(i));
+}
+
+qint64 HistoryStore::toTimestamp(const QDateTime &dateTime)
+{
+    if (!dateTime.isValid())
+        return InvalidTimestamp;
+    QDateTime utc = dateTime.toUTC();
+    return QDate(1970, 1, 1).daysTo(utc.date()) * MSecsPerDay
+           + QTime(0, 0).msecsTo(utc.time());
+}
+
+QDateTime HistoryStore::fromTimestamp(qint64 timestamp)
+{
+    if (timestamp == InvalidTimestamp)
+        return QDateTime();
+    qint64 days = timestamp / MSecsPerDay;
+    qint64 msecs = timestamp % MSecsPerDay;
+    if (msecs < 0) {
+        --days;
+        msecs += MSecsPerDay;
+    }
+    QDateTime utc(QDate(1970, 1, 1).addDays(int(days)), QTime(0, 0).addMSecs(int(msecs)), Qt::UTC);
+    return utc.toLocalTime();
+}
+
+/*
+    Writes the tables and the columns as they are so that reading them back
+    only has to hash the urls and titles again.
+ */
+QDataStream &operator<<(QDataStream &out, const HistoryStore &store)
+{
+    if (store.m_removedVisits != 0) {
+        HistoryStore compacted(store);
+        compacted.compact();
+        return out << compacted;
+    }
+    out << store.m_urls << store.m_titles
+        << store.m_urlColumn << store.m_titleColumn << store.m_timeColumn;
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, HistoryStore &store)
+{
+    store.clear();
+    in >> store.m_urls >> store.m_titles
+       >> store.m_urlColumn >> store.m_titleColumn >> store.m_timeColumn;
+    bool valid = (in.status() == QDataStream::Ok
+                  && store.m_urlColumn.count() == store.m_timeColumn.count()
+                  && store.m_titleColumn.count() == store.m_timeColumn.count());
+    for (int i = 0; valid && i < store.m_urlColumn.count(); ++i) {
+        valid = (store.m_urlColumn.at(i) >= 0 && store.m_urlColumn.at(i) < store.m_urls.count()
+                 && store.m_titleColumn.at(i) >= 0 && store.m_titleColumn.at(i) < store.m_titles.count());
+    }
+    if (!valid) {
+        store.clear();
+        in.setStatus(QDataStream::ReadCorruptData);
+        return in;
+    }
+    store.m_urlIds.reserve(store.m_urls.count());
+    for (int i = 0; i < store.m_urls.count(); ++i)
+        store.m_urlIds.insert(store.m_urls.at(i), i);
+    store.m_titleIds.reserve(store.m_titles.count());
+    for (int i = 0; i < store.m_titles.count(); ++i)
+        store.m_titleIds.insert(store.m_titles.at(i), i);
+    store.rebuildUrlFilter();
+    store.m_urlVisits.resize(store.m_urls.count());
+    store.m_liveVisits.clear(store.m_timeColumn.count(), 1);
+    for (int i = 0; i < store.m_urlColumn.count(); ++i)
+        store.m_urlVisits[store.m_urlColumn.at(i)].append(i);
+    store.rebuildTrigrams();
+    return in;
+}
+
+/*
+    Every record of the history file starts with its type.  Visits are
+    still written as HISTORY_VERSION records so that older versions can
+    read the file, they skip the other records.
+ */
 static const unsigned int HISTORY_VERSION = 23;
+static const unsigned int HISTORY_TITLE_RECORD = 0x100 | HISTORY_VERSION;
+static const unsigned int HISTORY_REMOVE_RECORD = 0x200 | HISTORY_VERSION;
+static const unsigned int HISTORY_EXPIRE_RECORD = 0x300 | HISTORY_VERSION;
+
+// What readHistory() found in the history file
+class HistoryFileContents
+{
+public:
+    HistoryStore store;
+    bool indexed;
+    bool needToSort;
+    int deadRecords;
+};
+
+static const quint32 HISTORY_INDEX_MAGIC = 0xa407a1d8;
+static const quint32 HISTORY_INDEX_VERSION = 1;
+// the part of the history file the checksum in the index is taken from
+static const int HISTORY_INDEX_CHECKSUM_SIZE = 4096;
 
 HistoryManager::HistoryManager(QObject *parent)
     : QWebHistoryInterface(parent)
     , m_saveTimer(new AutoSaver(this))
     , m_daysToExpire(30)
+    , m_rewriteHistory(false)
+    , m_deadRecords(0)
+    , m_historyFileGeneration(0)
+    , m_compacting(0)
+    , m_compactingOffset(0)
+    , m_compactingGeneration(0)
+    , m_loading(0)
     , m_historyModel(0)
     , m_historyFilterModel(0)
     , m_quickViewFilterModel(0)
@@ -103,13 +605,12 @@ HistoryManager::HistoryManager(QObject *parent)
     m_expiredTimer.setSingleShot(true);
     connect(&m_expiredTimer, SIGNAL(timeout()),
             this, SLOT(checkForExpired()));
-    m_frecencyTimer.setSingleShot(true);
-    connect(&m_frecencyTimer, SIGNAL(timeout()),
-            this, SLOT(refreshFrecencies()));
     connect(this, SIGNAL(entryAdded(const HistoryEntry &)),
             m_saveTimer, SLOT(changeOccurred()));
     connect(this, SIGNAL(entryRemoved(const HistoryEntry &)),
             m_saveTimer, SLOT(changeOccurred()));
+    connect(this, SIGNAL(entriesExpired(int)),
+            m_saveTimer, SLOT(changeOccurred()));
     load();
 
     m_historyModel = new HistoryModel(this, this);
@@ -118,25 +619,39 @@ HistoryManager::HistoryManager(QObject *parent)
     m_historyTreeModel = new HistoryTreeModel(m_historyFilterModel, this);
     // QWebHistoryInterface will delete the history manager
     QWebHistoryInterface::setDefaultInterface(this);
-    startFrecencyTimer();
 }
 
 HistoryManager::~HistoryManager()
 {
+    waitForLoaded();
     // remove history items on application exit
     if (m_daysToExpire == -2)
         clear();
     m_saveTimer->saveIfNeccessary();
+    if (m_compacting) {
+        m_compacting->waitForFinished();
+        compacted();
+    }
 }
 
+/*
+    Builds a list of all the visits, use historyStore() to look at single
+    visits without copying the history.  While isLoading() this only has
+    the visits since the history started loading.
+ */
 QList<HistoryEntry> HistoryManager::history() const
+{
+    return m_history.toList();
+}
+
+const HistoryStore &HistoryManager::historyStore() const
 {
     return m_history;
 }
 
 bool HistoryManager::historyContains(const QString &url) const
 {
-    return m_historyFilterModel->historyContains(url);
+    return m_history.contains(url);
 }
 
 void HistoryManager::addHistoryEntry(const QString &url)
@@ -144,24 +659,30 @@ void HistoryManager::addHistoryEntry(const QString &url)
     QUrl cleanUrl(url);
     cleanUrl.setPassword(QString());
     cleanUrl.setHost(cleanUrl.host().toLower());
-    HistoryEntry item(atomicString(cleanUrl.toString()), QDateTime::currentDateTime());
+    HistoryEntry item(cleanUrl.toString(), QDateTime::currentDateTime());
     addHistoryEntry(item);
 }
 
 void HistoryManager::setHistory(const QList<HistoryEntry> &history, bool loadedAndSorted)
 {
-    m_history = history;
-
+    waitForLoaded();
     // verify that it is sorted by date
-    if (!loadedAndSorted)
-        qSort(m_history.begin(), m_history.end());
+    if (!loadedAndSorted) {
+        QList<HistoryEntry> sortedHistory = history;
+        qSort(sortedHistory.begin(), sortedHistory.end());
+        m_history.setEntries(sortedHistory);
+    } else {
+        m_history.setEntries(history);
+    }
+    historyChanged(loadedAndSorted);
+}
 
-    checkForExpired();
+void HistoryManager::historyChanged(bool loadedAndSorted)
+{
+    checkForExpired(false);
 
-    if (loadedAndSorted) {
-        m_lastSavedUrl = m_history.value(0).url;
-    } else {
-        m_lastSavedUrl.clear();
+    if (!loadedAndSorted) {
+        m_rewriteHistory = true;
         m_saveTimer->changeOccurred();
     }
     emit historyReset();
@@ -187,7 +708,12 @@ HistoryTreeModel *HistoryManager::historyTreeModel() const
     return m_historyTreeModel;
 }
 
-void HistoryManager::checkForExpired()
+/*
+    The expired visits are always the oldest ones, they are removed
+    together so that the models only see the end of the history go away.
+    \a notify is false while the whole history is replaced anyway.
+ */
+void HistoryManager::checkForExpired(bool notify)
 {
     if (m_daysToExpire < 0 || m_history.isEmpty())
         return;
@@ -195,8 +721,9 @@ void HistoryManager::checkForExpired()
     QDateTime now = QDateTime::currentDateTime();
     int nextTimeout = 0;
 
-    while (!m_history.isEmpty()) {
-        QDateTime checkForExpired = m_history.last().dateTime;
+    int expired = 0;
+    while (expired < m_history.count()) {
+        QDateTime checkForExpired = m_history.dateTime(m_history.count() - 1 - expired);
         checkForExpired.setDate(checkForExpired.date().addDays(m_daysToExpire));
         if (now.daysTo(checkForExpired) > 7) {
             // check at most in a week to prevent int overflows on the timer
@@ -206,10 +733,19 @@ void HistoryManager::checkForExpired()
         }
         if (nextTimeout > 0)
             break;
-        HistoryEntry item = m_history.takeLast();
+        ++expired;
+    }
+
+    if (expired > 0) {
+        qint64 expiredTimestamp = m_history.timestamp(m_history.count() - expired);
+        if (notify)
+            emit entriesAboutToExpire(expired);
+        m_history.removeLast(expired);
+        m_deadRecords += expired;
         // remove from saved file also
-        m_lastSavedUrl.clear();
-        emit entryRemoved(item);
+        appendRecord(HISTORY_EXPIRE_RECORD, QString(), HistoryStore::fromTimestamp(expiredTimestamp));
+        if (notify)
+            emit entriesExpired(expired);
     }
 
     if (nextTimeout > 0)
@@ -223,6 +759,7 @@ void HistoryManager::addHistoryEntry(const HistoryEntry &item)
         return;
 
     m_history.prepend(item);
+    appendRecord(HISTORY_VERSION, item.url, item.dateTime, item.title);
     emit entryAdded(item);
     if (m_history.count() == 1)
         checkForExpired();
@@ -230,31 +767,39 @@ void HistoryManager::addHistoryEntry(const HistoryEntry &item)
 
 void HistoryManager::updateHistoryEntry(const QUrl &url, const QString &title)
 {
-    for (int i = 0; i < m_history.count(); ++i) {
-        if (url == m_history.at(i).url) {
-            m_history[i].title = atomicString(title);
-            m_saveTimer->changeOccurred();
-            if (m_lastSavedUrl.isEmpty())
-                m_lastSavedUrl = m_history.at(i).url;
-            emit entryUpdated(i);
-            break;
-        }
-    }
+    int offset = m_history.lastVisit(url.toString());
+    if (offset == -1)
+        return;
+    m_history.setTitle(offset, title);
+    appendRecord(HISTORY_TITLE_RECORD, m_history.url(offset), m_history.dateTime(offset), title);
+    ++m_deadRecords;
+    m_saveTimer->changeOccurred();
+    emit entryUpdated(offset);
 }
 
 void HistoryManager::removeHistoryEntry(const HistoryEntry &item)
 {
-    m_lastSavedUrl.clear();
-    m_history.removeOne(item);
+    int offset = m_history.indexOf(item);
+    if (offset != -1)
+        removeHistoryEntry(offset);
+}
+
+void HistoryManager::removeHistoryEntry(int offset)
+{
+    HistoryEntry item = m_history.at(offset);
+    emit entryAboutToBeRemoved(offset);
+    appendRecord(HISTORY_REMOVE_RECORD, item.url, item.dateTime);
+    m_history.removeAt(offset);
+    m_deadRecords += 2;
     emit entryRemoved(item);
 }
 
 void HistoryManager::removeHistoryEntry(const QUrl &url, const QString &title)
 {
-    for (int i = 0; i < m_history.count(); ++i) {
-        if (url == m_history.at(i).url
-            && (title.isEmpty() || title == m_history.at(i).title)) {
-            removeHistoryEntry(m_history.at(i));
+    waitForLoaded();
+    foreach (int offset, m_history.visits(url.toString())) {
+        if (title.isEmpty() || title == m_history.title(offset)) {
+            removeHistoryEntry(m_history.at(offset));
             break;
         }
     }
@@ -276,9 +821,10 @@ void HistoryManager::setDaysToExpire(int limit)
 
 void HistoryManager::clear()
 {
+    waitForLoaded();
     m_history.clear();
-    m_atomicStringHash.clear();
-    m_lastSavedUrl.clear();
+    m_journal.clear();
+    m_rewriteHistory = true;
     m_saveTimer->changeOccurred();
     m_saveTimer->saveIfNeccessary();
     emit historyReset();
@@ -293,28 +839,125 @@ void HistoryManager::loadSettings()
     m_daysToExpire = settings.value(QLatin1String("historyLimit"), 30).toInt();
 }
 
+QString HistoryManager::historyFileName()
+{
+    return BrowserApplication::dataFilePath(QLatin1String("history"));
+}
+
+QString HistoryManager::indexFileName()
+{
+    return BrowserApplication::dataFilePath(QLatin1String("history.index"));
+}
+
+/*
+    Reads the history file in another thread, addHistoryEntry() only adds
+    to m_history until loaded() merges it with what was read.
+ */
 void HistoryManager::load()
 {
     loadSettings();
 
-    QFile historyFile(BrowserApplication::dataFilePath(QLatin1String("history")));
+    if (!QFile::exists(historyFileName()))
+        return;
+
+    m_loading = new QFutureWatcher<HistoryFileContents>(this);
+    connect(m_loading, SIGNAL(finished()), this, SLOT(loaded()));
+    m_loading->setFuture(QtConcurrent::run(readHistory, historyFileName(), indexFileName()));
+}
+
+bool HistoryManager::isLoading() const
+{
+    return m_loading != 0;
+}
 
-    if (!historyFile.exists())
+/*
+    Blocks until the history file is read, for the functions that need
+    the whole history.
+ */
+void HistoryManager::waitForLoaded()
+{
+    if (!m_loading)
+        return;
+    m_loading->waitForFinished();
+    loaded();
+}
+
+void HistoryManager::loaded()
+{
+    if (!m_loading)
         return;
+    HistoryFileContents contents = m_loading->result();
+    m_loading->deleteLater();
+    m_loading = 0;
+
+    // the visits added while loading are the newest ones
+    HistoryStore store = contents.store;
+    bool needToSort = contents.needToSort;
+    for (int i = m_history.count() - 1; i >= 0; --i) {
+        if (!needToSort && !store.isEmpty()
+            && store.timestamp(0) > m_history.timestamp(i))
+            needToSort = true;
+        store.prepend(m_history.at(i));
+    }
+    if (needToSort) {
+        QList<HistoryEntry> list = store.toList();
+        qSort(list.begin(), list.end());
+        store.setEntries(list);
+    }
+
+    m_history = store;
+    m_deadRecords += contents.deadRecords;
+    historyChanged(true);
+
+    // If we had to sort re-write the whole history sorted
+    if (needToSort)
+        m_rewriteHistory = true;
+    // save what was added while loading
+    if (m_rewriteHistory || !m_journal.isEmpty())
+        m_saveTimer->changeOccurred();
+
+    // without an index the whole file is read record by record, compact
+    // it with the next save to write one
+    if (!contents.indexed && m_history.count() >= 1000)
+        m_deadRecords = qMax(m_deadRecords, m_history.count() + 1);
+#if defined(HISTORYMANAGER_DEBUG)
+    qDebug() << "HistoryManager::" << __FUNCTION__ << contents.indexed << m_history.count() << m_deadRecords;
+#endif
+}
+
+/*
+    Reads the history file and replays its records.  This only uses its
+    arguments so it can run in any thread.
+ */
+HistoryFileContents HistoryManager::readHistory(const QString &fileName, const QString &indexFileName)
+{
+    HistoryFileContents contents;
+    contents.indexed = false;
+    contents.needToSort = false;
+    contents.deadRecords = 0;
+
+    QFile historyFile(fileName);
     if (!historyFile.open(QFile::ReadOnly)) {
         qWarning() << "Unable to open history file" << historyFile.fileName();
-        return;
+        return contents;
+    }
+
+    // The index has the history up to where the file was last compacted,
+    // only the records after that are read one by one.  The file has the
+    // oldest visit first, so each one is the newest so far.
+    HistoryStore &store = contents.store;
+    contents.indexed = loadIndex(indexFileName, historyFile, store);
+    if (!contents.indexed) {
+        store.clear();
+        historyFile.seek(0);
     }
 
-    QList<HistoryEntry> list;
     QDataStream in(&historyFile);
     // Double check that the history file is sorted as it is read in
-    bool needToSort = false;
     HistoryEntry lastInsertedItem;
     QByteArray data;
     QDataStream stream;
     QBuffer buffer;
-    QString string;
     stream.setDevice(&buffer);
     while (!historyFile.atEnd()) {
         in >> data;
@@ -323,118 +966,265 @@ void HistoryManager::load()
         buffer.open(QIODevice::ReadOnly);
         quint32 ver;
         stream >> ver;
-        if (ver != HISTORY_VERSION)
-            continue;
         HistoryEntry item;
-        stream >> string;
-        item.url = atomicString(string);
+        stream >> item.url;
         stream >> item.dateTime;
-        stream >> string;
-        item.title = atomicString(string);
+        stream >> item.title;
+
+        switch (ver) {
+        case HISTORY_VERSION:
+            break;
+        case HISTORY_TITLE_RECORD: {
+            int offset = store.indexOf(item.url, HistoryStore::toTimestamp(item.dateTime));
+            if (offset != -1)
+                store.setTitle(offset, item.title);
+            ++contents.deadRecords;
+            continue;
+        }
+        case HISTORY_REMOVE_RECORD: {
+            int offset = store.indexOf(item.url, HistoryStore::toTimestamp(item.dateTime));
+            if (offset != -1)
+                store.removeAt(offset);
+            contents.deadRecords += 2;
+            continue;
+        }
+        case HISTORY_EXPIRE_RECORD: {
+            int count = store.expiredCount(HistoryStore::toTimestamp(item.dateTime));
+            store.removeLast(count);
+            contents.deadRecords += count + 1;
+            continue;
+        }
+        default:
+            continue;
+        }
 
         if (!item.dateTime.isValid())
             continue;
 
         if (item == lastInsertedItem) {
-            if (lastInsertedItem.title.isEmpty() && !list.isEmpty())
-                list[0].title = item.title;
+            if (lastInsertedItem.title.isEmpty() && !store.isEmpty())
+                store.setTitle(0, item.title);
             continue;
         }
 
-        if (!needToSort && !list.isEmpty() && lastInsertedItem < item)
-            needToSort = true;
+        if (!contents.needToSort && !store.isEmpty()
+            && store.timestamp(0) > HistoryStore::toTimestamp(item.dateTime))
+            contents.needToSort = true;
 
-        list.prepend(item);
+        store.prepend(item);
         lastInsertedItem = item;
     }
-    if (needToSort)
-        qSort(list.begin(), list.end());
+    return contents;
+}
 
-    setHistory(list, true);
+/*
+    Reads the history up to the offset in the history file the index was
+    written for, and leaves the history file at that offset.
+ */
+bool HistoryManager::loadIndex(const QString &indexFileName, QFile &historyFile, HistoryStore &store)
+{
+    QFile indexFile(indexFileName);
+    if (!indexFile.open(QFile::ReadOnly))
+        return false;
 
-    // If we had to sort re-write the whole history sorted
-    if (needToSort) {
-        m_lastSavedUrl.clear();
-        m_saveTimer->changeOccurred();
-    }
+    QDataStream in(&indexFile);
+    in.setVersion(QDataStream::Qt_4_5);
+    quint32 magic;
+    quint32 version;
+    qint64 offset;
+    quint16 checksum;
+    in >> magic >> version;
+    if (magic != HISTORY_INDEX_MAGIC || version != HISTORY_INDEX_VERSION)
+        return false;
+    in >> offset >> checksum;
+    if (in.status() != QDataStream::Ok
+        || offset <= 0 || offset > historyFile.size())
+        return false;
+
+    // the history file could have been written again without the index
+    int size = int(qMin<qint64>(offset, HISTORY_INDEX_CHECKSUM_SIZE));
+    if (!historyFile.seek(offset - size))
+        return false;
+    QByteArray data = historyFile.read(size);
+    if (data.size() != size || qChecksum(data.constData(), size) != checksum)
+        return false;
+
+    in >> store;
+    return in.status() == QDataStream::Ok;
 }
 
-QString HistoryManager::atomicString(const QString &string) {
-    QHash<QString, int>::const_iterator it = m_atomicStringHash.constFind(string);
-    if (it == m_atomicStringHash.constEnd()) {
-        QHash<QString, int>::iterator insertedIterator = m_atomicStringHash.insert(string, 0);
-        return insertedIterator.key();
-    }
-    return it.key();
+void HistoryManager::appendRecord(unsigned int type, const QString &url,
+                                  const QDateTime &dateTime, const QString &title)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << type << url << dateTime << title;
+    m_journal.append(data);
 }
 
+/*
+    Appends the changes since the last save to the history file, unless
+    the whole history has to be written again.
+ */
 void HistoryManager::save()
 {
     QSettings settings;
     settings.beginGroup(QLatin1String("history"));
     settings.setValue(QLatin1String("historyLimit"), m_daysToExpire);
 
-    bool saveAll = m_lastSavedUrl.isEmpty();
-    int first = m_history.count() - 1;
-    if (!saveAll) {
-        // find the first one to save
-        for (int i = 0; i < m_history.count(); ++i) {
-            if (m_history.at(i).url == m_lastSavedUrl) {
-                first = i - 1;
-                break;
-            }
-        }
+    // loaded() saves again, the history file is still being read
+    if (m_loading)
+        return;
+
+    if (m_rewriteHistory) {
+        // the journal is already part of the history that is written
+        m_journal.clear();
+        m_rewriteHistory = false;
+        m_deadRecords = 0;
+        ++m_historyFileGeneration;
+        installHistory(writeHistory(m_history, historyFileName()), -1);
+        return;
     }
-    if (first == m_history.count() - 1)
-        saveAll = true;
 
-    QFile historyFile(BrowserApplication::dataFilePath(QLatin1String("history")));
+    if (m_journal.isEmpty())
+        return;
 
-    // When saving everything use a temporary file to prevent possible data loss.
-    QTemporaryFile tempFile;
-    tempFile.setAutoRemove(false);
-    bool open = false;
-    if (saveAll) {
-        open = tempFile.open();
-    } else {
-        open = historyFile.open(QFile::Append);
+    QFile historyFile(historyFileName());
+    if (!historyFile.open(QFile::Append)) {
+        qWarning() << "Unable to open history file for saving" << historyFile.fileName();
+        return;
     }
+    QDataStream out(&historyFile);
+    foreach (const QByteArray &record, m_journal)
+        out << record;
+    historyFile.close();
+    m_journal.clear();
+
+    if (m_deadRecords > qMax(1000, m_history.count()))
+        compact();
+}
+
+/*
+    Writes the history without the records that are out of date in another
+    thread, the records appended while it runs are copied over by compacted().
+ */
+void HistoryManager::compact()
+{
+    if (m_compacting)
+        return;
+#if defined(HISTORYMANAGER_DEBUG)
+    qDebug() << "HistoryManager::" << __FUNCTION__ << m_history.count() << m_deadRecords;
+#endif
+    m_compactingOffset = QFileInfo(historyFileName()).size();
+    m_compactingGeneration = m_historyFileGeneration;
+    m_deadRecords = 0;
+    m_compacting = new QFutureWatcher<QStringList>(this);
+    connect(m_compacting, SIGNAL(finished()), this, SLOT(compacted()));
+    m_compacting->setFuture(QtConcurrent::run(writeHistory, m_history, historyFileName()));
+}
+
+void HistoryManager::compacted()
+{
+    if (!m_compacting)
+        return;
+    QStringList files = m_compacting->result();
+    m_compacting->deleteLater();
+    m_compacting = 0;
 
-    if (!open) {
-        qWarning() << "Unable to open history file for saving"
-                   << (saveAll ? tempFile.fileName() : historyFile.fileName());
+    // the whole history was written since
+    if (m_compactingGeneration != m_historyFileGeneration) {
+        foreach (const QString &file, files)
+            QFile::remove(file);
         return;
     }
+    installHistory(files, m_compactingOffset);
+}
 
-    QDataStream out(saveAll ? &tempFile : &historyFile);
-    for (int i = first; i >= 0; --i) {
+/*
+    Writes \a store as a history file with nothing out of date and an index
+    for it into temporary files next to \a fileName.  Returns the names of
+    the files, the index is left out for an empty history.  This only uses
+    its arguments so it can run in any thread.
+ */
+QStringList HistoryManager::writeHistory(const HistoryStore &store, const QString &fileName)
+{
+    QStringList files;
+    QTemporaryFile tempFile(fileName + QLatin1String(".XXXXXX"));
+    tempFile.setAutoRemove(false);
+    if (!tempFile.open()) {
+        qWarning() << "Unable to open history file for saving" << tempFile.fileName();
+        return files;
+    }
+
+    QDataStream out(&tempFile);
+    for (int i = store.count() - 1; i >= 0; --i) {
         QByteArray data;
         QDataStream stream(&data, QIODevice::WriteOnly);
-        HistoryEntry item = m_history.at(i);
-        stream << HISTORY_VERSION << item.url << item.dateTime << item.title;
+        stream << HISTORY_VERSION << store.url(i) << store.dateTime(i) << store.title(i);
         out << data;
     }
-    tempFile.close();
+    tempFile.flush();
+    files.append(tempFile.fileName());
 
-    if (saveAll) {
-        if (historyFile.exists() && !historyFile.remove())
-            qWarning() << "History: error removing old history." << historyFile.errorString();
-        if (!tempFile.rename(historyFile.fileName()))
-            qWarning() << "History: error moving new history over old." << tempFile.errorString() << historyFile.fileName();
+    qint64 size = tempFile.size();
+    if (size == 0)
+        return files;
+
+    QTemporaryFile indexFile(fileName + QLatin1String(".index.XXXXXX"));
+    indexFile.setAutoRemove(false);
+    if (!indexFile.open()) {
+        qWarning() << "Unable to open history index for saving" << indexFile.fileName();
+        return files;
     }
-    m_lastSavedUrl = m_history.value(0).url;
-}
+    int checksumSize = int(qMin<qint64>(size, HISTORY_INDEX_CHECKSUM_SIZE));
+    tempFile.seek(size - checksumSize);
+    QByteArray data = tempFile.read(checksumSize);
 
-void HistoryManager::refreshFrecencies()
-{
-    m_historyFilterModel->recalculateFrecencies();
-    m_quickViewFilterModel->recalculateFrecencies();
-    startFrecencyTimer();
+    // the tables still hold the urls and titles of the removed visits
+    HistoryStore liveStore;
+    liveStore.setEntries(store.toList());
+    QDataStream index(&indexFile);
+    index.setVersion(QDataStream::Qt_4_5);
+    index << HISTORY_INDEX_MAGIC << HISTORY_INDEX_VERSION
+          << size << qChecksum(data.constData(), data.size())
+          << liveStore;
+    files.append(indexFile.fileName());
+    return files;
 }
 
-void HistoryManager::startFrecencyTimer()
+/*
+    Moves the files written by writeHistory() over the history file and
+    its index.  Whatever was appended to the history file after
+    \a journalOffset is copied over first, -1 when there is nothing to copy.
+ */
+bool HistoryManager::installHistory(const QStringList &files, qint64 journalOffset)
 {
-    // schedule us to recalculate the frecencies once per day, at 3:00 am (aka 03h00)
-    QDateTime tomorrow(QDate::currentDate().addDays(1), QTime(3, 00));
-    m_frecencyTimer.start(QDateTime::currentDateTime().secsTo(tomorrow)*1000);
+    if (files.isEmpty())
+        return false;
+
+    QFile historyFile(historyFileName());
+    if (journalOffset >= 0 && historyFile.size() > journalOffset) {
+        QFile newFile(files.at(0));
+        if (!historyFile.open(QFile::ReadOnly)
+            || !historyFile.seek(journalOffset)
+            || !newFile.open(QFile::Append)) {
+            qWarning() << "History: error copying the end of the history." << historyFile.errorString() << newFile.errorString();
+            foreach (const QString &file, files)
+                QFile::remove(file);
+            return false;
+        }
+        while (!historyFile.atEnd())
+            newFile.write(historyFile.read(64 * 1024));
+        historyFile.close();
+    }
+
+    if (historyFile.exists() && !historyFile.remove())
+        qWarning() << "History: error removing old history." << historyFile.errorString();
+    if (!QFile::rename(files.at(0), historyFile.fileName()))
+        qWarning() << "History: error moving new history over old." << files.at(0) << historyFile.fileName();
+
+    QFile::remove(indexFileName());
+    if (files.count() > 1 && !QFile::rename(files.at(1), indexFileName()))
+        qWarning() << "History: error moving new history index over old." << files.at(1);
+    return true;
 }
@@ -65,9 +65,13 @@
 
 #include <qdatetime.h>
 #include <qhash.h>
+#include <qstringlist.h>
 #include <qtimer.h>
 #include <qurl.h>
+#include <qvector.h>
 #include <qwebhistoryinterface.h>
+#include "bloomfilter.h"
+#include "fenwicktree.h"
 #include "quickview/quickviewfiltermodel.h"
 
 class HistoryEntry
@@ -94,6 +98,101 @@ public:
     QDateTime dateTime;
 };
 
+/*
+    The history kept as columns instead of a list of entries: every visit
+    is a url id, a title id and a timestamp in milliseconds.  Each distinct
+    url and title is stored only once.  Offsets are the same as in
+    HistoryManager::history(), the newest visit is at offset 0.
+*/
+class HistoryStore
+{
+public:
+    HistoryStore();
+
+    int count() const { return m_timeColumn.count() - m_removedVisits; }
+    bool isEmpty() const { return count() == 0; }
+
+    HistoryEntry at(int offset) const;
+    QString url(int offset) const { return m_urls.at(m_urlColumn.at(index(offset))); }
+    QString title(int offset) const { return m_titles.at(m_titleColumn.at(index(offset))); }
+    QDateTime dateTime(int offset) const { return fromTimestamp(timestamp(offset)); }
+    qint64 timestamp(int offset) const { return m_timeColumn.at(index(offset)); }
+    int urlId(int offset) const { return m_urlColumn.at(index(offset)); }
+    int urlId(const QString &url) const { return m_urlIds.value(url, -1); }
+    bool contains(const QString &url) const;
+    bool matchingUrls(const QString &text, QVector<int> &offsets) const;
+
+    void prepend(const HistoryEntry &entry);
+    void setTitle(int offset, const QString &title);
+    void removeAt(int offset);
+    void removeLast(int count = 1);
+    int indexOf(const HistoryEntry &entry) const;
+    int indexOf(const QString &url, qint64 timestamp) const;
+    QList<int> visits(const QString &url) const;
+    int lastVisit(const QString &url) const;
+    int expiredCount(qint64 timestamp) const;
+    void clear();
+
+    QList<HistoryEntry> toList() const;
+    void setEntries(const QList<HistoryEntry> &entries);
+
+    static qint64 toTimestamp(const QDateTime &dateTime);
+    static QDateTime fromTimestamp(qint64 timestamp);
+
+private:
+    friend QDataStream &operator<<(QDataStream &out, const HistoryStore &store);
+    friend QDataStream &operator>>(QDataStream &in, HistoryStore &store);
+
+    // The columns are in the order of the visits, the newest one is last.
+    // index() is the slot of a visit in the columns and offsetOf() the way
+    // back, they only have to skip slots while visits have been removed.
+    inline int index(int offset) const
+        { return m_removedVisits == 0 ? m_timeColumn.count() - 1 - offset : m_liveVisits.find(count() - 1 - offset); }
+    inline int offsetOf(int index) const
+        { return m_removedVisits == 0 ? m_timeColumn.count() - 1 - index : count() - 1 - m_liveVisits.sum(index); }
+    void compact();
+    int internUrl(const QString &url);
+    int internTitle(const QString &title);
+    void rebuildUrlFilter();
+    void indexText(int urlId, const QString &text);
+    void indexTitle(int urlId, int titleId);
+    void unindexText(int urlId, const QString &text);
+    void unindexUrl(int urlId);
+    void rebuildTrigrams();
+
+    QVector<QString> m_urls;
+    QHash<QString, int> m_urlIds;
+    QVector<QString> m_titles;
+    QHash<QString, int> m_titleIds;
+
+    // The visits of every url id oldest first, a visit is numbered by
+    // its slot in the columns plus m_firstVisit so that removing a visit
+    // or the oldest visits does not have to renumber the others.
+    QVector<QVector<int> > m_urlVisits;
+    int m_firstVisit;
+    // every url in m_urls
+    BloomFilter m_urlFilter;
+
+    // The ids of the visited urls filed under every trigram of the url and
+    // its titles, m_urlTitles is the title each url was last filed under.
+    QHash<quint64, QVector<int> > m_trigramUrls;
+    QVector<int> m_urlTitles;
+
+    // A removed visit keeps its slot with a url of -1 until compact(),
+    // m_liveVisits counts 1 for every slot that still has a visit.
+    QVector<int> m_urlColumn;
+    QVector<int> m_titleColumn;
+    QVector<qint64> m_timeColumn;
+    FenwickTree m_liveVisits;
+    int m_removedVisits;
+};
+
+QDataStream &operator<<(QDataStream &out, const HistoryStore &store);
+QDataStream &operator>>(QDataStream &in, HistoryStore &store);
+
+template <typename T> class QFutureWatcher;
+class QFile;
+class HistoryFileContents;
 class AutoSaver;
 class HistoryModel;
 class HistoryFilterModel;
@@ -108,13 +207,19 @@ signals:
     void historyCleared();
     void historyReset();
     void entryAdded(const HistoryEntry &item);
+    void entryAboutToBeRemoved(int offset);
     void entryRemoved(const HistoryEntry &item);
+    void entriesAboutToExpire(int count);
+    void entriesExpired(int count);
     void entryUpdated(int offset);
 
 public:
     HistoryManager(QObject *parent = 0);
     ~HistoryManager();
 
+    bool isLoading() const;
+    void waitForLoaded();
+
     bool historyContains(const QString &url) const;
     void addHistoryEntry(const QString &url);
     void updateHistoryEntry(const QUrl &url, const QString &title);
@@ -124,6 +229,7 @@ public:
     void setDaysToExpire(int limit);
 
     QList<HistoryEntry> history() const;
+    const HistoryStore &historyStore() const;
     void setHistory(const QList<HistoryEntry> &history, bool loadedAndSorted = false);
 
     // History manager keeps around these models for use by the completer and other classes
@@ -138,8 +244,9 @@ public slots:
 
 private slots:
     void save();
-    void checkForExpired();
-    void refreshFrecencies();
+    void loaded();
+    void compacted();
+    void checkForExpired(bool notify = true);
 
 protected:
     void addHistoryEntry(const HistoryEntry &item);
@@ -147,21 +254,43 @@ protected:
 
 private:
     void load();
-    QString atomicString(const QString &string);
-    void startFrecencyTimer();
+    static HistoryFileContents readHistory(const QString &fileName, const QString &indexFileName);
+    static bool loadIndex(const QString &indexFileName, QFile &historyFile, HistoryStore &store);
+    void historyChanged(bool loadedAndSorted);
+    void removeHistoryEntry(int offset);
+    void appendRecord(unsigned int type, const QString &url,
+                      const QDateTime &dateTime, const QString &title = QString());
+    void compact();
+    static QStringList writeHistory(const HistoryStore &store, const QString &fileName);
+    bool installHistory(const QStringList &files, qint64 journalOffset);
+    static QString historyFileName();
+    static QString indexFileName();
 
     AutoSaver *m_saveTimer;
     int m_daysToExpire;
     QTimer m_expiredTimer;
-    QTimer m_frecencyTimer;
-    QHash<QString, int> m_atomicStringHash;
-    QList<HistoryEntry> m_history;
-    QString m_lastSavedUrl;
+    HistoryStore m_history;
+
+    // The history file is a journal of visits, title changes and removals
+    // that is compacted once enough of it is out of date.
+    QList<QByteArray> m_journal;
+    bool m_rewriteHistory;
+    int m_deadRecords;
+    int m_historyFileGeneration;
+    QFutureWatcher<QStringList> *m_compacting;
+    qint64 m_compactingOffset;
+    int m_compactingGeneration;
+
+    // Until the history file is read m_history only has the visits
+    // since, loaded() merges them.
+    QFutureWatcher<HistoryFileContents> *m_loading;
 
     HistoryModel *m_historyModel;
     HistoryFilterModel *m_historyFilterModel;
     QuickViewFilterModel *m_quickViewFilterModel;
     HistoryTreeModel *m_historyTreeModel;
+
+    friend class HistoryModel;
 };
 
 #endif // HISTORYMANAGER_H
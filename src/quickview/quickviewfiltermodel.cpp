@@ -84,12 +84,19 @@
 #include <qwebhistoryinterface.h>
 #include <qwebsettings.h>
 
+#include <math.h>
+
 #include <qdebug.h>
 #include <quickviewfiltermodel.h>
 
+// the frecency of a visit halves every thirty days
+static const qreal FrecencyHalfLife = 30 * 24 * 60 * 60;
+
 QuickViewFilterModel::QuickViewFilterModel(QAbstractItemModel *sourceModel, QObject *parent)
     : QAbstractProxyModel(parent)
     , m_loaded(false)
+    , m_tailOffsetBase(0)
+    , m_removingTail(false)
 {
     setSourceModel(sourceModel);
 }
@@ -101,13 +108,15 @@ int QuickViewFilterModel::historyLocation(const QString &url) const
     if(!m_historyHash.contains(qUrl.host()))
         return 0;
 
-    return sourceModel()->rowCount() - m_historyHash.value(qUrl.toString());
+    return sourceModel()->rowCount() + m_tailOffsetBase - m_historyHash.value(qUrl.toString());
 }
 
 QVariant QuickViewFilterModel::data(const QModelIndex &index, int role) const
 {
     if(role == FrecencyRole && index.isValid()) {
-        return m_filteredRows[index.row()].frecency;
+        // the frecencies are kept as of the reference time, decay them to now
+        qreal decay = pow(2.0, QDateTime::currentDateTime().secsTo(m_referenceTime) / FrecencyHalfLife);
+        return qRound(m_filteredRows[index.row()].frecency * decay);
     }
 
     return QAbstractProxyModel::data(index, role);
@@ -121,6 +130,8 @@ void QuickViewFilterModel::setSourceModel(QAbstractItemModel *newSourceModel)
                    this, SLOT(dataChanged(const QModelIndex &, const QModelIndex &)));
         disconnect(sourceModel(), SIGNAL(rowsInserted(const QModelIndex &, int, int)),
                    this, SLOT(sourceRowsInserted(const QModelIndex &, int, int)));
+        disconnect(sourceModel(), SIGNAL(rowsAboutToBeRemoved(const QModelIndex &, int, int)),
+                   this, SLOT(sourceRowsAboutToBeRemoved(const QModelIndex &, int, int)));
         disconnect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
                    this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
     }
@@ -134,6 +145,8 @@ void QuickViewFilterModel::setSourceModel(QAbstractItemModel *newSourceModel)
                 this, SLOT(sourceDataChanged(const QModelIndex &, const QModelIndex &)));
         connect(sourceModel(), SIGNAL(rowsInserted(const QModelIndex &, int, int)),
                 this, SLOT(sourceRowsInserted(const QModelIndex &, int, int)));
+        connect(sourceModel(), SIGNAL(rowsAboutToBeRemoved(const QModelIndex &, int, int)),
+                this, SLOT(sourceRowsAboutToBeRemoved(const QModelIndex &, int, int)));
         connect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
                 this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
     }
@@ -149,11 +162,6 @@ QVariant QuickViewFilterModel::headerData(int section, Qt::Orientation orientati
     return sourceModel()->headerData(section, orientation, role);
 }
 
-void QuickViewFilterModel::recalculateFrecencies()
-{
-    sourceReset();
-}
-
 void QuickViewFilterModel::sourceReset()
 {
     m_loaded = false;
@@ -176,7 +184,7 @@ int QuickViewFilterModel::columnCount(const QModelIndex &parent) const
 QModelIndex QuickViewFilterModel::mapToSource(const QModelIndex &proxyIndex) const
 {
     load();
-    int sourceRow = sourceModel()->rowCount() - proxyIndex.internalId();
+    int sourceRow = sourceModel()->rowCount() + m_tailOffsetBase - proxyIndex.internalId();
     return sourceModel()->index(sourceRow, proxyIndex.column());
 }
 
@@ -188,7 +196,7 @@ QModelIndex QuickViewFilterModel::mapFromSource(const QModelIndex &sourceIndex)
     if(!m_historyHash.contains(qUrl.host()))
         return QModelIndex();
 
-    int sourceOffset = sourceModel()->rowCount() - sourceIndex.row();
+    int sourceOffset = sourceModel()->rowCount() + m_tailOffsetBase - sourceIndex.row();
 
     QList<HistoryData>::iterator pos = qBinaryFind(m_filteredRows.begin(),
                                        m_filteredRows.end(), HistoryData(sourceOffset, -1));
@@ -221,7 +229,8 @@ void QuickViewFilterModel::load() const
     m_filteredRows.clear();
     m_historyHash.clear();
     m_historyHash.reserve(sourceModel()->rowCount());
-    m_scaleTime = QDateTime::currentDateTime();
+    m_tailOffsetBase = 0;
+    m_referenceTime = QDateTime::currentDateTime();
     for(int i = 0; i < sourceModel()->rowCount(); ++i) {
         QModelIndex idx = sourceModel()->index(i, 0);
         QString url = idx.data(HistoryModel::UrlStringRole).toString();
@@ -253,7 +262,7 @@ void QuickViewFilterModel::sourceRowsInserted(const QModelIndex &parent, int sta
     QModelIndex idx = sourceModel()->index(start, 0, parent);
     QString url = idx.data(HistoryModel::UrlStringRole).toString();
     const QUrl qUrl(url);
-    int currentFrecency = 0;
+    qreal currentFrecency = 0;
     if(m_historyHash.contains(qUrl.host())) {
         QList<HistoryData>::iterator pos = qBinaryFind(m_filteredRows.begin(),
                                            m_filteredRows.end(), HistoryData(m_historyHash[qUrl.host()], -1));
@@ -266,15 +275,60 @@ void QuickViewFilterModel::sourceRowsInserted(const QModelIndex &parent, int sta
         endRemoveRows();
     }
     beginInsertRows(QModelIndex(), 0, 0);
-    m_filteredRows.insert(0, HistoryData(sourceModel()->rowCount(), frecencyScore(idx) + currentFrecency));
-    m_historyHash.insert(qUrl.host(), sourceModel()->rowCount());
+    m_filteredRows.insert(0, HistoryData(sourceModel()->rowCount() + m_tailOffsetBase, frecencyScore(idx) + currentFrecency));
+    m_historyHash.insert(qUrl.host(), sourceModel()->rowCount() + m_tailOffsetBase);
     endInsertRows();
 }
 
+/*
+    Expiring history removes the oldest rows of the source.  The hosts whose
+    every visit is removed are the last rows here, the others only lose
+    the frecency of the removed visits.
+*/
+void QuickViewFilterModel::sourceRowsAboutToBeRemoved(const QModelIndex &parent, int start, int end)
+{
+    m_removingTail = false;
+    if(!m_loaded || parent.isValid() || end != sourceModel()->rowCount() - 1)
+        return;
+
+    QStringList removed;
+    for(int i = start; i <= end; ++i) {
+        QModelIndex idx = sourceModel()->index(i, 0);
+        const QUrl qUrl(idx.data(HistoryModel::UrlStringRole).toString());
+        if(!isValid(qUrl))
+            continue;
+        QString host = qUrl.host();
+        int sourceOffset = sourceModel()->rowCount() + m_tailOffsetBase - i;
+        int offset = m_historyHash.value(host);
+        if(offset == sourceOffset) {
+            removed.append(host);
+            continue;
+        }
+        QList<HistoryData>::iterator pos = qBinaryFind(m_filteredRows.begin(),
+            m_filteredRows.end(), HistoryData(offset, -1));
+        Q_ASSERT(pos != m_filteredRows.end());
+        pos->frecency -= frecencyScore(idx);
+    }
+
+    m_removingTail = true;
+    if(removed.isEmpty())
+        return;
+    int rows = m_filteredRows.count();
+    beginRemoveRows(QModelIndex(), rows - removed.count(), rows - 1);
+    m_filteredRows.erase(m_filteredRows.end() - removed.count(), m_filteredRows.end());
+    foreach (const QString &host, removed)
+        m_historyHash.remove(host);
+    endRemoveRows();
+}
+
 void QuickViewFilterModel::sourceRowsRemoved(const QModelIndex &, int start, int end)
 {
-    Q_UNUSED(start);
-    Q_UNUSED(end);
+    // the offsets are counted from the end, keep them as they are
+    if(m_removingTail) {
+        m_removingTail = false;
+        m_tailOffsetBase += end - start + 1;
+        return;
+    }
     sourceReset();
 }
 
@@ -287,14 +341,18 @@ bool QuickViewFilterModel::removeRows(int row, int count, const QModelIndex &par
     if(row < 0 || count <= 0 || row + count > rowCount(parent) || parent.isValid())
         return false;
     int lastRow = row + count - 1;
+    disconnect(sourceModel(), SIGNAL(rowsAboutToBeRemoved(const QModelIndex &, int, int)),
+               this, SLOT(sourceRowsAboutToBeRemoved(const QModelIndex &, int, int)));
     disconnect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
                this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
     beginRemoveRows(parent, row, lastRow);
     int oldCount = rowCount();
-    int start = sourceModel()->rowCount() - m_filteredRows[row].tailOffset;
-    int end = sourceModel()->rowCount() - m_filteredRows[lastRow].tailOffset;
+    int start = sourceModel()->rowCount() + m_tailOffsetBase - m_filteredRows[row].tailOffset;
+    int end = sourceModel()->rowCount() + m_tailOffsetBase - m_filteredRows[lastRow].tailOffset;
     sourceModel()->removeRows(start, end - start + 1);
     endRemoveRows();
+    connect(sourceModel(), SIGNAL(rowsAboutToBeRemoved(const QModelIndex &, int, int)),
+            this, SLOT(sourceRowsAboutToBeRemoved(const QModelIndex &, int, int)));
     connect(sourceModel(), SIGNAL(rowsRemoved(const QModelIndex &, int, int)),
             this, SLOT(sourceRowsRemoved(const QModelIndex &, int, int)));
     m_loaded = false;
@@ -312,24 +370,16 @@ bool QuickViewFilterModel::isValid(const QUrl url)
            && url.isValid();
 }
 
-int QuickViewFilterModel::frecencyScore(const QModelIndex &sourceIndex) const
+/*
+    Every visit adds 100 to the frecency of its host as of when it was made,
+    which then halves every FrecencyHalfLife seconds.  The frecencies are
+    all kept as of m_referenceTime so that a visit only adds its own score
+    and their order does not change as time passes.
+*/
+qreal QuickViewFilterModel::frecencyScore(const QModelIndex &sourceIndex) const
 {
     QDateTime loadTime = sourceModel()->data(sourceIndex, HistoryModel::DateTimeRole).toDateTime();
-    int days = loadTime.daysTo(m_scaleTime);
-
-    if(days <= 1) {
-        return 100;
-    } else if(days < 5) {  // within the last 4 days
-        return 90;
-    } else if(days < 15) {  // within the last two weeks
-        return 70;
-    } else if(days < 31) {  // within the last month
-        return 50;
-    } else if(days < 91) {  // within the last 3 months
-        return 30;
-    }
-
-    return 10;
+    return 100 * pow(2.0, m_referenceTime.secsTo(loadTime) / FrecencyHalfLife);
 }
 
 
@@ -122,10 +122,6 @@ public:
      * @return true if the url is valid for our model
      */
     static bool isValid(const QUrl url);
-    /**
-     * Forces to check the frecencies of the entries
-     */
-    void recalculateFrecencies();
 
 private slots:
     /**
@@ -134,6 +130,7 @@ private slots:
     void sourceReset();
     void sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
     void sourceRowsInserted(const QModelIndex &parent, int start, int end);
+    void sourceRowsAboutToBeRemoved(const QModelIndex &parent, int start, int end);
     void sourceRowsRemoved(const QModelIndex &, int, int);
 
 private:
@@ -148,9 +145,9 @@ private:
      */
     struct HistoryData {
         int tailOffset;
-        int frecency;
+        qreal frecency;
 
-        HistoryData(int off, int f = 0) : tailOffset(off), frecency(f) { }
+        HistoryData(int off, qreal f = 0) : tailOffset(off), frecency(f) { }
 
         bool operator==(const HistoryData &other) const {
             return (tailOffset == other.tailOffset)
@@ -166,9 +163,9 @@ private:
     };
     /**
      * Computes the frecency of the entry pointed by sourceIndex
-     * @return the frecency score
+     * @return the frecency score of the visit as of m_referenceTime
      */
-    int frecencyScore(const QModelIndex &sourceIndex) const;
+    qreal frecencyScore(const QModelIndex &sourceIndex) const;
     /**
      * List of entries of history with their frecency value and pointer
      */
@@ -182,10 +179,19 @@ private:
      */
     mutable bool m_loaded;
     /**
-     * Holds the current date time to be used as reference for calculating
-     * the frecencies
+     * Holds the time the frecencies are kept as of, they are decayed from
+     * it to the current time when they are returned
+     */
+    mutable QDateTime m_referenceTime;
+    /**
+     * The number of source rows removed from the end since the history was
+     * loaded, the tail offsets are still counted from before them
+     */
+    mutable int m_tailOffsetBase;
+    /**
+     * Holds whether the rows being removed from the source are its last ones
      */
-    mutable QDateTime m_scaleTime;
+    bool m_removingTail;
 };
 
 
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer  <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "bloomfilter.h"
+
+// About one false positive in a hundred
+static const int BitsPerString = 10;
+static const int HashCount = 7;
+
+BloomFilter::BloomFilter(int capacity)
+    : m_bitCount(0)
+    , m_count(0)
+    , m_capacity(0)
+{
+    clear(capacity);
+}
+
+int BloomFilter::count() const
+{
+    return m_count;
+}
+
+int BloomFilter::capacity() const
+{
+    return m_capacity;
+}
+
+// A full filter finds more strings that were not inserted
+bool BloomFilter::isFull() const
+{
+    return m_count >= m_capacity;
+}
+
+/*
+    Removes every string, \a capacity is the number of strings the
+    filter is sized for, -1 keeps the current size.
+ */
+void BloomFilter::clear(int capacity)
+{
+    if (capacity >= 0) {
+        m_capacity = capacity;
+        m_bitCount = qMax(32, capacity * BitsPerString);
+        m_bits = QVector<quint32>((m_bitCount + 31) / 32, 0);
+    } else {
+        m_bits.fill(0);
+    }
+    m_count = 0;
+}
+
+/*
+    Two hashes of the string in one pass over it, every probe is taken
+    from them by double hashing.
+ */
+void BloomFilter::hash(const QString &string, uint &first, uint &second)
+{
+    first = 2166136261u;
+    second = 0;
+    const ushort *data = string.utf16();
+    for (int i = 0; i < string.length(); ++i) {
+        first = (first ^ data[i]) * 16777619u;
+        second = second * 31 + data[i];
+    }
+    // an even step would only reach half of the bits
+    second = (second ^ (second >> 16)) | 1;
+}
+
+void BloomFilter::insert(const QString &string)
+{
+    uint first;
+    uint second;
+    hash(string, first, second);
+    for (int i = 0; i < HashCount; ++i) {
+        uint bit = (first + i * second) % m_bitCount;
+        m_bits[bit / 32] |= (1u << (bit % 32));
+    }
+    ++m_count;
+}
+
+bool BloomFilter::mightContain(const QString &string) const
+{
+    if (m_count == 0)
+        return false;
+    uint first;
+    uint second;
+    hash(string, first, second);
+    for (int i = 0; i < HashCount; ++i) {
+        uint bit = (first + i * second) % m_bitCount;
+        if (!(m_bits.at(bit / 32) & (1u << (bit % 32))))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer  <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <qstring.h>
+#include <qvector.h>
+
+/*
+    A set of strings that can only say for sure that a string is not in it.
+    A string that was inserted is always found, one that was not is found
+    about one time in a hundred while no more strings than the capacity
+    are inserted.  Strings can not be removed, clear the filter and insert
+    the ones that are left instead.
+ */
+class BloomFilter
+{
+
+public:
+    BloomFilter(int capacity = 0);
+
+    int count() const;
+    int capacity() const;
+    bool isFull() const;
+
+    void clear(int capacity = -1);
+    void insert(const QString &string);
+    bool mightContain(const QString &string) const;
+
+private:
+    static void hash(const QString &string, uint &first, uint &second);
+
+    QVector<quint32> m_bits;
+    uint m_bitCount;
+    int m_count;
+    int m_capacity;
+};
+
+#endif // BLOOMFILTER_H
@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer  <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "fenwicktree.h"
+
+FenwickTree::FenwickTree(int size, int count)
+    : m_total(0)
+{
+    clear(size, count);
+}
+
+int FenwickTree::size() const
+{
+    return m_tree.count() - 1;
+}
+
+// The sum of every count
+int FenwickTree::total() const
+{
+    return m_total;
+}
+
+/*
+    Sets the size to \a size with \a count at every position, which
+    takes O(n) instead of appending them one at a time.
+ */
+void FenwickTree::clear(int size, int count)
+{
+    m_tree.resize(size + 1);
+    m_tree[0] = 0;
+    for (int i = 1; i <= size; ++i)
+        m_tree[i] = count * (i & -i);
+    m_total = count * size;
+}
+
+void FenwickTree::append(int count)
+{
+    int i = m_tree.count();
+    m_tree.append(count + sum(i - 1) - sum(i - (i & -i)));
+    m_total += count;
+}
+
+void FenwickTree::add(int position, int count)
+{
+    Q_ASSERT(position >= 0 && position < size());
+    for (int i = position + 1; i < m_tree.count(); i += i & -i)
+        m_tree[i] += count;
+    m_total += count;
+}
+
+// The sum of the counts before \a position
+int FenwickTree::sum(int position) const
+{
+    int sum = 0;
+    for (int i = position; i > 0; i -= i & -i)
+        sum += m_tree.at(i);
+    return sum;
+}
+
+/*
+    Returns the position whose count holds the sum \a sum, the one where
+    sum(position) <= sum < sum(position + 1), or size() if the total is
+    not more than \a sum.  The counts must not be negative.
+ */
+int FenwickTree::find(int sum) const
+{
+    int size = m_tree.count() - 1;
+    int step = 1;
+    while (step * 2 <= size)
+        step *= 2;
+
+    int position = 0;
+    for (; step > 0; step /= 2) {
+        if (position + step <= size && m_tree.at(position + step) <= sum) {
+            position += step;
+            sum -= m_tree.at(position);
+        }
+    }
+    return position;
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2009, Benjamin C. Meyer  <ben@meyerhome.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Benjamin Meyer nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef FENWICKTREE_H
+#define FENWICKTREE_H
+
+#include <qvector.h>
+
+/*
+    A count for every position from 0 to size() - 1 kept in a Fenwick
+    tree.  Changing a count, adding a position at the end, summing the
+    counts before a position and finding the position a sum falls in all
+    take O(log n), so with counts of 0 and 1 it is a set that knows the
+    rank of every position in it.
+ */
+class FenwickTree
+{
+
+public:
+    FenwickTree(int size = 0, int count = 0);
+
+    int size() const;
+    int total() const;
+
+    void clear(int size = 0, int count = 0);
+    void append(int count = 0);
+    void add(int position, int count);
+    int sum(int position) const;
+    int find(int sum) const;
+
+private:
+    // m_tree[i] is the sum of the counts from i - (i & -i) to i - 1
+    QVector<int> m_tree;
+    int m_total;
+};
+
+#endif // FENWICKTREE_H
@@ -2,9 +2,11 @@ INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
 HEADERS += \
+    bloomfilter.h \
     editlistview.h \
     edittableview.h \
     edittreeview.h \
+    fenwicktree.h \
     languagemanager.h \
     lineedit.h \
     lineedit_p.h \
@@ -16,9 +18,11 @@ HEADERS += \
     webpageproxy.h
 
 SOURCES += \
+    bloomfilter.cpp \
     editlistview.cpp \
     edittableview.cpp \
     edittreeview.cpp \
+    fenwicktree.cpp \
     languagemanager.cpp \
     lineedit.cpp \
     networkaccessmanagerproxy.cpp \
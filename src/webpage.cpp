@@ -100,6 +100,7 @@ WebPage::WebPage(QObject *parent)
     , m_openTargetBlankLinksIn(TabWidget::NewWindow)
     , m_javaScriptExternalObject(0)
     , m_javaScriptAroraObject(0)
+    , lastRequestSubFrame(false)
 {
     setPluginFactory(webPluginFactory());
     NetworkAccessManagerProxy *networkManagerProxy = new NetworkAccessManagerProxy(this);
@@ -193,6 +194,9 @@ void WebPage::populateNetworkRequest(QNetworkRequest &request)
 {
     if (request == lastRequest) {
         request.setAttribute((QNetworkRequest::Attribute)(pageAttributeId() + 1), lastRequestType);
+        // the navigation loads a frame inside the page, not the page itself
+        if (lastRequestSubFrame)
+            request.setAttribute((QNetworkRequest::Attribute)(pageAttributeId() + 2), true);
     }
     WebPageProxy::populateNetworkRequest(request);
 }
@@ -257,6 +261,7 @@ bool WebPage::acceptNavigationRequest(QWebFrame *frame, const QNetworkRequest &r
 {
     lastRequest = request;
     lastRequestType = type;
+    lastRequestSubFrame = frame && frame != mainFrame();
 
     QString scheme = request.url().scheme();
     if (scheme == QLatin1String("mailto")